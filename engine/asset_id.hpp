@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Asset name hashed into number, thus lookups by it don't touch strings at all.
+// Hash of literal gets computed at compile time:
+//     static constexpr AssetId BUTTON = "button_default"_id;
+//     sprites[BUTTON];
+// That's 64-bit FNV-1a. Collisions between few thousands of names are very
+// unlikely, but storages check for these anyway once they build their tables.
+class AssetId {
+private:
+    uint64_t value = 0;
+
+public:
+    static constexpr uint64_t OFFSET_BASIS = 0xcbf29ce484222325ull;
+    static constexpr uint64_t PRIME = 0x100000001b3ull;
+
+    constexpr AssetId() = default;
+
+    constexpr explicit AssetId(std::string_view name)
+        : value(hash(name)) {
+    }
+
+    static constexpr uint64_t hash(std::string_view name) {
+        uint64_t result = OFFSET_BASIS;
+        for (char c : name) {
+            result ^= static_cast<unsigned char>(c);
+            result *= PRIME;
+        }
+        return result;
+    }
+
+    constexpr uint64_t get_value() const {
+        return value;
+    }
+
+    constexpr bool operator==(const AssetId& other) const {
+        return value == other.value;
+    }
+
+    constexpr bool operator!=(const AssetId& other) const {
+        return value != other.value;
+    }
+
+    constexpr bool operator<(const AssetId& other) const {
+        return value < other.value;
+    }
+};
+
+constexpr AssetId operator""_id(const char* name, size_t size) {
+    return AssetId(std::string_view(name, size));
+}
+
+// Flat table of values by their ids. Entries get added in whatever order, then
+// sorted once by build() - after that, find() is binary search over contiguous
+// array, without allocations or string compares.
+template <typename V> class AssetIdTable {
+private:
+    struct Entry {
+        uint64_t id;
+        V value;
+    };
+
+    std::vector<Entry> entries;
+
+public:
+    void clear() {
+        entries.clear();
+    }
+
+    void reserve(size_t amount) {
+        entries.reserve(amount);
+    }
+
+    void add(AssetId id, V value) {
+        entries.push_back({id.get_value(), value});
+    }
+
+    // Sort entries. Calls on_collision(const V&, const V&) for each pair of
+    // values that have ended up with the same id - one of these will be
+    // unreachable.
+    template <typename F> void build(F on_collision) {
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.id < b.id;
+        });
+        for (size_t i = 1; i < entries.size(); i++) {
+            if (entries[i].id == entries[i - 1].id) {
+                on_collision(entries[i - 1].value, entries[i].value);
+            }
+        }
+    }
+
+    // Value with that id, or nullptr. Table must be built.
+    const V* find(AssetId id) const {
+        size_t amount = entries.size();
+        if (amount == 0) {
+            return nullptr;
+        }
+
+        // Halving without early exit - the only branch in loop is its condition,
+        // and the comparison compiles into cmov
+        const Entry* base = entries.data();
+        while (amount > 1) {
+            size_t half = amount / 2;
+            base = base[half].id <= id.get_value() ? base + half : base;
+            amount -= half;
+        }
+        return base->id == id.get_value() ? &base->value : nullptr;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+};
@@ -0,0 +1,299 @@
+#include "asset_pack.hpp"
+#include "raylib.h"
+#include "spdlog/spdlog.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
+// PackData
+PackData::PackData(const unsigned char* _data, size_t _size, unsigned char* _buffer)
+    : data(_data)
+    , size(_size)
+    , buffer(_buffer) {
+}
+
+PackData::~PackData() {
+    if (buffer != nullptr) {
+        MemFree(buffer);
+    }
+}
+
+PackData::PackData(PackData&& other) noexcept
+    : data(other.data)
+    , size(other.size)
+    , buffer(other.buffer) {
+    other.data = nullptr;
+    other.size = 0;
+    other.buffer = nullptr;
+}
+
+PackData& PackData::operator=(PackData&& other) noexcept {
+    if (this != &other) {
+        if (buffer != nullptr) {
+            MemFree(buffer);
+        }
+        data = other.data;
+        size = other.size;
+        buffer = other.buffer;
+        other.data = nullptr;
+        other.size = 0;
+        other.buffer = nullptr;
+    }
+    return *this;
+}
+
+// AssetPack
+bool AssetPack::validate() {
+    size_t file_size = file.get_size();
+    auto fail = [&](const char* reason) {
+        spdlog::warn("Asset pack {} is broken: {}", path, reason);
+        return false;
+    };
+
+    if (file_size < sizeof(Header)) {
+        return fail("too small to be a pack");
+    }
+
+    const Header* header = reinterpret_cast<const Header*>(file.get_data());
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        return fail("not an asset pack");
+    }
+    if (header->version != VERSION) {
+        return fail("unsupported version");
+    }
+    if (header->byte_order != ORDER_MARK) {
+        return fail("made on platform with different byte order");
+    }
+    if (header->file_size != file_size) {
+        return fail("size doesn't match the header, file may be truncated");
+    }
+    if (header->entries_amount > (file_size - sizeof(Header)) / sizeof(Entry)) {
+        return fail("index is out of file");
+    }
+    if (header->names_offset > file_size ||
+        header->names_size > file_size - header->names_offset) {
+        return fail("names are out of file");
+    }
+
+    entries = reinterpret_cast<const Entry*>(file.get_data() + sizeof(Header));
+    entries_amount = static_cast<size_t>(header->entries_amount);
+    names = reinterpret_cast<const char*>(file.get_data() + header->names_offset);
+
+    // Lookups trust index blindly, thus everything gets checked once there
+    for (size_t i = 0; i < entries_amount; i++) {
+        const Entry& entry = entries[i];
+        if (static_cast<uint64_t>(entry.name_offset) + entry.name_size >
+            header->names_size) {
+            return fail("file name is out of names");
+        }
+        if (entry.offset > file_size || entry.size > file_size - entry.offset) {
+            return fail("file is out of pack");
+        }
+        if (entry.compression > static_cast<uint32_t>(PackCompression::Deflate)) {
+            return fail("unknown compression");
+        }
+        if (entry.compression == static_cast<uint32_t>(PackCompression::None) &&
+            entry.size != entry.unpacked_size) {
+            return fail("stored file has wrong size");
+        }
+        if (entry.compression == static_cast<uint32_t>(PackCompression::Deflate) &&
+            entry.unpacked_size > MAX_DEFLATE_SIZE) {
+            return fail("deflated file is too large to unpack");
+        }
+        // raylib takes sizes as int
+        uint64_t max_size = static_cast<uint64_t>(std::numeric_limits<int>::max());
+        if (entry.size > max_size || entry.unpacked_size > max_size) {
+            return fail("file is too large");
+        }
+        if (i > 0 && !(get_name(entries[i - 1]) < get_name(entry))) {
+            return fail("index isn't sorted");
+        }
+    }
+
+    return true;
+}
+
+bool AssetPack::open(const std::string& _path) {
+    close();
+    path = _path;
+
+    if (!file.open(path, false)) {
+        return false;
+    }
+
+    if (!validate()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void AssetPack::close() {
+    file.close();
+    entries = nullptr;
+    entries_amount = 0;
+    names = nullptr;
+}
+
+bool AssetPack::write(
+    const std::string& _path, std::vector<PackSource> sources, bool compress) {
+    std::sort(sources.begin(), sources.end(), [](const auto& a, const auto& b) {
+        return a.name < b.name;
+    });
+    for (size_t i = 1; i < sources.size(); i++) {
+        if (sources[i].name == sources[i - 1].name) {
+            spdlog::warn(
+                "Unable to write asset pack: {} is there twice", sources[i].name);
+            return false;
+        }
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = ORDER_MARK;
+    header.entries_amount = sources.size();
+    header.names_offset = sizeof(Header) + sources.size() * sizeof(Entry);
+
+    std::vector<Entry> index(sources.size());
+    std::string all_names;
+    for (size_t i = 0; i < sources.size(); i++) {
+        index[i].name_offset = static_cast<uint32_t>(all_names.size());
+        index[i].name_size = static_cast<uint32_t>(sources[i].name.size());
+        all_names += sources[i].name;
+    }
+    header.names_size = all_names.size();
+
+    std::string temp_path = _path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        spdlog::warn("Unable to write asset pack {}", temp_path);
+        return false;
+    }
+
+    // Header and index are written last, once offsets are known
+    uint64_t offset = header.names_offset;
+    out.seekp(static_cast<std::streamoff>(offset));
+    out.write(all_names.data(), static_cast<std::streamsize>(all_names.size()));
+    offset += all_names.size();
+
+    static const char zeros[DATA_ALIGNMENT] = {};
+    std::error_code error;
+    for (size_t i = 0; i < sources.size(); i++) {
+        std::ifstream in(sources[i].path, std::ios::binary);
+        if (!in) {
+            spdlog::warn("Unable to read {}", sources[i].path);
+            out.close();
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+        std::vector<unsigned char> contents(
+            (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (contents.size() > static_cast<size_t>(std::numeric_limits<int>::max())) {
+            spdlog::warn("Unable to pack {}: file is too large", sources[i].path);
+            out.close();
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+
+        uint64_t padding = (DATA_ALIGNMENT - offset % DATA_ALIGNMENT) % DATA_ALIGNMENT;
+        out.write(zeros, static_cast<std::streamsize>(padding));
+        offset += padding;
+
+        Entry& entry = index[i];
+        entry.offset = offset;
+        entry.unpacked_size = contents.size();
+        entry.compression = static_cast<uint32_t>(PackCompression::None);
+        const unsigned char* blob = contents.data();
+        size_t blob_size = contents.size();
+
+        unsigned char* compressed = nullptr;
+        if (compress && !contents.empty() && contents.size() <= MAX_DEFLATE_SIZE) {
+            int compressed_size = 0;
+            compressed = CompressData(
+                contents.data(), static_cast<int>(contents.size()), &compressed_size);
+            size_t limit = contents.size() - contents.size() / 8;
+            if (compressed != nullptr && static_cast<size_t>(compressed_size) <= limit) {
+                entry.compression = static_cast<uint32_t>(PackCompression::Deflate);
+                blob = compressed;
+                blob_size = static_cast<size_t>(compressed_size);
+            }
+        }
+
+        entry.size = blob_size;
+        out.write(
+            reinterpret_cast<const char*>(blob), static_cast<std::streamsize>(blob_size));
+        offset += blob_size;
+        if (compressed != nullptr) {
+            MemFree(compressed);
+        }
+    }
+
+    header.file_size = offset;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    out.write(
+        reinterpret_cast<const char*>(index.data()),
+        static_cast<std::streamsize>(index.size() * sizeof(Entry)));
+    out.close();
+
+    if (out.fail()) {
+        spdlog::warn("Unable to write asset pack {}", temp_path);
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    std::filesystem::rename(temp_path, _path, error);
+    if (error) {
+        spdlog::warn("Unable to replace asset pack {}: {}", _path, error.message());
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    return true;
+}
+
+const AssetPack::Entry* AssetPack::find(std::string_view name) const {
+    const Entry* entry = lower_bound(name);
+    if (entry != entries + entries_amount && get_name(*entry) == name) {
+        return entry;
+    }
+    return nullptr;
+}
+
+PackData AssetPack::read(const Entry& entry) const {
+    const unsigned char* blob = file.get_data() + entry.offset;
+    if (entry.compression == static_cast<uint32_t>(PackCompression::None)) {
+        return PackData(blob, static_cast<size_t>(entry.size), nullptr);
+    }
+
+    int unpacked_size = 0;
+    unsigned char* buffer =
+        DecompressData(blob, static_cast<int>(entry.size), &unpacked_size);
+    bool is_unpacked = buffer != nullptr &&
+                       static_cast<uint64_t>(unpacked_size) == entry.unpacked_size;
+    if (!is_unpacked) {
+        spdlog::warn("Unable to unpack {} from {}", get_name(entry), path);
+        if (buffer != nullptr) {
+            MemFree(buffer);
+        }
+        return PackData();
+    }
+    return PackData(buffer, static_cast<size_t>(unpacked_size), buffer);
+}
+
+std::string AssetPack::get_stem(std::string_view name) {
+    size_t slash = name.rfind('/');
+    if (slash != std::string_view::npos) {
+        name.remove_prefix(slash + 1);
+    }
+    size_t dot = name.rfind('.');
+    if (dot != std::string_view::npos && dot > 0) {
+        name.remove_suffix(name.size() - dot);
+    }
+    return std::string(name);
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Pack of asset files - single file with sorted index of names, followed by
+// contents of files back to back. Pack gets memory-mapped and read in place,
+// thus there is one open() per pack no matter how many files it has, and file
+// lookup is binary search over index - without any filesystem calls.
+// Contents may be deflated (with raylib's CompressData), which is worth it for
+// uncompressed formats like wav. Pngs and oggs are better stored as is.
+// Like map files, packs are in native byte order.
+
+enum class PackCompression : uint32_t {
+    None,
+    Deflate
+};
+
+// Contents of packed file. Stored files point right into mapped pack, while
+// deflated ones get unpacked into buffer owned by this.
+class PackData {
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    unsigned char* buffer = nullptr;
+
+public:
+    PackData() = default;
+    PackData(const unsigned char* _data, size_t _size, unsigned char* _buffer);
+    ~PackData();
+
+    PackData(const PackData&) = delete;
+    PackData& operator=(const PackData&) = delete;
+    PackData(PackData&& other) noexcept;
+    PackData& operator=(PackData&& other) noexcept;
+
+    const unsigned char* get_data() const {
+        return data;
+    }
+
+    size_t get_size() const {
+        return size;
+    }
+
+    bool is_valid() const {
+        return data != nullptr;
+    }
+
+    // Whether data lives in pack itself (thus stays valid while pack is open),
+    // rather than in buffer of this
+    bool is_in_place() const {
+        return buffer == nullptr;
+    }
+};
+
+// File to put into pack
+struct PackSource {
+    // What file will be looked up by, with '/' between directories
+    std::string name;
+    std::string path;
+};
+
+class AssetPack {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    struct Entry {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t unpacked_size;
+        uint32_t name_offset;
+        uint32_t name_size;
+        uint32_t compression;
+        uint32_t reserved;
+    };
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        // Must read as ORDER_MARK, else pack has been made on other platform
+        uint32_t byte_order;
+        uint64_t entries_amount;
+        uint64_t names_offset;
+        uint64_t names_size;
+        uint64_t file_size;
+    };
+
+    static constexpr char MAGIC[8] = {'M', 'B', 'A', 'S', 'S', 'E', 'T', 'S'};
+    static constexpr uint32_t ORDER_MARK = 0x01020304;
+    static constexpr uint64_t DATA_ALIGNMENT = 16;
+    // raylib's DecompressData() unpacks into fixed buffer of that size
+    // (MAX_DECOMPRESSION_SIZE), cutting off the rest. Larger files get stored.
+    static constexpr uint64_t MAX_DEFLATE_SIZE = 64 * 1024 * 1024;
+
+    MappedFile file;
+    std::string path;
+    const Entry* entries = nullptr;
+    size_t entries_amount = 0;
+    const char* names = nullptr;
+
+    // Check that index points within file and is sorted. Logs what's wrong.
+    bool validate();
+
+    // First entry with name not less than specified one
+    const Entry* lower_bound(std::string_view name) const {
+        return std::lower_bound(
+            entries, entries + entries_amount, name, [this](const Entry& e, auto n) {
+                return get_name(e) < n;
+            });
+    }
+
+public:
+    AssetPack() = default;
+
+    // Map pack and check its index
+    bool open(const std::string& _path);
+    void close();
+
+    // Write pack out of files. With compress, files get deflated if that saves
+    // at least 1/8 of their size and these aren't over MAX_DEFLATE_SIZE. Pack is
+    // written next to the old one first, thus if that fails midway - old one
+    // stays intact.
+    static bool write(
+        const std::string& _path, std::vector<PackSource> sources, bool compress);
+
+    bool is_open() const {
+        return file.is_open();
+    }
+
+    const std::string& get_path() const {
+        return path;
+    }
+
+    size_t get_entries_amount() const {
+        return entries_amount;
+    }
+
+    const Entry& get_entry(size_t index) const {
+        return entries[index];
+    }
+
+    std::string_view get_name(const Entry& entry) const {
+        return {names + entry.name_offset, entry.name_size};
+    }
+
+    // Entry with exactly that name, or nullptr
+    const Entry* find(std::string_view name) const;
+
+    // Contents of entry. Invalid if these can't be unpacked.
+    PackData read(const Entry& entry) const;
+
+    // Call fn(const Entry&) for each file right within directory (but not
+    // within its subdirectories) with name ending with extension. Empty
+    // directory means root of pack. Files come in order of their names.
+    template <typename F>
+    void for_each_file(
+        std::string_view directory, std::string_view extension, F fn) const {
+        while (!directory.empty() && directory.back() == '/') {
+            directory.remove_suffix(1);
+        }
+        std::string prefix(directory);
+        if (!prefix.empty()) {
+            prefix += '/';
+        }
+
+        // Files of directory are next to each other, since index is sorted
+        for (const Entry* entry = lower_bound(prefix); entry != entries + entries_amount;
+             entry++) {
+            std::string_view name = get_name(*entry);
+            if (name.compare(0, prefix.size(), prefix) != 0) {
+                break;
+            }
+            std::string_view rest = name.substr(prefix.size());
+            bool is_nested = rest.find('/') != std::string_view::npos;
+            bool has_extension =
+                rest.size() >= extension.size() &&
+                rest.substr(rest.size() - extension.size()) == extension;
+            if (is_nested || !has_extension) {
+                continue;
+            }
+            fn(*entry);
+        }
+    }
+
+    // File name without directories and extension, same as what storages use
+    // as keys of loaded files
+    static std::string get_stem(std::string_view name);
+};
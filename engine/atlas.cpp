@@ -0,0 +1,117 @@
+#include "atlas.hpp"
+
+#include <algorithm>
+
+SkylinePacker::SkylinePacker(int _width, int _height, int _padding)
+    : width(_width)
+    , height(_height)
+    , padding(_padding) {
+    // Rects are packed with padding added to their right and bottom sides, thus
+    // space is extended by it too - else rects at the edges would lose a row
+    skyline.push_back({0, 0, width + padding});
+}
+
+int SkylinePacker::fit(size_t index, int rect_width, int rect_height) const {
+    if (skyline[index].x + rect_width > width + padding) {
+        return -1;
+    }
+
+    int y = 0;
+    int width_left = rect_width;
+    for (size_t i = index; width_left > 0; i++) {
+        // Skyline always spans whole width, thus this never runs past its end
+        y = std::max(y, skyline[i].y);
+        if (y + rect_height > height + padding) {
+            return -1;
+        }
+        width_left -= skyline[i].width;
+    }
+    return y;
+}
+
+bool SkylinePacker::pack(int rect_width, int rect_height, int& x, int& y) {
+    int padded_width = rect_width + padding;
+    int padded_height = rect_height + padding;
+
+    size_t best_index = skyline.size();
+    int best_top = height + padding + 1;
+    int best_y = 0;
+    for (size_t i = 0; i < skyline.size(); i++) {
+        int fit_y = fit(i, padded_width, padded_height);
+        if (fit_y >= 0 && fit_y + padded_height < best_top) {
+            best_index = i;
+            best_top = fit_y + padded_height;
+            best_y = fit_y;
+        }
+    }
+    if (best_index == skyline.size()) {
+        return false;
+    }
+
+    x = skyline[best_index].x;
+    y = best_y;
+    skyline.insert(skyline.begin() + best_index, {x, best_top, padded_width});
+
+    // Segments under the new one get cut or removed
+    size_t next = best_index + 1;
+    while (next < skyline.size() && skyline[next].x < x + padded_width) {
+        int overlap = x + padded_width - skyline[next].x;
+        if (overlap < skyline[next].width) {
+            skyline[next].x += overlap;
+            skyline[next].width -= overlap;
+            break;
+        }
+        skyline.erase(skyline.begin() + next);
+    }
+
+    // Neighbours of the same height become one, to keep the list short
+    for (size_t i = 0; i + 1 < skyline.size();) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        }
+        else {
+            i++;
+        }
+    }
+
+    used_area += static_cast<size_t>(rect_width) * rect_height;
+    return true;
+}
+
+int SkylinePacker::get_used_height() const {
+    int top = 0;
+    for (const auto& segment : skyline) {
+        top = std::max(top, segment.y);
+    }
+    return std::max(top - padding, 0);
+}
+
+// Main thread only, like the rest of drawing
+static TextureBindStats current_binds;
+static TextureBindStats last_binds;
+static unsigned int last_texture_id = 0;
+static unsigned int last_source_id = 0;
+static bool has_bound = false;
+
+void count_texture_bind(unsigned int texture_id, unsigned int source_id) {
+    if (!has_bound || texture_id != last_texture_id) {
+        current_binds.switches++;
+    }
+    if (!has_bound || source_id != last_source_id) {
+        current_binds.unpacked_switches++;
+    }
+    last_texture_id = texture_id;
+    last_source_id = source_id;
+    has_bound = true;
+}
+
+void finish_texture_bind_frame() {
+    last_binds = current_binds;
+    current_binds = {};
+    has_bound = false;
+}
+
+TextureBindStats get_texture_bind_stats() {
+    return last_binds;
+}
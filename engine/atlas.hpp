@@ -0,0 +1,81 @@
+#pragma once
+
+#include "raylib.h"
+
+#include <cstddef>
+#include <vector>
+
+// Texture atlases - many small images packed into few large textures, so
+// drawing them doesn't make raylib flush its batch on each texture switch.
+
+// Part of texture to draw, same pair Sprite is made of
+struct AtlasRegion {
+    const Texture2D* texture;
+    Rectangle rect;
+    // Id texture would have without atlas. Only used to count how many texture
+    // switches atlas saves.
+    unsigned int source_id;
+};
+
+// Skyline bottom-left packer. Keeps top edge of what's been packed so far as
+// list of horizontal segments, and puts each rect as low as possible on it.
+// Rects should be fed largest first, tallest ones preferably.
+class SkylinePacker {
+private:
+    struct Segment {
+        int x;
+        int y;
+        int width;
+    };
+
+    int width;
+    int height;
+    // Gap between rects, so filtering doesn't bleed neighbours into each other
+    int padding;
+    std::vector<Segment> skyline;
+    size_t used_area = 0;
+
+    // Lowest y rect of that width may be placed at, starting at segment
+    // index. Negative if it doesn't fit there.
+    int fit(size_t index, int rect_width, int rect_height) const;
+
+public:
+    SkylinePacker(int width, int height, int padding);
+
+    // Find place for rect and reserve it. Returns false if there is no space.
+    bool pack(int rect_width, int rect_height, int& x, int& y);
+
+    // Bottom of the highest packed rect, texture may be cropped to that
+    int get_used_height() const;
+
+    // Area of packed rects, without padding
+    size_t get_used_area() const {
+        return used_area;
+    }
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
+    }
+};
+
+// Texture switches between consecutive draws during the last frame. Engine's
+// draw calls (sprites, buttons, text) report what they bind.
+struct TextureBindStats {
+    size_t switches = 0;
+    // Amount there would be if each atlas region was texture of its own
+    size_t unpacked_switches = 0;
+};
+
+// Report draw with texture_id. For atlas regions source_id is their own id,
+// for everything else it's the same as texture_id.
+void count_texture_bind(unsigned int texture_id, unsigned int source_id);
+
+// Move current frame's numbers to what get_texture_bind_stats() returns. Called
+// by SceneManager after each frame.
+void finish_texture_bind_frame();
+
+TextureBindStats get_texture_bind_stats();
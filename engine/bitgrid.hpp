@@ -0,0 +1,189 @@
+#pragma once
+
+#include "mapgen.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+// Amount of set bits in word. Written by hand, coz __builtin_popcount does not
+// exist on msvc - compilers recognize this pattern and emit popcnt anyway.
+inline int count_bits(uint64_t word) {
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return static_cast<int>((word * 0x0101010101010101ull) >> 56);
+}
+
+// Position of the lowest and the highest set bit. Word must not be zero.
+inline int lowest_bit(uint64_t word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+inline int highest_bit(uint64_t word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, word);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(word);
+#endif
+}
+
+// Packed grid of bits, one per tile. Each row starts on its own 64-bit word,
+// so rows can be processed word by word without caring about neighbours.
+// Used to keep per-tile flags (passability, opacity, visibility, etc) in a form
+// that is 32 times smaller than vector<int> and is cheap to scan.
+class BitGrid {
+private:
+    int width = 0;
+    int height = 0;
+    size_t words_per_row = 0;
+    std::vector<uint64_t> words;
+
+public:
+    BitGrid() = default;
+
+    BitGrid(int _width, int _height)
+        : width(_width)
+        , height(_height)
+        , words_per_row((static_cast<size_t>(_width) + 63) / 64)
+        , words(words_per_row * _height, 0) {
+    }
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
+    }
+
+    size_t get_words_per_row() const {
+        return words_per_row;
+    }
+
+    bool is_inside(int x, int y) const {
+        return 0 <= x && x < width && 0 <= y && y < height;
+    }
+
+    // These don't check bounds. Use is_inside() or get_or() for that.
+    bool get(int x, int y) const {
+        return (words[y * words_per_row + (x >> 6)] >> (x & 63)) & 1u;
+    }
+
+    void set(int x, int y, bool value) {
+        uint64_t& word = words[y * words_per_row + (x >> 6)];
+        uint64_t mask = uint64_t(1) << (x & 63);
+        if (value) {
+            word |= mask;
+        }
+        else {
+            word &= ~mask;
+        }
+    }
+
+    // Same as get(), but returns fallback for out-of-bounds coordinates
+    bool get_or(int x, int y, bool fallback) const {
+        if (!is_inside(x, y)) {
+            return fallback;
+        }
+        return get(x, y);
+    }
+
+    // Grid index based versions, to use with tile maps of the same size
+    bool get_index(size_t index) const {
+        return get(index % width, index / width);
+    }
+
+    void set_index(size_t index, bool value) {
+        set(index % width, index / width, value);
+    }
+
+    void fill(bool value) {
+        std::fill(words.begin(), words.end(), value ? ~uint64_t(0) : 0);
+        if (value) {
+            clear_padding();
+        }
+    }
+
+    // Bits past width in the last word of each row must stay zero, else
+    // counting and word-wise operations would go bananas.
+    void clear_padding() {
+        int tail = width & 63;
+        if (tail == 0) {
+            return;
+        }
+
+        uint64_t mask = (uint64_t(1) << tail) - 1;
+        for (int y = 0; y < height; y++) {
+            words[y * words_per_row + words_per_row - 1] &= mask;
+        }
+    }
+
+    uint64_t* get_row(int y) {
+        return words.data() + y * words_per_row;
+    }
+
+    const uint64_t* get_row(int y) const {
+        return words.data() + y * words_per_row;
+    }
+
+    size_t count() const {
+        size_t amount = 0;
+        for (auto i : words) {
+            amount += static_cast<size_t>(count_bits(i));
+        }
+        return amount;
+    }
+
+    size_t get_memory_size() const {
+        return words.size() * sizeof(uint64_t);
+    }
+};
+
+// Build bit grid of the same size as map, with bit set for each tile that has
+// at least one object matching the predicate (say, walls for passability).
+template <typename T>
+BitGrid make_tile_mask(TileMapBase<T>& map, const std::function<bool(T)>& predicate) {
+    Point map_size = map.get_map_size();
+    BitGrid mask(map_size.x, map_size.y);
+
+    size_t grid_index = 0;
+    for (int y = 0; y < map_size.y; y++) {
+        for (int x = 0; x < map_size.x; x++, grid_index++) {
+            bool value = false;
+            map.for_each_object_id(grid_index, [&](int object_id) {
+                value = value || predicate(map.get_object_by_id(object_id));
+            });
+            mask.set(x, y, value);
+        }
+    }
+
+    return mask;
+}
+
+// Re-evaluate single tile of mask. Call it after changing tile's content.
+template <typename T>
+void update_tile_mask(
+    BitGrid& mask,
+    TileMapBase<T>& map,
+    size_t grid_index,
+    const std::function<bool(T)>& predicate) {
+    bool value = false;
+    map.for_each_object_id(grid_index, [&](int object_id) {
+        value = value || predicate(map.get_object_by_id(object_id));
+    });
+    mask.set_index(grid_index, value);
+}
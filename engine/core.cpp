@@ -9,9 +9,11 @@
 #endif
 
 void TraceLog(int logLevel, const char* text, va_list args) {
-    static char log_text[2048] = {0}; // I think 2048 would be enough?
+    // I think 2048 would be enough? Per thread, since assets get decoded
+    // on workers, and raylib logs from there too.
+    thread_local char log_text[2048] = {0};
     // Doing this via std, coz fmt's function went bananas on some types.
-    std::vsprintf(log_text, text, args);
+    std::vsnprintf(log_text, sizeof(log_text), text, args);
 
     switch (logLevel) {
     case LOG_TRACE:
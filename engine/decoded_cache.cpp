@@ -0,0 +1,233 @@
+#include "decoded_cache.hpp"
+#include "asset_id.hpp"
+#include "mapped_file.hpp"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+// CacheSource
+CacheSource CacheSource::from_file(const std::string& path) {
+    return {path, path};
+}
+
+CacheSource CacheSource::from_pack(const AssetPack& pack, const AssetPack::Entry& entry) {
+    // Whole pack counts as changed once it's rewritten, which is fine - that's
+    // when its files have changed anyway
+    std::string key = pack.get_path() + ':' + std::string(pack.get_name(entry));
+    return {key, pack.get_path()};
+}
+
+// DecodedCache
+std::string DecodedCache::get_cache_path(const std::string& key) const {
+    return fmt::format("{}/{:016x}.bin", directory, AssetId::hash(key));
+}
+
+bool DecodedCache::get_fingerprint(
+    const std::string& file, uint64_t& size, int64_t& time) {
+    std::error_code error;
+    auto file_size = std::filesystem::file_size(file, error);
+    if (error) {
+        return false;
+    }
+    auto write_time = std::filesystem::last_write_time(file, error);
+    if (error) {
+        return false;
+    }
+    size = static_cast<uint64_t>(file_size);
+    time = static_cast<int64_t>(write_time.time_since_epoch().count());
+    return true;
+}
+
+bool DecodedCache::open(const std::string& _directory) {
+    close();
+
+    std::error_code error;
+    std::filesystem::create_directories(_directory, error);
+    if (error) {
+        spdlog::warn("Unable to use {} for cache: {}", _directory, error.message());
+        return false;
+    }
+
+    directory = _directory;
+    while (directory.size() > 1 && directory.back() == '/') {
+        directory.pop_back();
+    }
+    return true;
+}
+
+void DecodedCache::close() {
+    directory.clear();
+}
+
+unsigned char* DecodedCache::read_entry(
+    const CacheSource& source, Kind kind, uint32_t params[4], size_t& data_size) {
+    if (!is_open()) {
+        return nullptr;
+    }
+
+    uint64_t source_size = 0;
+    int64_t source_time = 0;
+    std::string path = get_cache_path(source.key);
+    std::error_code error;
+    // Checking first, since missing cache is not worth a warning from MappedFile
+    if (!get_fingerprint(source.file, source_size, source_time) ||
+        !std::filesystem::exists(path, error)) {
+        misses++;
+        return nullptr;
+    }
+
+    MappedFile file;
+    if (!file.open(path, false) || file.get_size() < sizeof(Header)) {
+        misses++;
+        return nullptr;
+    }
+
+    Header header;
+    std::memcpy(&header, file.get_data(), sizeof(Header));
+    const char* key = reinterpret_cast<const char*>(file.get_data() + sizeof(Header));
+    bool is_fresh = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                    header.version == VERSION &&
+                    header.kind == static_cast<uint32_t>(kind) &&
+                    header.source_size == source_size &&
+                    header.source_time == source_time &&
+                    header.key_size == source.key.size() &&
+                    header.data_offset >= sizeof(Header) + header.key_size &&
+                    header.data_offset <= file.get_size() &&
+                    header.data_size == file.get_size() - header.data_offset &&
+                    // Different source with the same hash of name
+                    std::memcmp(key, source.key.data(), source.key.size()) == 0;
+    if (!is_fresh) {
+        misses++;
+        return nullptr;
+    }
+
+    // Exact size of whatever params describe is checked by callers
+    data_size = static_cast<size_t>(header.data_size);
+    unsigned char* data = static_cast<unsigned char*>(
+        MemAlloc(static_cast<unsigned int>(std::max<size_t>(data_size, 1))));
+    std::memcpy(data, file.get_data() + header.data_offset, data_size);
+    std::memcpy(params, header.params, sizeof(header.params));
+    hits++;
+    return data;
+}
+
+void DecodedCache::write_entry(
+    const CacheSource& source,
+    Kind kind,
+    const uint32_t params[4],
+    const void* data,
+    size_t data_size) {
+    if (!is_open()) {
+        return;
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.kind = static_cast<uint32_t>(kind);
+    if (!get_fingerprint(source.file, header.source_size, header.source_time)) {
+        return;
+    }
+    header.key_size = source.key.size();
+    uint64_t key_end = sizeof(Header) + header.key_size;
+    header.data_offset = (key_end + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+    header.data_size = data_size;
+    std::memcpy(header.params, params, sizeof(header.params));
+
+    // Workers may cache the same source at once, thus each of them writes a
+    // file of its own and then replaces cache with it
+    std::string path = get_cache_path(source.key);
+    std::string temp_path = fmt::format(
+        "{}.{:x}.tmp", path, std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    static const char zeros[DATA_ALIGNMENT] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    out.write(source.key.data(), static_cast<std::streamsize>(source.key.size()));
+    out.write(zeros, static_cast<std::streamsize>(header.data_offset - key_end));
+    out.write(static_cast<const char*>(data), static_cast<std::streamsize>(data_size));
+    out.close();
+
+    std::error_code error;
+    if (out.fail()) {
+        spdlog::warn("Unable to cache {} in {}", source.key, temp_path);
+        std::filesystem::remove(temp_path, error);
+        return;
+    }
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        spdlog::warn("Unable to cache {}: {}", source.key, error.message());
+        std::filesystem::remove(temp_path, error);
+    }
+}
+
+bool DecodedCache::read(const CacheSource& source, Image& image) {
+    uint32_t params[4];
+    size_t data_size = 0;
+    unsigned char* data = read_entry(source, Kind::Image, params, data_size);
+    if (data == nullptr) {
+        return false;
+    }
+
+    int width = static_cast<int>(params[0]);
+    int height = static_cast<int>(params[1]);
+    int format = static_cast<int>(params[3]);
+    if (params[2] != 1 ||
+        static_cast<size_t>(GetPixelDataSize(width, height, format)) != data_size) {
+        spdlog::warn("Cached {} is broken, ignoring it", source.key);
+        MemFree(data);
+        return false;
+    }
+
+    image = {data, width, height, 1, format};
+    return true;
+}
+
+bool DecodedCache::read(const CacheSource& source, Wave& wave) {
+    uint32_t params[4];
+    size_t data_size = 0;
+    unsigned char* data = read_entry(source, Kind::Wave, params, data_size);
+    if (data == nullptr) {
+        return false;
+    }
+
+    uint64_t expected_size =
+        static_cast<uint64_t>(params[0]) * params[3] * (params[2] / 8);
+    if (params[2] % 8 != 0 || expected_size != data_size) {
+        spdlog::warn("Cached {} is broken, ignoring it", source.key);
+        MemFree(data);
+        return false;
+    }
+
+    wave = {params[0], params[1], params[2], params[3], data};
+    return true;
+}
+
+void DecodedCache::write(const CacheSource& source, const Image& image) {
+    if (image.data == nullptr || image.mipmaps != 1) {
+        return;
+    }
+    uint32_t params[4] = {
+        static_cast<uint32_t>(image.width),
+        static_cast<uint32_t>(image.height),
+        static_cast<uint32_t>(image.mipmaps),
+        static_cast<uint32_t>(image.format)};
+    size_t data_size =
+        static_cast<size_t>(GetPixelDataSize(image.width, image.height, image.format));
+    write_entry(source, Kind::Image, params, image.data, data_size);
+}
+
+void DecodedCache::write(const CacheSource& source, const Wave& wave) {
+    if (wave.data == nullptr || wave.sampleSize % 8 != 0) {
+        return;
+    }
+    uint32_t params[4] = {
+        wave.frameCount, wave.sampleRate, wave.sampleSize, wave.channels};
+    size_t data_size =
+        static_cast<size_t>(wave.frameCount) * wave.channels * (wave.sampleSize / 8);
+    write_entry(source, Kind::Wave, params, wave.data, data_size);
+}
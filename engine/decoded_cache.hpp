@@ -0,0 +1,113 @@
+#pragma once
+
+#include "asset_pack.hpp"
+#include "raylib.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// What decoded data has been made of
+struct CacheSource {
+    // Unique name of source - path of file, or pack path with file name
+    std::string key;
+    // File that gets checked for changes, by its size and modification time
+    std::string file;
+
+    static CacheSource from_file(const std::string& path);
+    static CacheSource from_pack(const AssetPack& pack, const AssetPack::Entry& entry);
+};
+
+// Cache of decoded assets on disk, so these don't get decoded on each launch.
+// Each source gets file of its own, with raw pixels or pcm samples after short
+// header. Header remembers size and modification time of source, thus changed
+// sources are decoded again and their cache gets overwritten.
+// Cache files are memory-mapped and copied straight into Image or Wave, without
+// touching decoders. Like packs, these are in native byte order - cache isn't
+// meant to be moved between machines anyway.
+// Reads and writes are safe to do from workers, even for the same source.
+class DecodedCache {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+private:
+    enum class Kind : uint32_t {
+        Image = 1,
+        Wave
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t kind;
+        uint64_t source_size;
+        int64_t source_time;
+        uint64_t key_size;
+        uint64_t data_offset;
+        uint64_t data_size;
+        // Width, height, mipmaps and format of image, or frame count, sample
+        // rate, sample size and channels of wave
+        uint32_t params[4];
+    };
+
+    static constexpr char MAGIC[8] = {'M', 'B', 'D', 'E', 'C', 'O', 'D', 'E'};
+    static constexpr uint64_t DATA_ALIGNMENT = 16;
+
+    std::string directory;
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+
+    std::string get_cache_path(const std::string& key) const;
+
+    // Size and modification time of source file. False if there is no such file.
+    static bool get_fingerprint(const std::string& file, uint64_t& size, int64_t& time);
+
+    // Copy of cached data into buffer allocated with MemAlloc(), if cache of
+    // that kind is there and source hasn't changed since it was written
+    unsigned char* read_entry(
+        const CacheSource& source, Kind kind, uint32_t params[4], size_t& data_size);
+    void write_entry(
+        const CacheSource& source,
+        Kind kind,
+        const uint32_t params[4],
+        const void* data,
+        size_t data_size);
+
+public:
+    DecodedCache() = default;
+
+    DecodedCache(const DecodedCache&) = delete;
+    DecodedCache& operator=(const DecodedCache&) = delete;
+
+    // Use directory for cache, creating it if needed. Returns false (and logs
+    // why) if it can't be created, in which case cache stays closed.
+    bool open(const std::string& _directory);
+    void close();
+
+    bool is_open() const {
+        return !directory.empty();
+    }
+
+    const std::string& get_directory() const {
+        return directory;
+    }
+
+    // Decoded data, if it's cached and source hasn't changed. Data belongs to
+    // caller, same as with LoadImage() and LoadWave().
+    bool read(const CacheSource& source, Image& image);
+    bool read(const CacheSource& source, Wave& wave);
+
+    // Cache decoded data. Failures are logged and otherwise ignored - it will
+    // just be decoded again next time. Images with mipmaps aren't cached.
+    void write(const CacheSource& source, const Image& image);
+    void write(const CacheSource& source, const Wave& wave);
+
+    size_t get_hits() const {
+        return hits;
+    }
+
+    size_t get_misses() const {
+        return misses;
+    }
+};
@@ -0,0 +1,132 @@
+#include "file_watcher.hpp"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+
+#if defined(__linux__)
+    #include <cerrno>
+    #include <cstring>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+FileWatcher::~FileWatcher() {
+    close();
+}
+
+#if defined(__linux__)
+
+bool FileWatcher::is_supported() {
+    return true;
+}
+
+int FileWatcher::watch(const std::string& directory) {
+    if (descriptor < 0) {
+        descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (descriptor < 0) {
+            spdlog::warn("Unable to watch files: {}", std::strerror(errno));
+            return -1;
+        }
+    }
+
+    // Editors either write files in place, or write them elsewhere and move
+    // them over the old ones
+    int id =
+        inotify_add_watch(descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (id < 0) {
+        spdlog::warn("Unable to watch {}: {}", directory, std::strerror(errno));
+        return -1;
+    }
+
+    directories[id] = directory;
+    return id;
+}
+
+void FileWatcher::close() {
+    if (descriptor >= 0) {
+        ::close(descriptor);
+    }
+    descriptor = -1;
+    directories.clear();
+}
+
+std::vector<FileChange> FileWatcher::poll() {
+    std::vector<FileChange> changes;
+    if (descriptor < 0) {
+        return changes;
+    }
+
+    bool is_overflown = false;
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t length = read(descriptor, buffer, sizeof(buffer));
+        // Nothing else to read, since descriptor doesn't block
+        if (length <= 0) {
+            break;
+        }
+
+        for (char* position = buffer; position < buffer + length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(position);
+            position += sizeof(inotify_event) + event->len;
+
+            // Overflow isn't tied to any directory, thus all of them are suspect
+            if (event->mask & IN_Q_OVERFLOW) {
+                is_overflown = true;
+                continue;
+            }
+            if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                continue;
+            }
+            auto it = directories.find(event->wd);
+            if (it == directories.end()) {
+                continue;
+            }
+
+            std::string path = it->second;
+            if (!path.empty() && path.back() != '/') {
+                path += '/';
+            }
+            path += event->name;
+
+            // Files often get written few times in a row
+            bool is_known =
+                std::any_of(changes.begin(), changes.end(), [&](const FileChange& c) {
+                    return c.path == path;
+                });
+            if (!is_known) {
+                changes.push_back({event->wd, path});
+            }
+        }
+    }
+
+    if (is_overflown) {
+        spdlog::warn("Too many files have changed at once, some got missed");
+        for (const auto& [id, _] : directories) {
+            changes.push_back({id, ""});
+        }
+    }
+
+    return changes;
+}
+
+#else
+
+bool FileWatcher::is_supported() {
+    return false;
+}
+
+int FileWatcher::watch(const std::string& directory) {
+    spdlog::warn("Unable to watch {}: not supported on this platform", directory);
+    return -1;
+}
+
+void FileWatcher::close() {
+    descriptor = -1;
+    directories.clear();
+}
+
+std::vector<FileChange> FileWatcher::poll() {
+    return {};
+}
+
+#endif
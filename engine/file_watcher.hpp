@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// File that has been written, or moved into watched directory
+struct FileChange {
+    // Id that watch() has returned for its directory
+    int directory;
+    // Empty if too many files have changed at once and OS has dropped some
+    // events - then anything within directory may have changed
+    std::string path;
+};
+
+// Watches directories for changed files, without blocking. Uses inotify on
+// linux. Elsewhere it doesn't watch anything (yet), thus nothing ever changes.
+// Like MappedFile, doesn't include any OS headers.
+class FileWatcher {
+private:
+    int descriptor = -1;
+    // Paths of directories, by their ids
+    std::unordered_map<int, std::string> directories;
+
+public:
+    FileWatcher() = default;
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    static bool is_supported();
+
+    // Start watching files right within directory (but not within its
+    // subdirectories). Returns its id, or -1 (and logs why) if it can't be
+    // watched.
+    int watch(const std::string& directory);
+
+    // Stop watching everything
+    void close();
+
+    // Files changed since the last call, each one once. If some changes got
+    // lost, each watched directory is reported with empty path.
+    std::vector<FileChange> poll();
+};
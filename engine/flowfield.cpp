@@ -0,0 +1,790 @@
+#include "flowfield.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace {
+
+constexpr uint32_t INF = FlowField::UNREACHABLE;
+constexpr uint32_t STRAIGHT_COST = 10;
+constexpr uint32_t DIAGONAL_COST = 14;
+// Bands thinner than that aren't worth a separate task
+constexpr int MIN_BAND_HEIGHT = 16;
+// After that many sweeps, the rest is left to Dijkstra
+constexpr int MAX_SWEEPS = 2;
+
+// Same order as in hpa.cpp - straight moves go first
+constexpr int directions_table[8][2] = {
+    {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
+
+// Priority queue of tiles for Dijkstra. Tiles are grouped into buckets by
+// cost, each bucket as wide as the cheapest step. Any step from a tile leads to
+// one of the next buckets, thus tiles of the same bucket can't affect each
+// other and can be handled in any order - no heap needed.
+struct BucketQueue {
+    std::vector<std::vector<uint32_t>> buckets;
+    size_t first = SIZE_MAX;
+
+    void push(uint32_t cost, uint32_t index) {
+        size_t bucket = cost / STRAIGHT_COST;
+        if (bucket >= buckets.size()) {
+            buckets.resize(bucket + 1);
+        }
+        buckets[bucket].push_back(index);
+        first = std::min(first, bucket);
+    }
+};
+
+// Per-tile data used by sweeps. Unpacked from PathGrid into flat arrays once
+// per rebuild, so inner loops don't have to deal with bits and can be
+// vectorized by compiler.
+struct SweepData {
+    int width = 0;
+    int height = 0;
+    bool diagonals = true;
+    std::vector<uint8_t> passable;
+    // Cost of stepping into tile, straight and diagonally
+    std::vector<uint32_t> straight;
+    std::vector<uint32_t> diagonal;
+    uint32_t* integration = nullptr;
+
+    // Rows only need to be relaxed again if their neighbours have changed
+    // since the last time. To know that, each row has a version that gets
+    // bumped on each change, and remembers versions of its neighbours (and of
+    // itself, for horizontal pass) it has been relaxed with.
+    std::vector<uint32_t> versions;
+    std::vector<uint32_t> seen_above;
+    std::vector<uint32_t> seen_below;
+    std::vector<uint32_t> swept;
+
+    // Integration before the last sweep
+    std::vector<uint32_t> previous;
+    // Tiles left for Dijkstra to finish, found by each chunk of rows
+    std::vector<std::vector<uint32_t>> found;
+    BucketQueue queue;
+};
+
+thread_local SweepData sweep_data;
+
+// Relax row y with values of its vertical and diagonal neighbours in row from.
+// Returns true if anything got smaller.
+bool relax_from_row(const SweepData& data, int y, int from) {
+    int w = data.width;
+    uint32_t* row = data.integration + static_cast<size_t>(y) * w;
+    const uint32_t* src = data.integration + static_cast<size_t>(from) * w;
+    const uint8_t* pass = data.passable.data() + static_cast<size_t>(y) * w;
+    const uint8_t* src_pass = data.passable.data() + static_cast<size_t>(from) * w;
+    const uint32_t* straight = data.straight.data() + static_cast<size_t>(from) * w;
+    const uint32_t* diagonal = data.diagonal.data() + static_cast<size_t>(from) * w;
+
+    uint32_t changed = 0;
+
+    // Diagonal moves must not cut corners, thus both tile next to us and tile
+    // above/below the source have to be passable.
+    auto relax_cell = [&](int x) {
+        uint32_t value = row[x];
+        uint32_t best = std::min(value, src[x] + straight[x]);
+        if (data.diagonals && src_pass[x]) {
+            if (x > 0 && pass[x - 1]) {
+                best = std::min(best, src[x - 1] + diagonal[x - 1]);
+            }
+            if (x + 1 < w && pass[x + 1]) {
+                best = std::min(best, src[x + 1] + diagonal[x + 1]);
+            }
+        }
+        best = pass[x] ? best : INF;
+        changed |= best ^ value;
+        row[x] = best;
+    };
+
+    if (!data.diagonals || w < 3) {
+        for (int x = 0; x < w; x++) {
+            relax_cell(x);
+        }
+        return changed != 0;
+    }
+
+    relax_cell(0);
+    // Same as relax_cell(), but without bound checks and branches. Walls are
+    // random enough to make branch predictor useless, thus masks are used
+    // instead of ifs.
+    for (int x = 1; x < w - 1; x++) {
+        uint32_t value = row[x];
+        uint32_t best = src[x] + straight[x];
+        uint32_t left_mask = 0u - static_cast<uint32_t>(pass[x - 1] & src_pass[x]);
+        uint32_t right_mask = 0u - static_cast<uint32_t>(pass[x + 1] & src_pass[x]);
+        uint32_t left =
+            ((src[x - 1] + diagonal[x - 1]) & left_mask) | (INF & ~left_mask);
+        uint32_t right =
+            ((src[x + 1] + diagonal[x + 1]) & right_mask) | (INF & ~right_mask);
+        best = std::min(std::min(best, value), std::min(left, right));
+        uint32_t mask = 0u - static_cast<uint32_t>(pass[x]);
+        best = (best & mask) | (INF & ~mask);
+        changed |= best ^ value;
+        row[x] = best;
+    }
+    relax_cell(w - 1);
+
+    return changed != 0;
+}
+
+// Relax row with its horizontal neighbours, left to right and back.
+// Unlike vertical pass, each tile depends on the previous one here - thus this
+// can't be vectorized. But it can at least be made branchless, same way as
+// above.
+bool relax_row(const SweepData& data, int y) {
+    int w = data.width;
+    uint32_t* row = data.integration + static_cast<size_t>(y) * w;
+    const uint8_t* pass = data.passable.data() + static_cast<size_t>(y) * w;
+    const uint32_t* straight = data.straight.data() + static_cast<size_t>(y) * w;
+
+    uint32_t changed = 0;
+    uint32_t previous = row[0];
+    for (int x = 1; x < w; x++) {
+        uint32_t value = row[x];
+        uint32_t mask = 0u - static_cast<uint32_t>(pass[x]);
+        uint32_t best = std::min(value, previous + straight[x - 1]);
+        best = (best & mask) | (INF & ~mask);
+        changed |= best ^ value;
+        row[x] = best;
+        previous = best;
+    }
+    previous = row[w - 1];
+    for (int x = w - 2; x >= 0; x--) {
+        uint32_t value = row[x];
+        uint32_t mask = 0u - static_cast<uint32_t>(pass[x]);
+        uint32_t best = std::min(value, previous + straight[x + 1]);
+        best = (best & mask) | (INF & ~mask);
+        changed |= best ^ value;
+        row[x] = best;
+        previous = best;
+    }
+
+    return changed != 0;
+}
+
+// Sweep band of rows top to bottom, then bottom to top. Rows right outside of
+// band are read, but not written. Returns true if anything has changed.
+bool sweep_band(SweepData& data, int first, int last) {
+    bool changed = false;
+
+    auto relax = [&](int y, int from, std::vector<uint32_t>& seen) {
+        if (0 <= from && from < data.height && data.versions[from] != seen[y]) {
+            seen[y] = data.versions[from];
+            if (relax_from_row(data, y, from)) {
+                data.versions[y]++;
+                changed = true;
+            }
+        }
+
+        // Single pass each way is enough to settle the row by itself
+        if (data.versions[y] != data.swept[y]) {
+            if (relax_row(data, y)) {
+                data.versions[y]++;
+                changed = true;
+            }
+            data.swept[y] = data.versions[y];
+        }
+    };
+
+    for (int y = first; y < last; y++) {
+        relax(y, y - 1, data.seen_above);
+    }
+    for (int y = last - 1; y >= first; y--) {
+        relax(y, y + 1, data.seen_below);
+    }
+
+    return changed;
+}
+
+// Same as FlowField::find_best_neighbour(), but over unpacked data. Only
+// used once integration is final.
+uint8_t find_sweep_neighbour(const SweepData& data, int x, int y, uint32_t& best) {
+    int w = data.width;
+    best = INF;
+
+    auto is_passable = [&](int nx, int ny) {
+        return 0 <= nx && nx < w && 0 <= ny && ny < data.height &&
+               data.passable[static_cast<size_t>(ny) * w + nx];
+    };
+
+    if (!is_passable(x, y)) {
+        return FlowField::NO_DIRECTION;
+    }
+
+    uint8_t best_direction = FlowField::NO_DIRECTION;
+    int directions_amount = data.diagonals ? 8 : 4;
+
+    // Tiles away from edges don't need any bound checks
+    if (0 < x && x < w - 1 && 0 < y && y < data.height - 1) {
+        size_t index = static_cast<size_t>(y) * w + x;
+        const uint8_t* pass = data.passable.data() + index;
+        const uint32_t* integration = data.integration + index;
+
+        for (int d = 0; d < directions_amount; d++) {
+            int dx = directions_table[d][0];
+            int dy = directions_table[d][1];
+            ptrdiff_t offset = dy * w + dx;
+            if (!pass[offset]) {
+                continue;
+            }
+
+            uint32_t cost = integration[offset];
+            if (d < 4) {
+                cost += data.straight[index + offset];
+            }
+            else {
+                if (!pass[dx] || !pass[dy * w]) {
+                    continue;
+                }
+                cost += data.diagonal[index + offset];
+            }
+
+            if (cost < best) {
+                best = cost;
+                best_direction = static_cast<uint8_t>(d);
+                // Once integration is settled, nothing can be cheaper than tile
+                // itself
+                if (best == integration[0]) {
+                    break;
+                }
+            }
+        }
+
+        return best_direction;
+    }
+
+    for (int d = 0; d < directions_amount; d++) {
+        int nx = x + directions_table[d][0];
+        int ny = y + directions_table[d][1];
+        if (!is_passable(nx, ny)) {
+            continue;
+        }
+
+        size_t n = static_cast<size_t>(ny) * w + nx;
+        uint32_t cost = data.integration[n] + data.straight[n];
+        if (d >= 4) {
+            if (!is_passable(nx, y) || !is_passable(x, ny)) {
+                continue;
+            }
+            cost = data.integration[n] + data.diagonal[n];
+        }
+
+        if (cost < best) {
+            best = cost;
+            best_direction = static_cast<uint8_t>(d);
+        }
+    }
+
+    return best_direction;
+}
+
+
+// Spread improvements from queued tiles Dijkstra-style, until nothing gets any
+// better. Integration must only contain costs of real paths (or INF), then it
+// ends up exact. Calls on_change with index of each tile that got cheaper.
+template <typename Passable, typename Cost, typename OnChange>
+void spread_costs(
+    uint32_t* integration,
+    int width,
+    bool diagonals,
+    BucketQueue& queue,
+    Passable is_passable,
+    Cost get_cost,
+    OnChange on_change) {
+    int directions_amount = diagonals ? 8 : 4;
+
+    for (size_t bucket = queue.first; bucket < queue.buckets.size(); bucket++) {
+        // Tiles may be added to later buckets while we are at it, thus no
+        // references and iterators here
+        for (size_t i = 0; i < queue.buckets[bucket].size(); i++) {
+            uint32_t index = queue.buckets[bucket][i];
+            uint32_t value = integration[index];
+            // Got cheaper since it has been queued, and has been handled already
+            if (value / STRAIGHT_COST < bucket) {
+                continue;
+            }
+
+            int x = static_cast<int>(index % width);
+            int y = static_cast<int>(index / width);
+            uint32_t cost = get_cost(x, y);
+
+            for (int d = 0; d < directions_amount; d++) {
+                int dx = directions_table[d][0];
+                int dy = directions_table[d][1];
+                int nx = x + dx;
+                int ny = y + dy;
+                if (!is_passable(nx, ny)) {
+                    continue;
+                }
+
+                uint32_t step = STRAIGHT_COST;
+                if (dx != 0 && dy != 0) {
+                    if (!is_passable(nx, y) || !is_passable(x, ny)) {
+                        continue;
+                    }
+                    step = DIAGONAL_COST;
+                }
+
+                uint32_t n = static_cast<uint32_t>(ny * width + nx);
+                uint32_t next = value + step * cost;
+                if (next < integration[n]) {
+                    integration[n] = next;
+                    queue.push(next, n);
+                    on_change(n);
+                }
+            }
+        }
+        queue.buckets[bucket].clear();
+    }
+
+    queue.first = SIZE_MAX;
+}
+
+// Buffers for incremental updates. Stamps work the same way as in
+// pathfinding.cpp.
+struct UpdateBuffers {
+    std::vector<uint32_t> invalid;
+    std::vector<uint32_t> stack;
+    std::vector<uint32_t> touched;
+    BucketQueue queue;
+    uint32_t generation = 0;
+
+    void prepare(size_t size) {
+        if (invalid.size() < size) {
+            invalid.assign(size, 0);
+            generation = 0;
+        }
+
+        stack.clear();
+        touched.clear();
+        generation++;
+        if (generation == 0) {
+            std::fill(invalid.begin(), invalid.end(), 0);
+            generation = 1;
+        }
+    }
+};
+
+thread_local UpdateBuffers update_buffers;
+
+} // namespace
+
+// FlowField
+FlowField::FlowField(
+    const PathGrid* _grid, std::vector<Point> _goals, PathOptions _options)
+    : grid(_grid)
+    , options(_options)
+    , goals(std::move(_goals)) {
+    rebuild();
+}
+
+FlowField::FlowField(const PathGrid* _grid, std::vector<Point> _goals)
+    : FlowField(_grid, std::move(_goals), PathOptions()) {
+}
+
+void FlowField::rebuild() {
+    changed_tiles.clear();
+    width = grid->get_width();
+    height = grid->get_height();
+    size_t area = static_cast<size_t>(width) * height;
+
+    integration.assign(area, INF);
+    directions.assign(area, NO_DIRECTION);
+    if (area == 0) {
+        return;
+    }
+
+    for (auto& goal : goals) {
+        if (grid->is_passable(goal.x, goal.y)) {
+            integration[static_cast<size_t>(goal.y) * width + goal.x] = 0;
+        }
+    }
+
+    WorkerPool& pool = get_worker_pool();
+
+    SweepData& data = sweep_data;
+    data.width = width;
+    data.height = height;
+    data.diagonals = options.allow_diagonals;
+    data.integration = integration.data();
+    data.passable.resize(area);
+    data.straight.resize(area);
+    data.diagonal.resize(area);
+    data.versions.assign(height, 0);
+    data.seen_above.assign(height, UINT32_MAX);
+    data.seen_below.assign(height, UINT32_MAX);
+    data.swept.assign(height, UINT32_MAX);
+
+    pool.parallel_for(height, MIN_BAND_HEIGHT, [&](size_t first, size_t last) {
+        for (size_t y = first; y < last; y++) {
+            size_t i = y * width;
+            for (int x = 0; x < width; x++, i++) {
+                uint32_t cost = grid->get_cost(x, static_cast<int>(y));
+                data.passable[i] = grid->is_passable(x, static_cast<int>(y));
+                data.straight[i] = STRAIGHT_COST * cost;
+                data.diagonal[i] = DIAGONAL_COST * cost;
+            }
+        }
+    });
+
+    // Map is split into horizontal bands, that get swept independently - even
+    // ones first, then odd ones, so neighbouring bands never run at once.
+    // Values cross into neighbouring bands on the next pass.
+    size_t threads = pool.get_threads_amount();
+    size_t bands_amount = 1;
+    if (threads > 1) {
+        bands_amount = std::min<size_t>(threads * 2, height / MIN_BAND_HEIGHT);
+        bands_amount = std::max<size_t>(bands_amount, 1);
+    }
+
+    std::vector<uint8_t> band_changed(bands_amount);
+    auto band_row = [&](size_t band) {
+        return static_cast<int>(band * height / bands_amount);
+    };
+
+    bool changed = true;
+    for (int pass = 0; pass < MAX_SWEEPS && changed; pass++) {
+        changed = false;
+        if (pass == MAX_SWEEPS - 1) {
+            data.previous.assign(integration.begin(), integration.end());
+        }
+
+        for (size_t parity = 0; parity < 2; parity++) {
+            size_t phase_bands = (bands_amount + 1 - parity) / 2;
+            pool.parallel_for(phase_bands, 1, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    size_t band = i * 2 + parity;
+                    band_changed[band] =
+                        sweep_band(data, band_row(band), band_row(band + 1));
+                }
+            });
+        }
+
+        for (auto i : band_changed) {
+            changed = changed || i;
+        }
+    }
+
+    // Sweeps are great for open areas, but each time path has to turn back
+    // around some wall, it takes them another pass to notice. So instead of
+    // sweeping until nothing changes, the rest is finished off with Dijkstra.
+    // Everything has been relaxed with its neighbours during the last pass, so
+    // only tiles that have changed during it may have something to offer.
+    if (changed) {
+        size_t chunks_amount = (height + MIN_BAND_HEIGHT - 1) / MIN_BAND_HEIGHT;
+        data.found.resize(chunks_amount);
+        pool.parallel_for(chunks_amount, 1, [&](size_t first, size_t last) {
+            for (size_t chunk = first; chunk < last; chunk++) {
+                data.found[chunk].clear();
+                size_t begin = chunk * MIN_BAND_HEIGHT * width;
+                size_t end = std::min(begin + MIN_BAND_HEIGHT * width, area);
+                for (size_t i = begin; i < end; i++) {
+                    if (integration[i] != data.previous[i]) {
+                        data.found[chunk].push_back(static_cast<uint32_t>(i));
+                    }
+                }
+            }
+        });
+
+        for (auto& i : data.found) {
+            for (auto index : i) {
+                data.queue.push(integration[index], index);
+            }
+        }
+
+        spread_costs(
+            integration.data(),
+            width,
+            options.allow_diagonals,
+            data.queue,
+            [&](int x, int y) {
+                return 0 <= x && x < width && 0 <= y && y < height &&
+                       data.passable[static_cast<size_t>(y) * width + x];
+            },
+            [&](int x, int y) {
+                return data.straight[static_cast<size_t>(y) * width + x] / STRAIGHT_COST;
+            },
+            [](uint32_t) {});
+    }
+
+    pool.parallel_for(height, MIN_BAND_HEIGHT, [&](size_t first, size_t last) {
+        for (size_t y = first; y < last; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t index = y * width + x;
+                uint32_t current = integration[index];
+                uint32_t best;
+                if (current == 0 || current == INF) {
+                    directions[index] = NO_DIRECTION;
+                }
+                else {
+                    directions[index] =
+                        find_sweep_neighbour(data, x, static_cast<int>(y), best);
+                }
+            }
+        }
+    });
+}
+
+uint8_t FlowField::find_best_neighbour(int x, int y, uint32_t& best) {
+    best = INF;
+    if (!grid->is_passable(x, y)) {
+        return NO_DIRECTION;
+    }
+
+    uint8_t best_direction = NO_DIRECTION;
+    int directions_amount = options.allow_diagonals ? 8 : 4;
+    for (int d = 0; d < directions_amount; d++) {
+        int dx = directions_table[d][0];
+        int dy = directions_table[d][1];
+        int nx = x + dx;
+        int ny = y + dy;
+        if (!grid->is_passable(nx, ny)) {
+            continue;
+        }
+
+        uint32_t step = STRAIGHT_COST;
+        if (dx != 0 && dy != 0) {
+            if (!grid->is_passable(nx, y) || !grid->is_passable(x, ny)) {
+                continue;
+            }
+            step = DIAGONAL_COST;
+        }
+
+        uint32_t cost = integration[static_cast<size_t>(ny) * width + nx] +
+                        step * grid->get_cost(nx, ny);
+        if (cost < best) {
+            best = cost;
+            best_direction = static_cast<uint8_t>(d);
+        }
+    }
+
+    return best_direction;
+}
+
+uint8_t FlowField::pick_direction(int x, int y) {
+    uint32_t current = integration[static_cast<size_t>(y) * width + x];
+    if (current == 0 || current == INF) {
+        return NO_DIRECTION;
+    }
+
+    uint32_t cost;
+    return find_best_neighbour(x, y, cost);
+}
+
+void FlowField::mark_tile_changed(Point tile) {
+    if (tile.x < 0 || tile.x >= width || tile.y < 0 || tile.y >= height) {
+        return;
+    }
+    changed_tiles.push_back(tile);
+}
+
+void FlowField::update() {
+    if (changed_tiles.empty()) {
+        return;
+    }
+
+    // Past some point, sweeping whole map is cheaper than patching it
+    size_t area = static_cast<size_t>(width) * height;
+    if (changed_tiles.size() > area / 64 || grid->get_width() != width ||
+        grid->get_height() != height) {
+        rebuild();
+        return;
+    }
+
+    UpdateBuffers& b = update_buffers;
+    b.prepare(area);
+
+    auto index_of = [&](int x, int y) { return static_cast<uint32_t>(y * width + x); };
+    auto is_inside = [&](int x, int y) {
+        return 0 <= x && x < width && 0 <= y && y < height;
+    };
+
+    // Tiles whose cost depended on changed ones may now be wrong. These are the
+    // ones that point to changed tiles - and ones that point to them, and so on.
+    // Diagonal moves also depend on tiles they go around.
+    for (auto& tile : changed_tiles) {
+        b.stack.push_back(index_of(tile.x, tile.y));
+
+        for (int d = 4; d < 8; d++) {
+            int sides[2][2] = {
+                {tile.x - directions_table[d][0], tile.y},
+                {tile.x, tile.y - directions_table[d][1]}};
+            for (auto& side : sides) {
+                if (is_inside(side[0], side[1]) &&
+                    directions[index_of(side[0], side[1])] == d) {
+                    b.stack.push_back(index_of(side[0], side[1]));
+                }
+            }
+        }
+    }
+
+    while (!b.stack.empty()) {
+        uint32_t index = b.stack.back();
+        b.stack.pop_back();
+        if (b.invalid[index] == b.generation) {
+            continue;
+        }
+        b.invalid[index] = b.generation;
+        b.touched.push_back(index);
+
+        int x = static_cast<int>(index % width);
+        int y = static_cast<int>(index / width);
+        for (int d = 0; d < 8; d++) {
+            // Neighbour that points to us is one that sits in the opposite
+            // direction and has the same direction index.
+            int nx = x - directions_table[d][0];
+            int ny = y - directions_table[d][1];
+            if (is_inside(nx, ny) && directions[index_of(nx, ny)] == d) {
+                b.stack.push_back(index_of(nx, ny));
+            }
+        }
+    }
+
+    for (auto index : b.touched) {
+        integration[index] = INF;
+    }
+    for (auto& goal : goals) {
+        if (grid->is_passable(goal.x, goal.y)) {
+            uint32_t index = index_of(goal.x, goal.y);
+            integration[index] = 0;
+            b.queue.push(0, index);
+        }
+    }
+
+    // Invalidated tiles get whatever their valid neighbours offer. Neighbours of
+    // changed tiles get re-evaluated too, in case they've got a shortcut.
+    auto seed = [&](int x, int y) {
+        uint32_t index = index_of(x, y);
+        uint32_t cost;
+        find_best_neighbour(x, y, cost);
+        if (cost < integration[index]) {
+            integration[index] = cost;
+            b.queue.push(cost, index);
+        }
+    };
+
+    size_t invalidated = b.touched.size();
+    for (size_t i = 0; i < invalidated; i++) {
+        uint32_t index = b.touched[i];
+        seed(static_cast<int>(index % width), static_cast<int>(index / width));
+    }
+    for (auto& tile : changed_tiles) {
+        for (int d = 0; d < 8; d++) {
+            int nx = tile.x + directions_table[d][0];
+            int ny = tile.y + directions_table[d][1];
+            if (is_inside(nx, ny)) {
+                seed(nx, ny);
+                b.touched.push_back(index_of(nx, ny));
+            }
+        }
+    }
+    // Then improvements spread outwards
+    spread_costs(
+        integration.data(),
+        width,
+        options.allow_diagonals,
+        b.queue,
+        [&](int x, int y) { return grid->is_passable(x, y); },
+        [&](int x, int y) { return static_cast<uint32_t>(grid->get_cost(x, y)); },
+        [&](uint32_t index) { b.touched.push_back(index); });
+
+    for (auto index : b.touched) {
+        int x = static_cast<int>(index % width);
+        int y = static_cast<int>(index / width);
+        directions[index] = pick_direction(x, y);
+    }
+
+    changed_tiles.clear();
+}
+
+Point FlowField::get_direction(int x, int y) {
+    if (x < 0 || x >= width || y < 0 || y >= height) {
+        return {0, 0};
+    }
+
+    uint8_t direction = directions[static_cast<size_t>(y) * width + x];
+    if (direction == NO_DIRECTION) {
+        return {0, 0};
+    }
+    return {directions_table[direction][0], directions_table[direction][1]};
+}
+
+// FlowFieldCache
+FlowFieldCache::FlowFieldCache(
+    const PathGrid* _grid, size_t _max_fields, PathOptions _options)
+    : grid(_grid)
+    , options(_options)
+    , max_fields(std::max<size_t>(_max_fields, 1)) {
+}
+
+FlowFieldCache::FlowFieldCache(const PathGrid* _grid, size_t _max_fields)
+    : FlowFieldCache(_grid, _max_fields, PathOptions()) {
+}
+
+FlowField& FlowFieldCache::get(Point goal) {
+    return get(std::vector<Point>{goal});
+}
+
+FlowField& FlowFieldCache::get(const std::vector<Point>& goals) {
+    ticks++;
+
+    auto same_goals = [&](const std::vector<Point>& other) {
+        return std::equal(
+            goals.begin(), goals.end(), other.begin(), other.end(), [](Point a, Point b) {
+                return a.x == b.x && a.y == b.y;
+            });
+    };
+
+    for (auto& i : fields) {
+        if (same_goals(i.field->get_goals())) {
+            i.last_used = ticks;
+            if (i.is_outdated) {
+                i.field->rebuild();
+                i.is_outdated = false;
+            }
+            else {
+                i.field->update();
+            }
+            return *i.field;
+        }
+    }
+
+    if (fields.size() >= max_fields) {
+        auto oldest = std::min_element(
+            fields.begin(), fields.end(), [](const Entry& a, const Entry& b) {
+                return a.last_used < b.last_used;
+            });
+        fields.erase(oldest);
+    }
+
+    fields.push_back({std::make_unique<FlowField>(grid, goals, options), ticks, false});
+    return *fields.back().field;
+}
+
+void FlowFieldCache::mark_tile_changed(Point tile) {
+    for (auto& i : fields) {
+        i.field->mark_tile_changed(tile);
+    }
+}
+
+void FlowFieldCache::read_journal(const std::shared_ptr<TileJournal>& current) {
+    TileChanges changes = journal.read(current);
+    if (changes.everything) {
+        for (auto& i : fields) {
+            i.is_outdated = true;
+        }
+        return;
+    }
+
+    int width = grid->get_width();
+    for (size_t i = 0; i < changes.tiles_amount; i++) {
+        int tile = static_cast<int>(changes.tiles[i]);
+        mark_tile_changed({tile % width, tile / width});
+    }
+}
+
+void FlowFieldCache::clear() {
+    fields.clear();
+}
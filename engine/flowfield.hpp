@@ -0,0 +1,139 @@
+#pragma once
+
+#include "mapgen.hpp"
+#include "pathfinding.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Flow fields, for crowds of units that go to the same place.
+// Instead of searching path for each unit, field stores cost of getting to the
+// closest goal from each tile of map (integration field), and a direction to
+// the next tile on the way (direction field). Units then just follow arrows.
+// Costs are integers: 10 per straight step and 14 per diagonal one, multiplied
+// by cost of tile being entered - same rules as find_path() uses.
+
+class FlowField {
+private:
+    const PathGrid* grid;
+    PathOptions options;
+    std::vector<Point> goals;
+
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> integration;
+    std::vector<uint8_t> directions;
+
+    // Tiles that changed since the last update
+    std::vector<Point> changed_tiles;
+
+    // Neighbour with the cheapest way to goal, and cost of that way
+    uint8_t find_best_neighbour(int x, int y, uint32_t& cost);
+    uint8_t pick_direction(int x, int y);
+
+public:
+    static constexpr uint32_t UNREACHABLE = 0x3fffffff;
+    static constexpr uint8_t NO_DIRECTION = 8;
+
+    FlowField(const PathGrid* grid, std::vector<Point> goals, PathOptions options);
+    FlowField(const PathGrid* grid, std::vector<Point> goals);
+
+    // Recompute whole field from scratch. Called automatically on creation.
+    void rebuild();
+
+    // Remember that passability or cost of tile has changed. Nothing is
+    // recomputed until update().
+    void mark_tile_changed(Point tile);
+
+    bool has_changes() {
+        return !changed_tiles.empty();
+    }
+
+    // Recompute parts of field affected by changes since the last update.
+    // If too much has changed - falls back to rebuild().
+    void update();
+
+    const std::vector<Point>& get_goals() {
+        return goals;
+    }
+
+    bool is_reachable(int x, int y) {
+        return get_cost(x, y) != UNREACHABLE;
+    }
+
+    // Cost of getting from tile to the closest goal. UNREACHABLE for walls,
+    // out-of-bounds tiles and ones that have no way to goals.
+    uint32_t get_cost(int x, int y) {
+        if (x < 0 || x >= width || y < 0 || y >= height) {
+            return UNREACHABLE;
+        }
+        return integration[static_cast<size_t>(y) * width + x];
+    }
+
+    // Offset to the next tile on the way to goal. {0, 0} for goals themselves
+    // and tiles that can't reach any goal.
+    Point get_direction(int x, int y);
+
+    // Tile to move into from x, y. Same as x, y if there is nowhere to go.
+    Point get_next_tile(int x, int y) {
+        Point direction = get_direction(x, y);
+        return {x + direction.x, y + direction.y};
+    }
+
+    const std::vector<uint32_t>& get_integration() {
+        return integration;
+    }
+
+    const std::vector<uint8_t>& get_directions() {
+        return directions;
+    }
+
+    size_t get_memory_size() {
+        return integration.size() * sizeof(uint32_t) + directions.size();
+    }
+};
+
+// Keeps flow fields to recently requested goals around, so units that go to
+// the same place share the same field. Least recently used fields get thrown
+// away once there are more of them than max_fields.
+class FlowFieldCache {
+private:
+    struct Entry {
+        std::unique_ptr<FlowField> field;
+        uint64_t last_used;
+        // Whole grid may have changed, thus field gets rebuilt on next get()
+        bool is_outdated;
+    };
+
+    const PathGrid* grid;
+    PathOptions options;
+    size_t max_fields;
+    std::vector<Entry> fields;
+    uint64_t ticks = 0;
+    TileJournalReader journal;
+
+public:
+    FlowFieldCache(const PathGrid* grid, size_t max_fields, PathOptions options);
+    FlowFieldCache(const PathGrid* grid, size_t max_fields);
+
+    // Get (and build, if necessary) field leading to goal(s). Pending changes of
+    // tiles are applied before returning. Reference stays valid until field
+    // gets evicted by requests to other goals, or until clear().
+    FlowField& get(Point goal);
+    FlowField& get(const std::vector<Point>& goals);
+
+    // Pass tile change to all cached fields. They'll update on next get().
+    void mark_tile_changed(Point tile);
+
+    // Same for each tile map's journal has recorded since the previous call.
+    // Meant to be called with map's get_journal() each frame, once grid is up
+    // to date. New journal counts as change of everything.
+    void read_journal(const std::shared_ptr<TileJournal>& current);
+
+    void clear();
+
+    size_t get_fields_amount() {
+        return fields.size();
+    }
+};
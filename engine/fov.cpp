@@ -0,0 +1,234 @@
+#include "fov.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+// Transforms of each octant into the first one: x goes along row, y goes away
+// from viewer.
+constexpr int octants[8][4] = {
+    {1, 0, 0, 1},
+    {0, 1, 1, 0},
+    {0, -1, 1, 0},
+    {-1, 0, 0, 1},
+    {-1, 0, 0, -1},
+    {0, -1, -1, 0},
+    {0, 1, -1, 0},
+    {1, 0, 0, -1},
+};
+
+struct Caster {
+    const BitGrid& opaque;
+    Point viewer;
+    int radius;
+    BitGrid& visible;
+    Point origin;
+
+    bool is_opaque(int x, int y) {
+        return opaque.get_or(x, y, true);
+    }
+
+    void light(int x, int y) {
+        visible.set(x - origin.x, y - origin.y, true);
+    }
+
+    // Bergstrom's recursive shadowcasting. Scans rows of octant going away from
+    // viewer, within slopes range from start to end. Each time a wall
+    // interrupts the range, part before it gets scanned recursively, and the
+    // rest continues past it.
+    void cast(int row, float start, float end, const int* octant) {
+        if (start < end) {
+            return;
+        }
+
+        int radius_squared = radius * radius;
+        float next_start = start;
+
+        for (int distance = row; distance <= radius; distance++) {
+            bool blocked = false;
+            int dy = -distance;
+
+            for (int dx = -distance; dx <= 0; dx++) {
+                float left_slope = (dx - 0.5f) / (dy + 0.5f);
+                float right_slope = (dx + 0.5f) / (dy - 0.5f);
+                if (start < right_slope) {
+                    continue;
+                }
+                if (end > left_slope) {
+                    break;
+                }
+
+                int x = viewer.x + dx * octant[0] + dy * octant[1];
+                int y = viewer.y + dx * octant[2] + dy * octant[3];
+                bool is_wall = is_opaque(x, y);
+
+                if (dx * dx + dy * dy <= radius_squared && opaque.is_inside(x, y)) {
+                    light(x, y);
+                }
+
+                if (blocked) {
+                    if (is_wall) {
+                        next_start = right_slope;
+                    }
+                    else {
+                        blocked = false;
+                        start = next_start;
+                    }
+                }
+                else if (is_wall && distance < radius) {
+                    blocked = true;
+                    cast(distance + 1, start, left_slope, octant);
+                    next_start = right_slope;
+                }
+            }
+
+            if (blocked) {
+                break;
+            }
+        }
+    }
+};
+
+} // namespace
+
+// Visibility
+void Visibility::merge_into(BitGrid& map_bits) const {
+    for_each_visible([&](Point tile) {
+        if (map_bits.is_inside(tile.x, tile.y)) {
+            map_bits.set(tile.x, tile.y, true);
+        }
+    });
+}
+
+// Computing
+void compute_fov(const BitGrid& opaque, Point viewer, int radius, Visibility& result) {
+    radius = std::max(radius, 0);
+    int size = radius * 2 + 1;
+
+    result.origin = {viewer.x - radius, viewer.y - radius};
+    if (result.visible.get_width() != size || result.visible.get_height() != size) {
+        result.visible = BitGrid(size, size);
+    }
+    else {
+        result.visible.fill(false);
+    }
+
+    if (!opaque.is_inside(viewer.x, viewer.y)) {
+        return;
+    }
+
+    Caster caster = {opaque, viewer, radius, result.visible, result.origin};
+    caster.light(viewer.x, viewer.y);
+    for (auto& octant : octants) {
+        caster.cast(1, 1.0f, 0.0f, octant);
+    }
+}
+
+void compute_fov(
+    const BitGrid& opaque,
+    const std::vector<FovRequest>& requests,
+    std::vector<Visibility>& results) {
+    results.resize(requests.size());
+
+    get_worker_pool().parallel_for(requests.size(), 4, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            compute_fov(opaque, requests[i].viewer, requests[i].radius, results[i]);
+        }
+    });
+}
+
+// FovCache
+FovCache::FovCache(const BitGrid* _opaque)
+    : opaque(_opaque) {
+}
+
+FovCache::Entry& FovCache::prepare(const FovViewer& viewer) {
+    auto it = entries.find(viewer.id);
+    if (it == entries.end()) {
+        Entry entry = {viewer.position, viewer.radius, true, {}};
+        it = entries.emplace(viewer.id, std::move(entry)).first;
+    }
+
+    Entry& entry = it->second;
+    if (entry.position.x != viewer.position.x || entry.position.y != viewer.position.y ||
+        entry.radius != viewer.radius) {
+        entry.position = viewer.position;
+        entry.radius = viewer.radius;
+        entry.dirty = true;
+    }
+
+    return entry;
+}
+
+void FovCache::update(const std::vector<FovViewer>& viewers) {
+    // Entries are created beforehand, since map can't be touched from workers
+    std::vector<Entry*> outdated;
+    for (auto& viewer : viewers) {
+        Entry& entry = prepare(viewer);
+        if (entry.dirty) {
+            outdated.push_back(&entry);
+            entry.dirty = false;
+        }
+    }
+
+    get_worker_pool().parallel_for(outdated.size(), 4, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            Entry& entry = *outdated[i];
+            compute_fov(*opaque, entry.position, entry.radius, entry.visibility);
+        }
+    });
+
+    last_recomputed = outdated.size();
+}
+
+const Visibility& FovCache::get(const FovViewer& viewer) {
+    Entry& entry = prepare(viewer);
+    if (entry.dirty) {
+        compute_fov(*opaque, entry.position, entry.radius, entry.visibility);
+        entry.dirty = false;
+    }
+    return entry.visibility;
+}
+
+const Visibility* FovCache::find(size_t id) {
+    auto it = entries.find(id);
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    return &it->second.visibility;
+}
+
+void FovCache::mark_tile_changed(Point tile) {
+    for (auto& [id, entry] : entries) {
+        if (std::abs(tile.x - entry.position.x) <= entry.radius &&
+            std::abs(tile.y - entry.position.y) <= entry.radius) {
+            entry.dirty = true;
+        }
+    }
+}
+
+void FovCache::read_journal(const std::shared_ptr<TileJournal>& current) {
+    TileChanges changes = journal.read(current);
+    if (changes.everything) {
+        for (auto& [id, entry] : entries) {
+            entry.dirty = true;
+        }
+        return;
+    }
+
+    int width = opaque->get_width();
+    for (size_t i = 0; i < changes.tiles_amount; i++) {
+        int tile = static_cast<int>(changes.tiles[i]);
+        mark_tile_changed({tile % width, tile / width});
+    }
+}
+
+void FovCache::remove(size_t id) {
+    entries.erase(id);
+}
+
+void FovCache::clear() {
+    entries.clear();
+}
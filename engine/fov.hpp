@@ -0,0 +1,137 @@
+#pragma once
+
+#include "bitgrid.hpp"
+#include "mapgen.hpp"
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+// Field of view, roguelike style.
+// Works over mask of opaque tiles (see make_tile_mask()) with recursive
+// shadowcasting. Results are stored as bits in a square window around viewer,
+// thus computing fov over and over again with the same Visibility object
+// doesn't allocate anything.
+
+// Tiles visible from some spot
+class Visibility {
+private:
+    friend void compute_fov(const BitGrid&, Point, int, Visibility&);
+
+    // Map coordinates of window's top left corner
+    Point origin = {0, 0};
+    BitGrid visible;
+
+public:
+    bool is_visible(int x, int y) const {
+        return visible.get_or(x - origin.x, y - origin.y, false);
+    }
+
+    Point get_origin() const {
+        return origin;
+    }
+
+    // Window's bits, with origin at get_origin()
+    const BitGrid& get_bits() const {
+        return visible;
+    }
+
+    size_t count() const {
+        return visible.count();
+    }
+
+    // Call fn with map coordinates of each visible tile
+    template <typename F> void for_each_visible(F fn) const {
+        for (int y = 0; y < visible.get_height(); y++) {
+            const uint64_t* row = visible.get_row(y);
+            for (size_t w = 0; w < visible.get_words_per_row(); w++) {
+                uint64_t word = row[w];
+                while (word != 0) {
+                    int x = static_cast<int>(w * 64) + lowest_bit(word);
+                    fn(Point{origin.x + x, origin.y + y});
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+    // Set bits of visible tiles in map-sized grid. Say, to remember tiles
+    // player has ever seen.
+    void merge_into(BitGrid& map_bits) const;
+};
+
+// Compute tiles visible from viewer within radius. Opaque tiles that are lit
+// are visible too, so walls show up. Anything outside of map is opaque.
+void compute_fov(const BitGrid& opaque, Point viewer, int radius, Visibility& result);
+
+struct FovRequest {
+    Point viewer;
+    int radius;
+};
+
+// Same as above, but for multiple viewers at once, spread across worker
+// threads. Keep results around between turns, to reuse their memory.
+void compute_fov(
+    const BitGrid& opaque,
+    const std::vector<FovRequest>& requests,
+    std::vector<Visibility>& results);
+
+struct FovViewer {
+    // Anything that identifies viewer - entity id, object id on map, etc
+    size_t id;
+    Point position;
+    int radius;
+};
+
+// Remembers fov of each viewer, and only recomputes it if viewer has moved or
+// if something has changed around it.
+class FovCache {
+private:
+    struct Entry {
+        Point position;
+        int radius;
+        bool dirty;
+        Visibility visibility;
+    };
+
+    const BitGrid* opaque;
+    std::unordered_map<size_t, Entry> entries;
+    size_t last_recomputed = 0;
+    TileJournalReader journal;
+
+    Entry& prepare(const FovViewer& viewer);
+
+public:
+    FovCache(const BitGrid* opaque);
+
+    // Bring fov of all these viewers up to date. Outdated ones are recomputed
+    // in parallel.
+    void update(const std::vector<FovViewer>& viewers);
+
+    // Get fov of single viewer, recomputing it if necessary
+    const Visibility& get(const FovViewer& viewer);
+
+    // Get fov as of the last update. Returns nullptr for unknown viewers.
+    const Visibility* find(size_t id);
+
+    // Opacity of tile has changed - viewers that may see it need recomputing
+    void mark_tile_changed(Point tile);
+
+    // Same for each tile map's journal has recorded since the previous call.
+    // Meant to be called with map's get_journal() each frame, once opacity
+    // mask is up to date. New journal counts as change of everything.
+    void read_journal(const std::shared_ptr<TileJournal>& current);
+
+    // Forget about viewer (say, if monster has died)
+    void remove(size_t id);
+    void clear();
+
+    size_t get_viewers_amount() {
+        return entries.size();
+    }
+
+    // Amount of viewers that had to be recomputed during the last update()
+    size_t get_last_recomputed() {
+        return last_recomputed;
+    }
+};
@@ -0,0 +1,647 @@
+#include "hpa.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+namespace {
+
+constexpr float INF = std::numeric_limits<float>::infinity();
+constexpr float DIAGONAL_COST = 1.41421356f;
+constexpr uint32_t NO_NODE = UINT32_MAX;
+// Runs of passable border tiles this wide or wider get two entrances (one on
+// each end) instead of one in the middle.
+constexpr int WIDE_ENTRANCE = 6;
+
+struct QueueItem {
+    float priority;
+    uint32_t index;
+};
+
+bool operator>(const QueueItem& a, const QueueItem& b) {
+    return a.priority > b.priority;
+}
+
+// Buffers for searches inside of a single cluster
+struct ClusterSearch {
+    std::vector<float> dist;
+    std::vector<QueueItem> queue;
+    std::vector<uint8_t> is_target;
+};
+
+thread_local ClusterSearch cluster_search;
+
+// Buffers for searches over abstract graph. Same generation trick as in
+// pathfinding.cpp - stamps are used instead of clearing.
+struct GraphSearch {
+    std::vector<float> g;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> seen;
+    std::vector<uint32_t> closed;
+    std::vector<QueueItem> open;
+    std::vector<float> start_edges;
+    std::vector<float> goal_edges;
+    uint32_t generation = 0;
+
+    void prepare(size_t size) {
+        if (seen.size() < size) {
+            g.resize(size);
+            parent.resize(size);
+            seen.assign(size, 0);
+            closed.assign(size, 0);
+            generation = 0;
+        }
+
+        open.clear();
+        generation++;
+        if (generation == 0) {
+            std::fill(seen.begin(), seen.end(), 0);
+            std::fill(closed.begin(), closed.end(), 0);
+            generation = 1;
+        }
+    }
+
+    void relax(uint32_t from, uint32_t to, float cost, float h) {
+        if (closed[to] == generation) {
+            return;
+        }
+
+        if (seen[to] != generation || cost < g[to]) {
+            seen[to] = generation;
+            g[to] = cost;
+            parent[to] = from;
+            open.push_back({cost + h, to});
+            std::push_heap(open.begin(), open.end(), std::greater<QueueItem>());
+        }
+    }
+};
+
+thread_local GraphSearch graph_search;
+
+float octile(Point a, Point b) {
+    int dx = std::abs(a.x - b.x);
+    int dy = std::abs(a.y - b.y);
+    return static_cast<float>(std::max(dx, dy)) +
+           (DIAGONAL_COST - 1.0f) * static_cast<float>(std::min(dx, dy));
+}
+
+// Dijkstra from origin, limited to rect. Fills cluster_search.dist with
+// distances to each tile of rect (row by row). Moves follow the same rules as
+// in find_path(). If reverse is set - distances are of paths that go *to*
+// origin, which differs from paths going out of it due to tile costs.
+// If targets are provided - search stops as soon as all of them are reached,
+// leaving distances to the rest of tiles incomplete.
+void search_cluster(
+    const PathGrid& grid,
+    TileRect rect,
+    Point origin,
+    bool diagonals,
+    bool reverse,
+    const std::vector<Point>* targets) {
+    ClusterSearch& s = cluster_search;
+    size_t area = static_cast<size_t>(rect.width) * rect.height;
+    s.dist.assign(area, INF);
+    s.queue.clear();
+
+    size_t targets_left = 0;
+    if (targets != nullptr) {
+        s.is_target.assign(area, 0);
+        for (auto& t : *targets) {
+            size_t row = static_cast<size_t>(t.y - rect.y) * rect.width;
+            uint8_t& flag = s.is_target[row + (t.x - rect.x)];
+            if (!flag) {
+                flag = 1;
+                targets_left++;
+            }
+        }
+    }
+
+    auto inside = [&](int x, int y) {
+        return rect.x <= x && x < rect.x + rect.width && rect.y <= y &&
+               y < rect.y + rect.height && grid.is_passable(x, y);
+    };
+    auto local = [&](int x, int y) {
+        return static_cast<uint32_t>((y - rect.y) * rect.width + (x - rect.x));
+    };
+
+    if (!inside(origin.x, origin.y)) {
+        return;
+    }
+
+    s.dist[local(origin.x, origin.y)] = 0.0f;
+    s.queue.push_back({0.0f, local(origin.x, origin.y)});
+
+    static constexpr int directions[8][2] = {
+        {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
+    int directions_amount = diagonals ? 8 : 4;
+
+    while (!s.queue.empty()) {
+        std::pop_heap(s.queue.begin(), s.queue.end(), std::greater<QueueItem>());
+        QueueItem item = s.queue.back();
+        s.queue.pop_back();
+
+        if (item.priority > s.dist[item.index]) {
+            continue;
+        }
+
+        if (targets != nullptr && s.is_target[item.index]) {
+            s.is_target[item.index] = 0;
+            targets_left--;
+            if (targets_left == 0) {
+                return;
+            }
+        }
+
+        int x = rect.x + static_cast<int>(item.index % rect.width);
+        int y = rect.y + static_cast<int>(item.index / rect.width);
+
+        for (int d = 0; d < directions_amount; d++) {
+            int dx = directions[d][0];
+            int dy = directions[d][1];
+            int nx = x + dx;
+            int ny = y + dy;
+            if (!inside(nx, ny)) {
+                continue;
+            }
+            if (dx != 0 && dy != 0 && (!inside(nx, y) || !inside(x, ny))) {
+                continue;
+            }
+
+            float step = (dx != 0 && dy != 0) ? DIAGONAL_COST : 1.0f;
+            float cost = step * (reverse ? grid.get_cost(x, y) : grid.get_cost(nx, ny));
+            float dist = item.priority + cost;
+            uint32_t n = local(nx, ny);
+            if (dist < s.dist[n]) {
+                s.dist[n] = dist;
+                s.queue.push_back({dist, n});
+                std::push_heap(s.queue.begin(), s.queue.end(), std::greater<QueueItem>());
+            }
+        }
+    }
+}
+
+float get_cluster_distance(TileRect rect, Point tile) {
+    return cluster_search
+        .dist[static_cast<size_t>(tile.y - rect.y) * rect.width + (tile.x - rect.x)];
+}
+
+} // namespace
+
+// HierarchicalPath
+bool HierarchicalPath::next_segment(std::vector<Point>& tiles) {
+    tiles.clear();
+    if (grid == nullptr || is_finished()) {
+        return false;
+    }
+
+    Point from = waypoints[current];
+    Point to = waypoints[current + 1];
+
+    // Legs either stay inside of a single cluster, or cross border between two
+    // neighbouring tiles.
+    TileRect rect;
+    if (from.x / cluster_size == to.x / cluster_size &&
+        from.y / cluster_size == to.y / cluster_size) {
+        rect = {
+            from.x / cluster_size * cluster_size,
+            from.y / cluster_size * cluster_size,
+            cluster_size,
+            cluster_size};
+    }
+    else {
+        rect = {
+            std::min(from.x, to.x),
+            std::min(from.y, to.y),
+            std::abs(from.x - to.x) + 1,
+            std::abs(from.y - to.y) + 1};
+    }
+
+    if (!find_path_in_rect(*grid, rect, from, to, tiles, options, nullptr)) {
+        return false;
+    }
+
+    tiles.erase(tiles.begin());
+    current++;
+    return true;
+}
+
+// HierarchicalPathfinder
+HierarchicalPathfinder::HierarchicalPathfinder(
+    const PathGrid* _grid, int _cluster_size, PathOptions _options)
+    : grid(_grid)
+    , cluster_size(std::max(_cluster_size, 2))
+    , options(_options) {
+    clusters_amount = {
+        (grid->get_width() + cluster_size - 1) / cluster_size,
+        (grid->get_height() + cluster_size - 1) / cluster_size};
+    rebuild();
+}
+
+HierarchicalPathfinder::HierarchicalPathfinder(const PathGrid* _grid, int _cluster_size)
+    : HierarchicalPathfinder(_grid, _cluster_size, PathOptions()) {
+}
+
+size_t HierarchicalPathfinder::vertical_borders_amount() {
+    return static_cast<size_t>(clusters_amount.x - 1) * clusters_amount.y;
+}
+
+size_t HierarchicalPathfinder::get_border_index(Point cluster, bool right) {
+    if (right) {
+        return static_cast<size_t>(cluster.y) * (clusters_amount.x - 1) + cluster.x;
+    }
+    size_t row = static_cast<size_t>(cluster.y) * clusters_amount.x;
+    return vertical_borders_amount() + row + cluster.x;
+}
+
+uint32_t HierarchicalPathfinder::allocate_node() {
+    if (!free_nodes.empty()) {
+        uint32_t id = free_nodes.back();
+        free_nodes.pop_back();
+        return id;
+    }
+
+    nodes.push_back({{0, 0}, NO_NODE, 0, 0});
+    return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void HierarchicalPathfinder::rebuild_border(size_t border) {
+    for (auto id : borders[border]) {
+        free_nodes.push_back(id);
+    }
+    borders[border].clear();
+
+    // Figure out which tiles are on each side of border.
+    // Side a is left (or top) cluster, side b - right (or bottom) one.
+    Point a_start;
+    Point step;
+    int length;
+    bool vertical = border < vertical_borders_amount();
+    if (vertical) {
+        int cx = static_cast<int>(border % (clusters_amount.x - 1));
+        int cy = static_cast<int>(border / (clusters_amount.x - 1));
+        a_start = {(cx + 1) * cluster_size - 1, cy * cluster_size};
+        step = {0, 1};
+        length = std::min(cluster_size, grid->get_height() - a_start.y);
+    }
+    else {
+        size_t index = border - vertical_borders_amount();
+        int cx = static_cast<int>(index % clusters_amount.x);
+        int cy = static_cast<int>(index / clusters_amount.x);
+        a_start = {cx * cluster_size, (cy + 1) * cluster_size - 1};
+        step = {1, 0};
+        length = std::min(cluster_size, grid->get_width() - a_start.x);
+    }
+    Point offset = {step.y, step.x};
+
+    auto open = [&](int i) {
+        Point a = {a_start.x + step.x * i, a_start.y + step.y * i};
+        return grid->is_passable(a.x, a.y) &&
+               grid->is_passable(a.x + offset.x, a.y + offset.y);
+    };
+    auto add_entrance = [&](int i) {
+        Point a = {a_start.x + step.x * i, a_start.y + step.y * i};
+        Point b = {a.x + offset.x, a.y + offset.y};
+        uint32_t a_id = allocate_node();
+        uint32_t b_id = allocate_node();
+        nodes[a_id] = {a, b_id, 0, 0};
+        nodes[b_id] = {b, a_id, 0, 0};
+        borders[border].push_back(a_id);
+        borders[border].push_back(b_id);
+    };
+
+    int i = 0;
+    while (i < length) {
+        if (!open(i)) {
+            i++;
+            continue;
+        }
+
+        int run_start = i;
+        while (i < length && open(i)) {
+            i++;
+        }
+        int run_length = i - run_start;
+
+        if (run_length < WIDE_ENTRANCE) {
+            add_entrance(run_start + run_length / 2);
+        }
+        else {
+            add_entrance(run_start);
+            add_entrance(i - 1);
+        }
+    }
+}
+
+void HierarchicalPathfinder::rebuild_cluster(size_t cluster_index) {
+    Cluster& cluster = clusters[cluster_index];
+    Point c = {
+        static_cast<int>(cluster_index % clusters_amount.x),
+        static_cast<int>(cluster_index / clusters_amount.x)};
+
+    // Gather nodes from borders around. Cluster is side b of borders on its
+    // left and top, and side a of ones on its right and bottom.
+    cluster.nodes.clear();
+    auto gather = [&](size_t border, size_t side) {
+        const std::vector<uint32_t>& pairs = borders[border];
+        for (size_t i = side; i < pairs.size(); i += 2) {
+            cluster.nodes.push_back(pairs[i]);
+        }
+    };
+    if (c.x > 0) {
+        gather(get_border_index({c.x - 1, c.y}, true), 1);
+    }
+    if (c.x < clusters_amount.x - 1) {
+        gather(get_border_index(c, true), 0);
+    }
+    if (c.y > 0) {
+        gather(get_border_index({c.x, c.y - 1}, false), 1);
+    }
+    if (c.y < clusters_amount.y - 1) {
+        gather(get_border_index(c, false), 0);
+    }
+
+    size_t amount = cluster.nodes.size();
+    for (size_t i = 0; i < amount; i++) {
+        Node& node = nodes[cluster.nodes[i]];
+        node.cluster = static_cast<uint32_t>(cluster_index);
+        node.local = static_cast<uint32_t>(i);
+    }
+
+    // Without custom costs distances are the same both ways, thus each search
+    // only needs to look for nodes that haven't been searched from yet.
+    bool symmetric = grid->is_uniform();
+    std::vector<Point> targets;
+
+    cluster.distances.assign(amount * amount, INF);
+    for (size_t i = 0; i < amount; i++) {
+        size_t first = symmetric ? i + 1 : 0;
+        targets.clear();
+        for (size_t j = first; j < amount; j++) {
+            targets.push_back(nodes[cluster.nodes[j]].tile);
+        }
+        if (targets.empty()) {
+            cluster.distances[i * amount + i] = 0.0f;
+            continue;
+        }
+
+        search_cluster(
+            *grid,
+            cluster.rect,
+            nodes[cluster.nodes[i]].tile,
+            options.allow_diagonals,
+            false,
+            &targets);
+
+        cluster.distances[i * amount + i] = 0.0f;
+        for (size_t j = first; j < amount; j++) {
+            float d = get_cluster_distance(cluster.rect, nodes[cluster.nodes[j]].tile);
+            cluster.distances[i * amount + j] = d;
+            if (symmetric) {
+                cluster.distances[j * amount + i] = d;
+            }
+        }
+    }
+}
+
+void HierarchicalPathfinder::rebuild() {
+    nodes.clear();
+    free_nodes.clear();
+
+    size_t clusters_total = static_cast<size_t>(clusters_amount.x) * clusters_amount.y;
+    clusters.assign(clusters_total, Cluster());
+    for (int cy = 0; cy < clusters_amount.y; cy++) {
+        for (int cx = 0; cx < clusters_amount.x; cx++) {
+            Cluster& cluster = clusters[static_cast<size_t>(cy) * clusters_amount.x + cx];
+            cluster.rect = {
+                cx * cluster_size,
+                cy * cluster_size,
+                std::min(cluster_size, grid->get_width() - cx * cluster_size),
+                std::min(cluster_size, grid->get_height() - cy * cluster_size)};
+        }
+    }
+
+    size_t borders_amount =
+        vertical_borders_amount() +
+        static_cast<size_t>(clusters_amount.y - 1) * clusters_amount.x;
+    borders.assign(borders_amount, {});
+    for (size_t i = 0; i < borders_amount; i++) {
+        rebuild_border(i);
+    }
+
+    // Distances inside of clusters are the expensive part, but clusters don't
+    // depend on each other - thus these are computed in parallel.
+    get_worker_pool().parallel_for(clusters.size(), 4, [this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            rebuild_cluster(i);
+        }
+    });
+
+    dirty_borders.assign(borders_amount, 0);
+    dirty_clusters.assign(clusters.size(), 0);
+    has_changes = false;
+}
+
+void HierarchicalPathfinder::mark_tile_changed(Point tile) {
+    Point c = {tile.x / cluster_size, tile.y / cluster_size};
+    if (c.x < 0 || c.y < 0 || c.x >= clusters_amount.x || c.y >= clusters_amount.y) {
+        return;
+    }
+
+    auto mark_border = [&](Point a, bool right) {
+        dirty_borders[get_border_index(a, right)] = 1;
+        dirty_clusters[static_cast<size_t>(a.y) * clusters_amount.x + a.x] = 1;
+        Point b = right ? Point{a.x + 1, a.y} : Point{a.x, a.y + 1};
+        dirty_clusters[static_cast<size_t>(b.y) * clusters_amount.x + b.x] = 1;
+    };
+
+    dirty_clusters[static_cast<size_t>(c.y) * clusters_amount.x + c.x] = 1;
+
+    // Tiles on edges of cluster may also change entrances on its borders
+    if (tile.x == c.x * cluster_size && c.x > 0) {
+        mark_border({c.x - 1, c.y}, true);
+    }
+    if (tile.x == (c.x + 1) * cluster_size - 1 && c.x < clusters_amount.x - 1) {
+        mark_border(c, true);
+    }
+    if (tile.y == c.y * cluster_size && c.y > 0) {
+        mark_border({c.x, c.y - 1}, false);
+    }
+    if (tile.y == (c.y + 1) * cluster_size - 1 && c.y < clusters_amount.y - 1) {
+        mark_border(c, false);
+    }
+
+    has_changes = true;
+}
+
+void HierarchicalPathfinder::read_journal(const std::shared_ptr<TileJournal>& current) {
+    TileChanges changes = journal.read(current);
+    if (changes.everything) {
+        rebuild();
+        return;
+    }
+
+    int width = grid->get_width();
+    for (size_t i = 0; i < changes.tiles_amount; i++) {
+        int tile = static_cast<int>(changes.tiles[i]);
+        mark_tile_changed({tile % width, tile / width});
+    }
+}
+
+void HierarchicalPathfinder::update() {
+    if (!has_changes) {
+        return;
+    }
+
+    for (size_t i = 0; i < borders.size(); i++) {
+        if (dirty_borders[i]) {
+            rebuild_border(i);
+            dirty_borders[i] = 0;
+        }
+    }
+
+    std::vector<size_t> changed;
+    for (size_t i = 0; i < clusters.size(); i++) {
+        if (dirty_clusters[i]) {
+            changed.push_back(i);
+            dirty_clusters[i] = 0;
+        }
+    }
+
+    get_worker_pool().parallel_for(changed.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            rebuild_cluster(changed[i]);
+        }
+    });
+
+    has_changes = false;
+}
+
+bool HierarchicalPathfinder::find_path(Point start, Point goal, HierarchicalPath& path) {
+    path.grid = grid;
+    path.cluster_size = cluster_size;
+    path.options = options;
+    path.waypoints.clear();
+    path.current = 0;
+    path.cost = 0.0f;
+
+    if (!grid->is_passable(start.x, start.y) || !grid->is_passable(goal.x, goal.y)) {
+        return false;
+    }
+
+    const Cluster& start_cluster =
+        clusters[static_cast<size_t>(start.y / cluster_size) * clusters_amount.x +
+                 start.x / cluster_size];
+    const Cluster& goal_cluster =
+        clusters[static_cast<size_t>(goal.y / cluster_size) * clusters_amount.x +
+                 goal.x / cluster_size];
+    bool same_cluster = &start_cluster == &goal_cluster;
+
+    GraphSearch& s = graph_search;
+    uint32_t start_id = static_cast<uint32_t>(nodes.size());
+    uint32_t goal_id = start_id + 1;
+    s.prepare(nodes.size() + 2);
+
+    // Connect start and goal to entrances of their clusters
+    search_cluster(
+        *grid, start_cluster.rect, start, options.allow_diagonals, false, nullptr);
+    s.start_edges.resize(start_cluster.nodes.size());
+    for (size_t i = 0; i < start_cluster.nodes.size(); i++) {
+        s.start_edges[i] =
+            get_cluster_distance(start_cluster.rect, nodes[start_cluster.nodes[i]].tile);
+    }
+    float direct = same_cluster ? get_cluster_distance(start_cluster.rect, goal) : INF;
+
+    search_cluster(
+        *grid, goal_cluster.rect, goal, options.allow_diagonals, true, nullptr);
+    s.goal_edges.resize(goal_cluster.nodes.size());
+    for (size_t i = 0; i < goal_cluster.nodes.size(); i++) {
+        s.goal_edges[i] =
+            get_cluster_distance(goal_cluster.rect, nodes[goal_cluster.nodes[i]].tile);
+    }
+
+    s.seen[start_id] = s.generation;
+    s.g[start_id] = 0.0f;
+    s.parent[start_id] = NO_NODE;
+    s.open.push_back({octile(start, goal), start_id});
+
+    bool found = false;
+    while (!s.open.empty()) {
+        std::pop_heap(s.open.begin(), s.open.end(), std::greater<QueueItem>());
+        QueueItem item = s.open.back();
+        s.open.pop_back();
+
+        uint32_t u = item.index;
+        if (s.closed[u] == s.generation) {
+            continue;
+        }
+        s.closed[u] = s.generation;
+
+        if (u == goal_id) {
+            found = true;
+            break;
+        }
+
+        float g = s.g[u];
+        if (u == start_id) {
+            for (size_t i = 0; i < start_cluster.nodes.size(); i++) {
+                if (s.start_edges[i] < INF) {
+                    uint32_t v = start_cluster.nodes[i];
+                    s.relax(u, v, s.start_edges[i], octile(nodes[v].tile, goal));
+                }
+            }
+            if (direct < INF) {
+                s.relax(u, goal_id, direct, 0.0f);
+            }
+            continue;
+        }
+
+        const Node& node = nodes[u];
+        const Cluster& cluster = clusters[node.cluster];
+        size_t amount = cluster.nodes.size();
+
+        for (size_t j = 0; j < amount; j++) {
+            float d = cluster.distances[node.local * amount + j];
+            if (j != node.local && d < INF) {
+                uint32_t v = cluster.nodes[j];
+                s.relax(u, v, g + d, octile(nodes[v].tile, goal));
+            }
+        }
+
+        const Node& partner = nodes[node.partner];
+        s.relax(
+            u,
+            node.partner,
+            g + grid->get_cost(partner.tile.x, partner.tile.y),
+            octile(partner.tile, goal));
+
+        if (&cluster == &goal_cluster && s.goal_edges[node.local] < INF) {
+            s.relax(u, goal_id, g + s.goal_edges[node.local], 0.0f);
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    for (uint32_t id = goal_id; id != NO_NODE; id = s.parent[id]) {
+        Point tile = id == goal_id ? goal : id == start_id ? start : nodes[id].tile;
+        // Nodes on corners of clusters may share the same tile
+        if (path.waypoints.empty() || path.waypoints.back().x != tile.x ||
+            path.waypoints.back().y != tile.y) {
+            path.waypoints.push_back(tile);
+        }
+    }
+    std::reverse(path.waypoints.begin(), path.waypoints.end());
+    path.cost = s.g[goal_id];
+
+    return true;
+}
+
+size_t HierarchicalPathfinder::get_nodes_amount() {
+    return nodes.size() - free_nodes.size();
+}
+
+size_t HierarchicalPathfinder::get_clusters_amount() {
+    return clusters.size();
+}
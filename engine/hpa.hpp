@@ -0,0 +1,125 @@
+#pragma once
+
+#include "mapgen.hpp"
+#include "pathfinding.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Hierarchical pathfinding (HPA*), for maps that are too large to search tile
+// by tile each time.
+// Map is split into square clusters. Passable spots on borders between
+// clusters become entrances - nodes of abstract graph, connected with
+// precomputed distances inside of each cluster. Queries search this graph
+// instead of map, and produce coarse path of waypoints that gets refined into
+// actual tiles leg by leg, as unit moves along it.
+// When tiles change, only clusters around them are recomputed.
+
+class HierarchicalPathfinder;
+
+class HierarchicalPath {
+private:
+    friend class HierarchicalPathfinder;
+
+    const PathGrid* grid = nullptr;
+    int cluster_size = 0;
+    PathOptions options;
+
+    std::vector<Point> waypoints;
+    size_t current = 0;
+    float cost = 0.0f;
+
+public:
+    bool is_empty() {
+        return waypoints.empty();
+    }
+
+    // True once all legs have been refined
+    bool is_finished() {
+        return current + 1 >= waypoints.size();
+    }
+
+    const std::vector<Point>& get_waypoints() {
+        return waypoints;
+    }
+
+    // Estimated cost of whole path
+    float get_cost() {
+        return cost;
+    }
+
+    // Turn next leg of path into tiles. Current waypoint is not included, next
+    // one is. Returns false if there is nothing left to refine, or if map has
+    // changed in a way that made this leg impossible - in which case its time
+    // to request a new path.
+    bool next_segment(std::vector<Point>& tiles);
+};
+
+class HierarchicalPathfinder {
+private:
+    struct Node {
+        Point tile;
+        // Node on the other side of border
+        uint32_t partner;
+        uint32_t cluster;
+        // Position in cluster's node list
+        uint32_t local;
+    };
+
+    struct Cluster {
+        TileRect rect;
+        std::vector<uint32_t> nodes;
+        // Distances between each pair of nodes, nodes.size() x nodes.size()
+        std::vector<float> distances;
+    };
+
+    const PathGrid* grid;
+    int cluster_size;
+    Point clusters_amount;
+    PathOptions options;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> free_nodes;
+    std::vector<Cluster> clusters;
+    // Pairs of nodes on each border. Borders between horizontal neighbours go
+    // first, then ones between vertical neighbours.
+    std::vector<std::vector<uint32_t>> borders;
+
+    std::vector<uint8_t> dirty_borders;
+    std::vector<uint8_t> dirty_clusters;
+    bool has_changes = false;
+    TileJournalReader journal;
+
+    size_t vertical_borders_amount();
+    size_t get_border_index(Point cluster, bool right);
+    void rebuild_border(size_t border);
+    void rebuild_cluster(size_t cluster);
+    uint32_t allocate_node();
+
+public:
+    HierarchicalPathfinder(const PathGrid* grid, int cluster_size, PathOptions options);
+    HierarchicalPathfinder(const PathGrid* grid, int cluster_size);
+
+    // Recompute everything from scratch. Called automatically on creation.
+    void rebuild();
+
+    // Remember that tile has changed. Nothing is recomputed until update().
+    void mark_tile_changed(Point tile);
+
+    // Mark tiles map's journal has recorded since the previous call. Meant to
+    // be called with map's get_journal() each frame, once grid is up to date
+    // (see update_path_grid()). New journal counts as change of everything.
+    void read_journal(const std::shared_ptr<TileJournal>& current);
+
+    // Recompute clusters affected by changes since the last update.
+    // Must be called before querying paths, after changing the grid.
+    void update();
+
+    // Find coarse path between two tiles. Returns false if there is no path.
+    // Safe to call from multiple threads at once, as long as nobody calls
+    // update() at the same time.
+    bool find_path(Point start, Point goal, HierarchicalPath& path);
+
+    size_t get_nodes_amount();
+    size_t get_clusters_amount();
+};
@@ -0,0 +1,399 @@
+#include "labeling.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+
+// Rows labeled per task, before bands get merged
+static constexpr int BAND_ROWS = 64;
+
+static bool is_bit_set(const uint64_t* row, int x) {
+    return (row[x >> 6] >> (x & 63)) & 1;
+}
+
+// Grow stats by one tile
+static void add_to_stats(ComponentStats& stats, Point tile) {
+    if (stats.size == 0) {
+        stats.bounds = {tile.x, tile.y, 1, 1};
+    }
+    else {
+        TileRect& bounds = stats.bounds;
+        int right = std::max(bounds.x + bounds.width, tile.x + 1);
+        int bottom = std::max(bounds.y + bounds.height, tile.y + 1);
+        bounds.x = std::min(bounds.x, tile.x);
+        bounds.y = std::min(bounds.y, tile.y);
+        bounds.width = right - bounds.x;
+        bounds.height = bottom - bounds.y;
+    }
+    stats.size++;
+}
+
+// Join stats of two components
+static void merge_stats(ComponentStats& stats, const ComponentStats& other) {
+    if (other.size == 0) {
+        return;
+    }
+    if (stats.size == 0) {
+        stats = other;
+        return;
+    }
+
+    TileRect& bounds = stats.bounds;
+    int right = std::max(bounds.x + bounds.width, other.bounds.x + other.bounds.width);
+    int bottom = std::max(bounds.y + bounds.height, other.bounds.y + other.bounds.height);
+    bounds.x = std::min(bounds.x, other.bounds.x);
+    bounds.y = std::min(bounds.y, other.bounds.y);
+    bounds.width = right - bounds.x;
+    bounds.height = bottom - bounds.y;
+    stats.size += other.size;
+}
+
+int32_t TileLabels::find(int32_t label) const {
+    while (parents[label] != label) {
+        label = parents[label];
+    }
+    return label;
+}
+
+int32_t TileLabels::add_component(Point tile) {
+    int32_t label = static_cast<int32_t>(parents.size());
+    parents.push_back(label);
+    stats.push_back({});
+    add_to_stats(stats.back(), tile);
+    components_amount++;
+    return label;
+}
+
+void TileLabels::build(const BitGrid& mask, Neighbourhood _connectivity, bool parallel) {
+    width = mask.get_width();
+    height = mask.get_height();
+    connectivity = _connectivity;
+    bool has_diagonals = connectivity == Neighbourhood::Moore;
+
+    labels.assign(static_cast<size_t>(width) * height, NO_COMPONENT);
+    parents.clear();
+    stats.clear();
+    components_amount = 0;
+    visit_marks.clear();
+    visit_stamp = 0;
+
+    // During the first pass, labels are parent tiles of union-find over tiles.
+    // Roots always get linked to the smaller one, so parents always come
+    // before their children - and tiles of band only ever point within band.
+    auto find_root = [&](int32_t tile) {
+        while (labels[tile] != tile) {
+            labels[tile] = labels[labels[tile]];
+            tile = labels[tile];
+        }
+        return tile;
+    };
+    auto unite = [&](int32_t first, int32_t second) {
+        first = find_root(first);
+        second = find_root(second);
+        if (first < second) {
+            labels[second] = first;
+        }
+        else if (second < first) {
+            labels[first] = second;
+        }
+    };
+
+    auto link_above = [&](int y) {
+        const uint64_t* row = mask.get_row(y);
+        const uint64_t* above = mask.get_row(y - 1);
+        int32_t index = y * width;
+        for (int x = 0; x < width; x++) {
+            if (!is_bit_set(row, x)) {
+                continue;
+            }
+            if (is_bit_set(above, x)) {
+                unite(index + x, index + x - width);
+            }
+            if (has_diagonals && x > 0 && is_bit_set(above, x - 1)) {
+                unite(index + x, index + x - width - 1);
+            }
+            if (has_diagonals && x + 1 < width && is_bit_set(above, x + 1)) {
+                unite(index + x, index + x - width + 1);
+            }
+        }
+    };
+
+    auto label_band = [&](int first_y, int last_y) {
+        for (int y = first_y; y < last_y; y++) {
+            const uint64_t* row = mask.get_row(y);
+            int32_t index = y * width;
+            for (int x = 0; x < width; x++) {
+                // Skipping empty words at once, these are common on sparse masks
+                if ((x & 63) == 0 && row[x >> 6] == 0) {
+                    x += 63;
+                    continue;
+                }
+                if (!is_bit_set(row, x)) {
+                    continue;
+                }
+                labels[index + x] = index + x;
+                if (x > 0 && is_bit_set(row, x - 1)) {
+                    unite(index + x, index + x - 1);
+                }
+            }
+            if (y > first_y) {
+                link_above(y);
+            }
+        }
+    };
+
+    int bands_amount = parallel ? (height + BAND_ROWS - 1) / BAND_ROWS : 1;
+    int band_rows = parallel ? BAND_ROWS : height;
+    get_worker_pool().parallel_for(bands_amount, 1, [&](size_t first, size_t last) {
+        for (size_t band = first; band < last; band++) {
+            int first_y = static_cast<int>(band) * band_rows;
+            label_band(first_y, std::min(first_y + band_rows, height));
+        }
+    });
+
+    // Merging bands along their borders. There are few of these, thus that's
+    // done right here.
+    for (int band = 1; band < bands_amount; band++) {
+        link_above(band * band_rows);
+    }
+
+    // Since parents come first, by the time tile is reached its parent already
+    // holds final label - thus single pass turns parents into labels.
+    size_t index = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++, index++) {
+            int32_t parent = labels[index];
+            if (parent == NO_COMPONENT) {
+                continue;
+            }
+
+            int32_t label;
+            if (parent == static_cast<int32_t>(index)) {
+                label = static_cast<int32_t>(parents.size());
+                parents.push_back(label);
+                stats.push_back({});
+                components_amount++;
+            }
+            else {
+                label = labels[parent];
+            }
+            labels[index] = label;
+            add_to_stats(stats[label], {x, y});
+        }
+    }
+}
+
+bool TileLabels::walk(
+    size_t start,
+    int32_t root,
+    int32_t label,
+    const std::vector<size_t>& targets,
+    bool can_stop,
+    ComponentStats& walked) {
+    size_t targets_left = targets.size();
+    queue.clear();
+    queue.push_back(start);
+    visit_marks[start] = visit_stamp;
+
+    for (size_t i = 0; i < queue.size(); i++) {
+        size_t index = queue[i];
+        labels[index] = label;
+        Point tile = {static_cast<int>(index % width), static_cast<int>(index / width)};
+        add_to_stats(walked, tile);
+
+        if (std::find(targets.begin(), targets.end(), index) != targets.end()) {
+            targets_left--;
+            if (can_stop && targets_left == 0) {
+                return true;
+            }
+        }
+
+        for_each_neighbour(tile, [&](size_t neighbour) {
+            int32_t neighbour_label = labels[neighbour];
+            bool is_visited = visit_marks[neighbour] == visit_stamp;
+            if (neighbour_label == NO_COMPONENT || is_visited) {
+                return;
+            }
+            if (find(neighbour_label) == root) {
+                visit_marks[neighbour] = visit_stamp;
+                queue.push_back(neighbour);
+            }
+        });
+    }
+
+    return false;
+}
+
+void TileLabels::add_tile(Point tile) {
+    size_t index = static_cast<size_t>(tile.y) * width + tile.x;
+    if (labels[index] != NO_COMPONENT) {
+        return;
+    }
+
+    int32_t roots[8];
+    int roots_amount = 0;
+    for_each_neighbour(tile, [&](size_t neighbour) {
+        if (labels[neighbour] == NO_COMPONENT) {
+            return;
+        }
+        int32_t root = find(labels[neighbour]);
+        if (std::find(roots, roots + roots_amount, root) == roots + roots_amount) {
+            roots[roots_amount++] = root;
+        }
+    });
+
+    if (roots_amount == 0) {
+        labels[index] = add_component(tile);
+        return;
+    }
+
+    // Everything joins the biggest one, which keeps trees of union-find shallow
+    auto is_smaller = [&](int32_t a, int32_t b) {
+        return stats[a].size < stats[b].size;
+    };
+    int32_t root = *std::max_element(roots, roots + roots_amount, is_smaller);
+    ComponentStats& merged = stats[root];
+    for (int i = 0; i < roots_amount; i++) {
+        if (roots[i] == root) {
+            continue;
+        }
+        merge_stats(merged, stats[roots[i]]);
+        stats[roots[i]].size = 0;
+        parents[roots[i]] = root;
+        components_amount--;
+    }
+
+    labels[index] = root;
+    add_to_stats(merged, tile);
+}
+
+void TileLabels::remove_tile(Point tile) {
+    size_t index = static_cast<size_t>(tile.y) * width + tile.x;
+    if (labels[index] == NO_COMPONENT) {
+        return;
+    }
+
+    int32_t root = find(labels[index]);
+    labels[index] = NO_COMPONENT;
+    if (stats[root].size <= 1) {
+        stats[root].size = 0;
+        components_amount--;
+        return;
+    }
+
+    std::vector<size_t> targets;
+    for_each_neighbour(tile, [&](size_t neighbour) {
+        if (labels[neighbour] != NO_COMPONENT && find(labels[neighbour]) == root) {
+            targets.push_back(neighbour);
+        }
+    });
+    if (targets.empty()) {
+        stats[root].size--;
+        return;
+    }
+
+    visit_marks.resize(labels.size(), 0);
+    visit_stamp++;
+    if (visit_stamp == 0) {
+        std::fill(visit_marks.begin(), visit_marks.end(), 0);
+        visit_stamp = 1;
+    }
+
+    // If tile wasn't on the edge of bounds, these stay the same - thus it's
+    // enough to find out that neighbours are still connected. Otherwise the
+    // whole component gets walked, to shrink bounds.
+    const TileRect& bounds = stats[root].bounds;
+    bool is_on_edge = tile.x == bounds.x || tile.y == bounds.y ||
+                      tile.x == bounds.x + bounds.width - 1 ||
+                      tile.y == bounds.y + bounds.height - 1;
+
+    ComponentStats walked;
+    if (walk(targets[0], root, root, targets, !is_on_edge, walked)) {
+        stats[root].size--;
+        return;
+    }
+    stats[root] = walked;
+
+    // Neighbours that haven't been reached are cut off, each part of these
+    // becomes component of its own
+    for (size_t target : targets) {
+        if (visit_marks[target] == visit_stamp) {
+            continue;
+        }
+        int32_t label = static_cast<int32_t>(parents.size());
+        parents.push_back(label);
+        stats.push_back({});
+        components_amount++;
+
+        ComponentStats part;
+        walk(target, root, label, {}, false, part);
+        stats[label] = part;
+    }
+}
+
+void TileLabels::update_tile(const BitGrid& mask, Point tile) {
+    if (mask.get(tile.x, tile.y)) {
+        add_tile(tile);
+    }
+    else {
+        remove_tile(tile);
+    }
+}
+
+void flood_fill(
+    const BitGrid& mask,
+    Point start,
+    Neighbourhood connectivity,
+    std::vector<size_t>& tiles) {
+    tiles.clear();
+    if (!mask.is_inside(start.x, start.y) || !mask.get(start.x, start.y)) {
+        return;
+    }
+
+    int width = mask.get_width();
+    int height = mask.get_height();
+    // Diagonal neighbours of span reach one tile further to each side
+    int reach = connectivity == Neighbourhood::Moore ? 1 : 0;
+    BitGrid visited(width, height);
+    std::vector<Point> seeds = {start};
+
+    // Scanline fill - each seed grows into the whole run of set tiles around it,
+    // then runs touching it from above and below become new seeds
+    auto can_fill = [&](int x, int y) { return mask.get(x, y) && !visited.get(x, y); };
+    while (!seeds.empty()) {
+        Point seed = seeds.back();
+        seeds.pop_back();
+        if (!can_fill(seed.x, seed.y)) {
+            continue;
+        }
+
+        int first_x = seed.x;
+        int last_x = seed.x;
+        while (first_x > 0 && can_fill(first_x - 1, seed.y)) {
+            first_x--;
+        }
+        while (last_x + 1 < width && can_fill(last_x + 1, seed.y)) {
+            last_x++;
+        }
+
+        size_t index = static_cast<size_t>(seed.y) * width + first_x;
+        for (int x = first_x; x <= last_x; x++, index++) {
+            visited.set(x, seed.y, true);
+            tiles.push_back(index);
+        }
+
+        for (int y = seed.y - 1; y <= seed.y + 1; y += 2) {
+            if (y < 0 || y >= height) {
+                continue;
+            }
+            bool is_in_run = false;
+            int scan_last = std::min(last_x + reach, width - 1);
+            for (int x = std::max(first_x - reach, 0); x <= scan_last; x++) {
+                bool is_fillable = can_fill(x, y);
+                if (is_fillable && !is_in_run) {
+                    seeds.push_back({x, y});
+                }
+                is_in_run = is_fillable;
+            }
+        }
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "bitgrid.hpp"
+#include "mapgen.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Connected components of tiles - rooms, islands, areas reachable from each
+// other, etc. Tiles in question are the set bits of BitGrid mask, usually
+// made with make_tile_mask() out of predicate on map's objects.
+// Whole map is labeled with union-find, with rows split into bands that get
+// labeled in parallel and then merged along their borders. Afterwards single
+// tiles may be updated without relabeling everything.
+
+struct ComponentStats {
+    size_t size = 0;
+    TileRect bounds = {0, 0, 0, 0};
+};
+
+class TileLabels {
+private:
+    int width = 0;
+    int height = 0;
+    Neighbourhood connectivity = Neighbourhood::VonNeumann;
+
+    // Label of each tile, or NO_COMPONENT. Once components merge, tiles may
+    // keep label of the merged one - get_label() resolves these.
+    std::vector<int32_t> labels;
+
+    // Union-find over labels, to merge components without relabeling tiles.
+    // Stats are only valid for roots.
+    std::vector<int32_t> parents;
+    std::vector<ComponentStats> stats;
+    size_t components_amount = 0;
+
+    // Scratch space of updates. Tiles with current stamp are visited already.
+    std::vector<uint32_t> visit_marks;
+    uint32_t visit_stamp = 0;
+    std::vector<size_t> queue;
+
+    int32_t find(int32_t label) const;
+    int32_t add_component(Point tile);
+
+    // Call fn(size_t neighbour_index) for each neighbour of tile within map
+    template <typename F> void for_each_neighbour(Point tile, F fn) const {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                bool is_diagonal = dx != 0 && dy != 0;
+                if ((dx == 0 && dy == 0) ||
+                    (is_diagonal && connectivity == Neighbourhood::VonNeumann)) {
+                    continue;
+                }
+                int x = tile.x + dx;
+                int y = tile.y + dy;
+                if (0 <= x && x < width && 0 <= y && y < height) {
+                    fn(static_cast<size_t>(y) * width + x);
+                }
+            }
+        }
+    }
+
+    // Visit tiles of component root reachable from start, giving them label.
+    // Stops early once all of targets are visited, unless that's disabled.
+    // Returns true if stopped early.
+    bool walk(
+        size_t start,
+        int32_t root,
+        int32_t label,
+        const std::vector<size_t>& targets,
+        bool can_stop,
+        ComponentStats& walked);
+
+    void add_tile(Point tile);
+    void remove_tile(Point tile);
+
+public:
+    static constexpr int32_t NO_COMPONENT = -1;
+
+    TileLabels() = default;
+
+    // Label set tiles of mask. Components get labels from 0 up, in order of
+    // their first tile, row by row.
+    void build(const BitGrid& mask, Neighbourhood _connectivity, bool parallel);
+
+    void build(const BitGrid& mask, Neighbourhood _connectivity) {
+        build(mask, _connectivity, true);
+    }
+
+    // Update labels after tile's bit in mask has changed. Adding a tile is
+    // cheap. Removing one walks its component, to find out if it has split -
+    // parts that are cut off get new labels.
+    void update_tile(const BitGrid& mask, Point tile);
+
+    // Label of tile's component, or NO_COMPONENT. Tile must be within map.
+    int32_t get_label(Point tile) const {
+        int32_t label = labels[static_cast<size_t>(tile.y) * width + tile.x];
+        return label == NO_COMPONENT ? NO_COMPONENT : find(label);
+    }
+
+    bool are_connected(Point first, Point second) const {
+        int32_t label = get_label(first);
+        return label != NO_COMPONENT && label == get_label(second);
+    }
+
+    // Label must be one returned by get_label()
+    const ComponentStats& get_stats(int32_t label) const {
+        return stats[label];
+    }
+
+    size_t get_components_amount() const {
+        return components_amount;
+    }
+
+    // Call fn(int32_t label, const ComponentStats& stats) for each component
+    template <typename F> void for_each_component(F fn) const {
+        for (size_t label = 0; label < parents.size(); label++) {
+            if (parents[label] == static_cast<int32_t>(label) && stats[label].size > 0) {
+                fn(static_cast<int32_t>(label), stats[label]);
+            }
+        }
+    }
+
+    Point get_size() const {
+        return {width, height};
+    }
+};
+
+// Label tiles that have at least one object matching predicate
+template <typename T>
+TileLabels label_tiles(
+    TileMapBase<T>& map,
+    const std::function<bool(T)>& predicate,
+    Neighbourhood connectivity) {
+    TileLabels labels;
+    labels.build(make_tile_mask(map, predicate), connectivity);
+    return labels;
+}
+
+// Grid indices of set tiles of mask reachable from start, run by run in order
+// of discovery. Iterative, thus fine with components of any size. Empty if
+// start isn't set or is out of mask.
+void flood_fill(
+    const BitGrid& mask,
+    Point start,
+    Neighbourhood connectivity,
+    std::vector<size_t>& tiles);
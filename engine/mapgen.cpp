@@ -0,0 +1,386 @@
+#include "mapgen.hpp"
+#include "workers.hpp"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <sstream>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define MAPGEN_SSE2
+#endif
+
+void pack_colors(const unsigned char* pixels, int* colors, size_t amount) {
+    size_t i = 0;
+
+#if defined(MAPGEN_SSE2)
+    // Four pixels at once. Loaded as little endian words, pixels look like
+    // 0xAABBGGRR, while ColorToInt() wants 0xRRGGBBAA - so its just a byte swap
+    // of each word. SSE2 has no byte shuffle, thus its done with shifts.
+    const __m128i middle_mask = _mm_set1_epi32(0x00ff0000);
+    for (; i + 4 <= amount; i += 4) {
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i * 4));
+        __m128i swapped = _mm_or_si128(
+            _mm_or_si128(_mm_slli_epi32(words, 24), _mm_srli_epi32(words, 24)),
+            _mm_or_si128(
+                _mm_and_si128(_mm_slli_epi32(words, 8), middle_mask),
+                _mm_and_si128(_mm_srli_epi32(words, 8), _mm_srli_epi32(middle_mask, 8))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(colors + i), swapped);
+    }
+#endif
+
+    // Leftovers, or everything if there is no SSE2. Compilers turn this into
+    // a load and a bswap.
+    for (; i < amount; i++) {
+        const unsigned char* pixel = pixels + i * 4;
+        uint32_t r = pixel[0];
+        uint32_t g = pixel[1];
+        uint32_t b = pixel[2];
+        uint32_t a = pixel[3];
+        colors[i] = static_cast<int>((r << 24) | (g << 16) | (b << 8) | a);
+    }
+}
+
+void read_image_colors(Image image, std::vector<int>& colors) {
+    size_t width = static_cast<size_t>(image.width);
+    size_t height = static_cast<size_t>(image.height);
+    colors.resize(width * height);
+    if (colors.empty()) {
+        return;
+    }
+
+    // Converting whole image once is way cheaper than decoding pixel format on
+    // each GetImageColor() call
+    Image pixels = image;
+    bool is_copy = false;
+    if (image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) {
+        pixels = ImageCopy(image);
+        ImageFormat(&pixels, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        is_copy = true;
+    }
+
+    // Compressed images can't be converted. These shouldn't be used as maps
+    // anyway, but just in case - fall back to the slow path.
+    if (pixels.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 || pixels.data == nullptr) {
+        for (int y = 0; y < image.height; y++) {
+            for (int x = 0; x < image.width; x++) {
+                colors[y * width + x] = ColorToInt(GetImageColor(image, x, y));
+            }
+        }
+    }
+    else {
+        const unsigned char* data = static_cast<const unsigned char*>(pixels.data);
+        get_worker_pool().parallel_for(height, 64, [&](size_t first, size_t last) {
+            size_t offset = first * width;
+            size_t amount = (last - first) * width;
+            pack_colors(data + offset * 4, colors.data() + offset, amount);
+        });
+    }
+
+    if (is_copy) {
+        UnloadImage(pixels);
+    }
+}
+
+namespace {
+
+// Colors of some part of map, in order of their appearance
+struct LocalPalette {
+    std::vector<int> colors;
+    std::unordered_map<int, uint16_t> known;
+
+    // Maps rarely have more than a handful of colors, thus small direct-mapped
+    // cache in front of hash map catches nearly all lookups
+    static constexpr size_t CACHE_SIZE = 256;
+    int cached_colors[CACHE_SIZE] = {};
+    uint16_t cached_indices[CACHE_SIZE];
+
+    LocalPalette() {
+        std::fill(cached_indices, cached_indices + CACHE_SIZE, NO_PALETTE_INDEX);
+    }
+
+    uint16_t get_index(int color, size_t limit) {
+        size_t slot = (static_cast<uint32_t>(color) * 2654435761u) >> 24;
+        if (cached_colors[slot] == color && cached_indices[slot] != NO_PALETTE_INDEX) {
+            return cached_indices[slot];
+        }
+
+        uint16_t index = NO_PALETTE_INDEX;
+        auto it = known.find(color);
+        if (it != known.end()) {
+            index = it->second;
+        }
+        else if (colors.size() < limit) {
+            index = static_cast<uint16_t>(colors.size());
+            known.emplace(color, index);
+            colors.push_back(color);
+        }
+
+        cached_colors[slot] = color;
+        cached_indices[slot] = index;
+        return index;
+    }
+};
+
+// Small enough for local indices to always fit into uint16_t
+constexpr size_t PALETTE_CHUNK = 32768;
+
+} // namespace
+
+void build_palette(
+    const std::vector<int>& colors,
+    std::vector<int>& palette,
+    std::vector<uint16_t>& indices) {
+    palette.clear();
+    indices.resize(colors.size());
+    size_t chunks_amount = (colors.size() + PALETTE_CHUNK - 1) / PALETTE_CHUNK;
+    WorkerPool& pool = get_worker_pool();
+
+    // Each chunk gets its own palette first, with indices into it
+    std::vector<std::vector<int>> chunk_colors(chunks_amount);
+    pool.parallel_for(chunks_amount, 1, [&](size_t first, size_t last) {
+        for (size_t chunk = first; chunk < last; chunk++) {
+            LocalPalette local;
+            size_t end = std::min((chunk + 1) * PALETTE_CHUNK, colors.size());
+            for (size_t i = chunk * PALETTE_CHUNK; i < end; i++) {
+                indices[i] = local.get_index(colors[i], PALETTE_CHUNK);
+            }
+            chunk_colors[chunk] = std::move(local.colors);
+        }
+    });
+
+    // Then these get merged in order, so colors keep order of appearance
+    LocalPalette global;
+    std::vector<std::vector<uint16_t>> remaps(chunks_amount);
+    bool overflown = false;
+    for (size_t chunk = 0; chunk < chunks_amount; chunk++) {
+        for (auto color : chunk_colors[chunk]) {
+            uint16_t index = global.get_index(color, NO_PALETTE_INDEX);
+            overflown = overflown || index == NO_PALETTE_INDEX;
+            remaps[chunk].push_back(index);
+        }
+    }
+    palette = std::move(global.colors);
+
+    pool.parallel_for(chunks_amount, 1, [&](size_t first, size_t last) {
+        for (size_t chunk = first; chunk < last; chunk++) {
+            const std::vector<uint16_t>& remap = remaps[chunk];
+            size_t end = std::min((chunk + 1) * PALETTE_CHUNK, colors.size());
+            for (size_t i = chunk * PALETTE_CHUNK; i < end; i++) {
+                indices[i] = remap[indices[i]];
+            }
+        }
+    });
+
+    if (overflown) {
+        spdlog::warn(
+            "Map has more than {} distinct colors, tiles of the rest will be ignored",
+            static_cast<int>(NO_PALETTE_INDEX));
+    }
+}
+
+// StripReader
+int StripReader::read_rows(int rows_amount, std::vector<int>& colors) {
+    rows_amount = std::min(rows_amount, size.y - next_row);
+    if (failed || rows_amount <= 0) {
+        colors.clear();
+        return 0;
+    }
+
+    colors.resize(static_cast<size_t>(rows_amount) * size.x);
+    if (!decode_rows(rows_amount, colors.data())) {
+        failed = true;
+        colors.clear();
+        return 0;
+    }
+
+    next_row += rows_amount;
+    return rows_amount;
+}
+
+// FileStripReader
+FileStripReader::FileStripReader(const std::string& _path)
+    : path(_path)
+    , file(_path, std::ios::binary) {
+    if (!file) {
+        spdlog::warn("Unable to open map file {}", path);
+        failed = true;
+    }
+}
+
+bool FileStripReader::validate() {
+    // Grid indices get passed around as uint32_t, thus map can't be bigger
+    // than that
+    bool is_valid = size.x > 0 && size.y > 0 && 1 <= channels && channels <= 4 &&
+                    0 < max_value && max_value <= 65535 &&
+                    static_cast<uint64_t>(size.x) * size.y <= UINT32_MAX;
+    if (!is_valid) {
+        spdlog::warn(
+            "Map file {} has unsupported size {}x{}, {} channels or max value {}",
+            path,
+            size.x,
+            size.y,
+            channels,
+            max_value);
+    }
+    return is_valid;
+}
+
+bool FileStripReader::decode_rows(int rows_amount, int* colors) {
+    size_t sample_size = max_value > 255 ? 2 : 1;
+    size_t pixels_amount = static_cast<size_t>(rows_amount) * size.x;
+    buffer.resize(pixels_amount * channels * sample_size);
+
+    file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    if (static_cast<size_t>(file.gcount()) != buffer.size()) {
+        spdlog::warn("Map file {} ends before row {}", path, next_row + rows_amount);
+        return false;
+    }
+
+    const unsigned char* data = buffer.data();
+    size_t width = static_cast<size_t>(size.x);
+
+    // The usual case, which needs no conversion at all
+    if (channels == 4 && max_value == 255) {
+        get_worker_pool().parallel_for(rows_amount, 16, [&](size_t first, size_t last) {
+            size_t offset = first * width;
+            pack_colors(data + offset * 4, colors + offset, (last - first) * width);
+        });
+        return true;
+    }
+
+    int stride = channels * static_cast<int>(sample_size);
+    auto sample = [&](const unsigned char* pixel, int channel) -> uint32_t {
+        const unsigned char* at = pixel + channel * sample_size;
+        uint32_t value = sample_size == 2 ? (at[0] << 8) | at[1] : at[0];
+        value = std::min<uint32_t>(value, max_value);
+        return (value * 255 + max_value / 2) / max_value;
+    };
+
+    get_worker_pool().parallel_for(rows_amount, 16, [&](size_t first, size_t last) {
+        for (size_t i = first * width; i < last * width; i++) {
+            const unsigned char* pixel = data + i * stride;
+            uint32_t r = sample(pixel, 0);
+            uint32_t g = r;
+            uint32_t b = r;
+            uint32_t a = 255;
+            if (channels == 2) {
+                a = sample(pixel, 1);
+            }
+            else if (channels >= 3) {
+                g = sample(pixel, 1);
+                b = sample(pixel, 2);
+                if (channels == 4) {
+                    a = sample(pixel, 3);
+                }
+            }
+            colors[i] = static_cast<int>((r << 24) | (g << 16) | (b << 8) | a);
+        }
+    });
+    return true;
+}
+
+namespace {
+
+// Next whitespace-separated word of P5/P6 header, skipping comments. The single
+// whitespace after word is consumed too - which is what binary data after the
+// last header value needs.
+bool read_pnm_token(std::istream& file, std::string& token) {
+    token.clear();
+    int c = file.get();
+    while (c != EOF) {
+        if (c == '#') {
+            while (c != EOF && c != '\n') {
+                c = file.get();
+            }
+        }
+        else if (std::isspace(c)) {
+            c = file.get();
+        }
+        else {
+            break;
+        }
+    }
+
+    while (c != EOF && !std::isspace(c)) {
+        token.push_back(static_cast<char>(c));
+        c = file.get();
+    }
+
+    return !token.empty();
+}
+
+bool parse_number(const std::string& token, int& value) {
+    const char* end = token.data() + token.size();
+    auto result = std::from_chars(token.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+} // namespace
+
+// PnmStripReader
+PnmStripReader::PnmStripReader(const std::string& _path)
+    : FileStripReader(_path) {
+    if (failed) {
+        return;
+    }
+
+    std::string magic;
+    read_pnm_token(file, magic);
+    bool is_parsed = false;
+
+    if (magic == "P5" || magic == "P6") {
+        channels = magic == "P5" ? 1 : 3;
+        std::string width, height, max;
+        is_parsed = read_pnm_token(file, width) && read_pnm_token(file, height) &&
+                    read_pnm_token(file, max) && parse_number(width, size.x) &&
+                    parse_number(height, size.y) && parse_number(max, max_value);
+    }
+    else if (magic == "P7") {
+        // PAM header is made of "KEY value" lines, up to ENDHDR. TUPLTYPE is
+        // ignored, since DEPTH already says everything about layout.
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream words(line);
+            std::string key, value;
+            words >> key >> value;
+            if (key == "ENDHDR") {
+                is_parsed = true;
+                break;
+            }
+            else if (key == "WIDTH") {
+                parse_number(value, size.x);
+            }
+            else if (key == "HEIGHT") {
+                parse_number(value, size.y);
+            }
+            else if (key == "DEPTH") {
+                parse_number(value, channels);
+            }
+            else if (key == "MAXVAL") {
+                parse_number(value, max_value);
+            }
+        }
+    }
+
+    if (!is_parsed) {
+        spdlog::warn("Map file {} is not a binary pgm, ppm or pam image", path);
+        failed = true;
+        return;
+    }
+
+    failed = !validate();
+}
+
+// RawStripReader
+RawStripReader::RawStripReader(const std::string& _path, Point _size)
+    : FileStripReader(_path) {
+    size = _size;
+    if (!failed) {
+        failed = !validate();
+    }
+}
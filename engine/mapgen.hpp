@@ -1,8 +1,19 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include "memory_stats.hpp"
 #include <optional>
 #include "raylib.h"
+#include "tile_journal.hpp"
+#include "workers.hpp"
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -14,8 +25,155 @@ struct Point {
     int y;
 };
 
+// Rectangle of tiles. Unlike raylib's Rectangle, uses integer tile coordinates.
+struct TileRect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Object ids of single tile of TileMapDeep, viewed in place
+struct IdSpan {
+    const int* data;
+    size_t amount;
+
+    const int* begin() const {
+        return data;
+    }
+
+    const int* end() const {
+        return data + amount;
+    }
+
+    size_t size() const {
+        return amount;
+    }
+
+    bool empty() const {
+        return amount == 0;
+    }
+
+    int operator[](size_t i) const {
+        return data[i];
+    }
+};
+
+// Ids of rect of TileMap's tiles, row by row. See TileMap::copy_rect().
+struct TileBlock {
+    Point size = {0, 0};
+    std::vector<int> ids;
+};
+
+// Same for TileMapDeep. Ids of i-th tile are ids from offsets[i] up to
+// offsets[i + 1] - same format as of TileMapDeep::get_map_layout().
+struct DeepTileBlock {
+    Point size = {0, 0};
+    std::vector<uint32_t> offsets;
+    std::vector<int> ids;
+};
+
+// Tile of region, along with its grid index
+struct TileRef {
+    Point tile;
+    size_t index;
+};
+
+// Rectangle of tiles that is already clipped to map. Walked row by row, with
+// grid index tracked along the way - thus without any bounds checks or
+// divisions. Made by TileMapBase::region().
+class TileRegion {
+private:
+    TileRect rect;
+    int map_width;
+
+public:
+    class Iterator {
+    private:
+        TileRef ref;
+        int first_x;
+        int last_x;
+        // Distance from the end of one row to the start of next one
+        size_t row_step;
+
+    public:
+        Iterator(TileRef _ref, int _first_x, int _last_x, size_t _row_step)
+            : ref(_ref)
+            , first_x(_first_x)
+            , last_x(_last_x)
+            , row_step(_row_step) {
+        }
+
+        const TileRef& operator*() const {
+            return ref;
+        }
+
+        Iterator& operator++() {
+            ref.tile.x++;
+            ref.index++;
+            if (ref.tile.x == last_x) {
+                ref.tile.x = first_x;
+                ref.tile.y++;
+                ref.index += row_step;
+            }
+            return *this;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return ref.index != other.ref.index;
+        }
+    };
+
+    TileRegion(TileRect _rect, int _map_width)
+        : rect(_rect)
+        , map_width(_map_width) {
+        if (rect.width <= 0 || rect.height <= 0) {
+            rect = {0, 0, 0, 0};
+        }
+    }
+
+    Iterator begin() const {
+        size_t index = static_cast<size_t>(rect.y) * map_width + rect.x;
+        return Iterator(
+            {{rect.x, rect.y}, index},
+            rect.x,
+            rect.x + rect.width,
+            map_width - rect.width);
+    }
+
+    // Where iterator ends up after the last tile - start of the row below it
+    Iterator end() const {
+        size_t index = static_cast<size_t>(rect.y + rect.height) * map_width + rect.x;
+        return Iterator(
+            {{rect.x, rect.y + rect.height}, index},
+            rect.x,
+            rect.x + rect.width,
+            map_width - rect.width);
+    }
+
+    TileRect get_rect() const {
+        return rect;
+    }
+
+    size_t size() const {
+        return static_cast<size_t>(rect.width) * rect.height;
+    }
+};
+
+enum class Neighbourhood {
+    // Up, down, left, right - within manhattan distance
+    VonNeumann,
+    // Same, plus diagonals - within chebyshev distance
+    Moore
+};
+
+// Saves and loads maps to disk, see tilemap_file.hpp
+template <typename T> class TileMapFile;
+
 template <typename T> class TileMapBase {
 protected:
+    friend class TileMapFile<T>;
+
     Point map_size;
     Point tile_size;
     size_t grid_size;
@@ -24,6 +182,9 @@ protected:
     std::unordered_map<int, T> map_objects;
     size_t map_objects_amount;
 
+    // Optional, see enable_journal()
+    std::shared_ptr<TileJournal> journal;
+
 public:
     TileMapBase(Point _map_size, Point _tile_size)
         : map_size(_map_size)
@@ -46,12 +207,53 @@ public:
         return object_id;
     }
 
+    // Start recording which tiles change, for renderers and other systems that
+    // mirror map to subscribe to. Chunk size should match the one of whoever
+    // uses chunks - renderer's default is 16.
+    std::shared_ptr<TileJournal> enable_journal(int chunk_size) {
+        if (journal == nullptr || journal->get_chunk_size() != chunk_size) {
+            journal = std::make_shared<TileJournal>(map_size.x, map_size.y, chunk_size);
+        }
+        return journal;
+    }
+
+    std::shared_ptr<TileJournal> enable_journal() {
+        return enable_journal(16);
+    }
+
+    // nullptr, unless journal has been enabled
+    std::shared_ptr<TileJournal> get_journal() {
+        return journal;
+    }
+
+    // Record change of tile in journal. Map's own methods do that on their own,
+    // call it if tile's contents have been changed some other way.
+    void mark_tile_changed(size_t grid_index) {
+        if (journal != nullptr) {
+            journal->record(grid_index);
+        }
+    }
+
+    // Same, for tiles of rect that has been changed in bulk. Rect must be
+    // within map. Journal gets it as a single change.
+    void mark_rect_changed(TileRect rect) {
+        if (journal != nullptr) {
+            journal->record_rect(rect.x, rect.y, rect.width, rect.height);
+        }
+    }
+
     virtual void clear_tile(int grid_index, bool delete_from_storage) = 0;
 
     virtual bool place_object(size_t grid_index, int object_id) = 0;
 
     virtual std::optional<Point> find_object_tile(int object_id) = 0;
 
+    // Call provided function with id of each object that should be visible on
+    // specified tile. Used by things that walk the map without knowing which
+    // grid layout it has (renderers, etc).
+    virtual void for_each_object_id(
+        size_t grid_index, const std::function<void(int)>& fn) = 0;
+
     T get_object_by_id(int object_id) {
         return map_objects.at(object_id);
     }
@@ -111,6 +313,141 @@ public:
         return static_cast<size_t>(y * map_size.x + x);
     }
 
+    // Region and neighbourhood walking.
+    // Everything below clips to map once and then walks rows of tiles, calling
+    // fn(Point tile, size_t grid_index) for each of them - so there is no need
+    // to check bounds or convert between tiles and indices in gameplay loops.
+
+    // Part of rect that is within map. Width and height may end up as 0.
+    TileRect clip_rect(TileRect rect) const {
+        int first_x = std::max(rect.x, 0);
+        int first_y = std::max(rect.y, 0);
+        int last_x = std::min(rect.x + rect.width, map_size.x);
+        int last_y = std::min(rect.y + rect.height, map_size.y);
+        return {
+            first_x,
+            first_y,
+            std::max(last_x - first_x, 0),
+            std::max(last_y - first_y, 0)};
+    }
+
+    bool is_rect_on_map(TileRect rect) const {
+        return rect.width >= 0 && rect.height >= 0 && rect.x >= 0 && rect.y >= 0 &&
+               rect.x + rect.width <= map_size.x && rect.y + rect.height <= map_size.y;
+    }
+
+    // Rects can be swapped only if both are fully within map and don't overlap
+    bool can_swap_rects(TileRect rect, Point tile) const {
+        TileRect other = {tile.x, tile.y, rect.width, rect.height};
+        bool overlap = rect.x < other.x + other.width && other.x < rect.x + rect.width &&
+                       rect.y < other.y + other.height && other.y < rect.y + rect.height;
+        return is_rect_on_map(rect) && is_rect_on_map(other) && !overlap;
+    }
+
+    // Iterable tiles of rect, clipped to map:
+    // for (auto& [tile, grid_index] : map.region(rect)) {...}
+    TileRegion region(TileRect rect) const {
+        return TileRegion(clip_rect(rect), map_size.x);
+    }
+
+    // Call fn(int y, int first_x, int last_x, size_t first_index) for each row
+    // of rect that is within map. Right border is exclusive. Tiles of row are
+    // contiguous in grid, thus loops over these vectorize nicely.
+    template <typename F> void for_each_row_span(TileRect rect, F fn) const {
+        rect = clip_rect(rect);
+        if (rect.width == 0) {
+            return;
+        }
+        size_t index = static_cast<size_t>(rect.y) * map_size.x + rect.x;
+        for (int y = rect.y; y < rect.y + rect.height; y++, index += map_size.x) {
+            fn(y, rect.x, rect.x + rect.width, index);
+        }
+    }
+
+    template <typename F> void for_each_in_rect(TileRect rect, F fn) const {
+        for_each_row_span(rect, [&](int y, int first_x, int last_x, size_t index) {
+            for (int x = first_x; x < last_x; x++, index++) {
+                fn(Point{x, y}, index);
+            }
+        });
+    }
+
+    // Tiles within radius of center, except center itself, in row order
+    template <typename F>
+    void for_each_neighbour(Point center, Neighbourhood kind, int radius, F fn) const {
+        for (int dy = -radius; dy <= radius; dy++) {
+            int reach = kind == Neighbourhood::Moore ? radius : radius - std::abs(dy);
+            int y = center.y + dy;
+            if (dy == 0) {
+                for_each_in_rect({center.x - reach, y, reach, 1}, fn);
+                for_each_in_rect({center.x + 1, y, reach, 1}, fn);
+            }
+            else {
+                for_each_in_rect({center.x - reach, y, reach * 2 + 1, 1}, fn);
+            }
+        }
+    }
+
+    template <typename F>
+    void for_each_neighbour(Point center, Neighbourhood kind, F fn) const {
+        for_each_neighbour(center, kind, 1, fn);
+    }
+
+    // Tiles at exactly radius (chebyshev distance) from center - border of
+    // square around it
+    template <typename F> void for_each_in_ring(Point center, int radius, F fn) const {
+        if (radius <= 0) {
+            for_each_in_rect({center.x, center.y, 1, 1}, fn);
+            return;
+        }
+
+        int side = radius * 2 + 1;
+        for_each_in_rect({center.x - radius, center.y - radius, side, 1}, fn);
+        for (int y = center.y - radius + 1; y < center.y + radius; y++) {
+            for_each_in_rect({center.x - radius, y, 1, 1}, fn);
+            for_each_in_rect({center.x + radius, y, 1, 1}, fn);
+        }
+        for_each_in_rect({center.x - radius, center.y + radius, side, 1}, fn);
+    }
+
+    // Tiles on line between two points, both included (bresenham). Parts of
+    // line outside of map are skipped.
+    template <typename F> void for_each_on_line(Point from, Point to, F fn) const {
+        int dx = std::abs(to.x - from.x);
+        int dy = -std::abs(to.y - from.y);
+        int step_x = from.x < to.x ? 1 : -1;
+        int step_y = from.y < to.y ? 1 : -1;
+        int error = dx + dy;
+
+        // Index is tracked along the way, and may go out of grid while line
+        // is outside of map - thus signed
+        int64_t index = static_cast<int64_t>(from.y) * map_size.x + from.x;
+        int64_t index_step_y = static_cast<int64_t>(step_y) * map_size.x;
+        Point tile = from;
+        while (true) {
+            bool is_on_map =
+                0 <= tile.x && tile.x < map_size.x && 0 <= tile.y && tile.y < map_size.y;
+            if (is_on_map) {
+                fn(tile, static_cast<size_t>(index));
+            }
+            if (tile.x == to.x && tile.y == to.y) {
+                break;
+            }
+
+            int doubled = error * 2;
+            if (doubled >= dy) {
+                error += dy;
+                tile.x += step_x;
+                index += step_x;
+            }
+            if (doubled <= dx) {
+                error += dx;
+                tile.y += step_y;
+                index += index_step_y;
+            }
+        }
+    }
+
     // Getters for various map-related stats
     Point get_tile_size() {
         return tile_size;
@@ -121,10 +458,22 @@ public:
     size_t get_grid_size() {
         return grid_size;
     }
+
+    // Object table and journal. Grid is up to implementation. Amount is of
+    // objects, and doesn't count whatever these point to.
+    virtual MemoryUsage get_memory_usage() const {
+        MemoryUsage usage = {get_table_bytes(map_objects), map_objects.size()};
+        if (journal != nullptr) {
+            usage.bytes += journal->get_memory_usage().bytes;
+        }
+        return usage;
+    }
 };
 
 template <typename T> class TileMap : public TileMapBase<T> {
 protected:
+    friend class TileMapFile<T>;
+
     // ID of item used as failsafe when tile is empty. Default = -1.
     int placeholder_id;
     // Toggle that returns object from map
@@ -140,6 +489,35 @@ public:
         , grid(TileMapBase<T>::grid_size, placeholder_id) {
     }
 
+    // Raw ids of all tiles, row by row. Meant to be used with
+    // for_each_row_span(), to go through ids without any per-tile checks.
+    const int* get_grid_data() const {
+        return grid.data();
+    }
+
+    // Overwrite ids of whole map - fn(int y, int* ids) gets called once per row,
+    // on workers if parallel is set. Meant for generators that make whole map
+    // at once. Journal gets it as change of everything.
+    template <typename F> void write_rows(F fn, bool parallel) {
+        Point map_size = TileMapBase<T>::map_size;
+        auto write = [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++) {
+                fn(static_cast<int>(y), grid.data() + y * map_size.x);
+            }
+        };
+
+        if (parallel) {
+            get_worker_pool().parallel_for(map_size.y, 16, write);
+        }
+        else {
+            write(0, map_size.y);
+        }
+
+        if (TileMapBase<T>::journal != nullptr) {
+            TileMapBase<T>::journal->record_everything();
+        }
+    }
+
     // Set placeholder tile an its return policy.
     void set_placeholder(int _placeholder_id, bool _return_placeholder) {
         placeholder_id = _placeholder_id;
@@ -155,6 +533,7 @@ public:
             TileMapBase<T>::map_objects.erase(grid[grid_index]);
         }
         grid[grid_index] = placeholder_id;
+        TileMapBase<T>::mark_tile_changed(grid_index);
     }
 
     // Place specific object from storage on specified space, without removing it
@@ -165,6 +544,7 @@ public:
     bool place_object(size_t grid_index, int object_id) override {
         if (grid.at(grid_index) == placeholder_id) {
             grid[grid_index] = object_id;
+            TileMapBase<T>::mark_tile_changed(grid_index);
             return true;
         }
         return false;
@@ -179,6 +559,7 @@ public:
         }
 
         grid[grid_index] = object_id;
+        TileMapBase<T>::mark_tile_changed(grid_index);
     }
 
     // Move object from grid[grid_index] to grid[new_grid_index].
@@ -192,6 +573,112 @@ public:
         place_or_replace(grid_index, second_id, false);
     }
 
+    // Bulk operations on rects of tiles.
+    // Rects get clipped to map once, then tiles are handled row by row, with
+    // memcpy and the like - way cheaper than doing the same tile by tile. Journal
+    // gets a single change per rect.
+
+    // Set each tile of rect to object_id. Placeholder id clears tiles without
+    // touching storage.
+    void fill_rect(TileRect rect, int object_id) {
+        rect = TileMapBase<T>::clip_rect(rect);
+        TileMapBase<T>::for_each_row_span(
+            rect, [&](int, int first_x, int last_x, size_t index) {
+                std::fill_n(grid.data() + index, last_x - first_x, object_id);
+            });
+        TileMapBase<T>::mark_rect_changed(rect);
+    }
+
+    // Clear tiles of rect. If delete_from_storage is set - also delete objects
+    // that were on these from map_objects, each one once. Placeholder stays.
+    void clear_rect(TileRect rect, bool delete_from_storage) {
+        if (delete_from_storage) {
+            std::vector<int> ids;
+            TileMapBase<T>::for_each_row_span(
+                rect, [&](int, int first_x, int last_x, size_t index) {
+                    const int* row = grid.data() + index;
+                    ids.insert(ids.end(), row, row + (last_x - first_x));
+                });
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            for (auto object_id : ids) {
+                if (object_id != placeholder_id) {
+                    TileMapBase<T>::map_objects.erase(object_id);
+                }
+            }
+        }
+
+        fill_rect(rect, placeholder_id);
+    }
+
+    // Copy ids of rect's tiles into block. Tiles outside of map are copied as
+    // placeholders.
+    void copy_rect(TileRect rect, TileBlock& block) {
+        block.size = {std::max(rect.width, 0), std::max(rect.height, 0)};
+        size_t block_size = static_cast<size_t>(block.size.x) * block.size.y;
+        block.ids.assign(block_size, placeholder_id);
+
+        TileMapBase<T>::for_each_row_span(
+            rect, [&](int y, int first_x, int last_x, size_t index) {
+                size_t offset =
+                    static_cast<size_t>(y - rect.y) * block.size.x + (first_x - rect.x);
+                std::memcpy(
+                    block.ids.data() + offset,
+                    grid.data() + index,
+                    (last_x - first_x) * sizeof(int));
+            });
+    }
+
+    // Paste block with its top left corner at specified tile. Parts that don't
+    // fit on map are skipped. If transparent is set - placeholders of block
+    // leave tiles below them as they are.
+    void paste(const TileBlock& block, Point tile, bool transparent) {
+        TileRect rect =
+            TileMapBase<T>::clip_rect({tile.x, tile.y, block.size.x, block.size.y});
+
+        TileMapBase<T>::for_each_row_span(
+            rect, [&](int y, int first_x, int last_x, size_t index) {
+                const int* source = block.ids.data() +
+                                    static_cast<size_t>(y - tile.y) * block.size.x +
+                                    (first_x - tile.x);
+                int* target = grid.data() + index;
+                size_t amount = last_x - first_x;
+
+                if (!transparent) {
+                    std::memcpy(target, source, amount * sizeof(int));
+                    return;
+                }
+                // Branchless, so it vectorizes
+                for (size_t i = 0; i < amount; i++) {
+                    target[i] = source[i] != placeholder_id ? source[i] : target[i];
+                }
+            });
+        TileMapBase<T>::mark_rect_changed(rect);
+    }
+
+    // Swap contents of rect with ones of same-sized rect at specified tile.
+    // Returns false and does nothing, unless both rects are within map and
+    // don't overlap.
+    bool swap_rects(TileRect rect, Point tile) {
+        if (!TileMapBase<T>::can_swap_rects(rect, tile)) {
+            return false;
+        }
+
+        // Rows of both rects are the same distance apart in grid
+        int64_t distance =
+            static_cast<int64_t>(tile.y - rect.y) * TileMapBase<T>::map_size.x +
+            (tile.x - rect.x);
+        TileMapBase<T>::for_each_row_span(
+            rect, [&](int, int first_x, int last_x, size_t index) {
+                int* row = grid.data() + index;
+                std::swap_ranges(row, row + (last_x - first_x), row + distance);
+            });
+
+        TileMapBase<T>::mark_rect_changed(rect);
+        TileMapBase<T>::mark_rect_changed({tile.x, tile.y, rect.width, rect.height});
+        return true;
+    }
+
     // Get pointer to object from specified tile.
     // If return_placeholder is set to false and specified tile contains placeholder
     // tile - will return nullptr.
@@ -205,6 +692,19 @@ public:
         return TileMapBase<T>::get_object_by_id(object_id);
     }
 
+    // Same rules as get_object_from_grid() - placeholder is skipped, unless
+    // return_placeholder is set.
+    void for_each_object_id(
+        size_t grid_index, const std::function<void(int)>& fn) override {
+        int object_id = grid[grid_index];
+
+        if (object_id == placeholder_id && !return_placeholder) {
+            return;
+        }
+
+        fn(object_id);
+    }
+
     // Get first tile that contains object with specified id, or std::nullopt
     std::optional<Point> find_object_tile(int object_id) override {
         for (auto index = 0u; index < TileMapBase<T>::grid_size; index++) {
@@ -215,6 +715,116 @@ public:
 
         return std::nullopt;
     }
+
+    MemoryUsage get_memory_usage() const override {
+        MemoryUsage usage = TileMapBase<T>::get_memory_usage();
+        usage.bytes += get_capacity_bytes(grid);
+        return usage;
+    }
+};
+
+// Convert RGBA8 pixels into colors in ColorToInt() format
+void pack_colors(const unsigned char* pixels, int* colors, size_t amount);
+
+// Fill colors with ColorToInt() of each pixel of image, row by row. Works with
+// any uncompressed format, but RGBA8 images are the fastest, since these don't
+// need to be converted first.
+void read_image_colors(Image image, std::vector<int>& colors);
+
+// Split colors into palette of distinct ones and grid of their indices in it.
+// Colors are indexed in order of their first appearance. Palette can hold up
+// to 65535 colors - pixels of colors past that get NO_PALETTE_INDEX.
+static constexpr uint16_t NO_PALETTE_INDEX = UINT16_MAX;
+void build_palette(
+    const std::vector<int>& colors,
+    std::vector<int>& palette,
+    std::vector<uint16_t>& indices);
+
+// Source of map image that gets decoded a few rows at a time, top to bottom.
+// Used to generate maps that are too big to keep whole image in memory.
+class StripReader {
+protected:
+    Point size = {0, 0};
+    int next_row = 0;
+    bool failed = false;
+
+    // Decode rows_amount next rows into colors. Amount never goes past image.
+    virtual bool decode_rows(int rows_amount, int* colors) = 0;
+
+public:
+    virtual ~StripReader() = default;
+
+    Point get_size() const {
+        return size;
+    }
+
+    // False if image couldn't be opened or parsed, or if it ended too early
+    bool is_valid() const {
+        return !failed;
+    }
+
+    bool is_done() const {
+        return next_row >= size.y;
+    }
+
+    // Read up to rows_amount next rows into colors, in ColorToInt() format.
+    // Returns amount of rows read, which is 0 once image is over or broken.
+    int read_rows(int rows_amount, std::vector<int>& colors);
+};
+
+// Base of readers that decode image straight from file
+class FileStripReader : public StripReader {
+protected:
+    std::string path;
+    std::ifstream file;
+    // Samples per pixel: gray, gray + alpha, rgb or rgba
+    int channels = 4;
+    // Samples above 255 take two bytes, big endian
+    int max_value = 255;
+    std::vector<unsigned char> buffer;
+
+    FileStripReader(const std::string& _path);
+
+    // Check header's values and complain if these make no sense
+    bool validate();
+    bool decode_rows(int rows_amount, int* colors) override;
+};
+
+// Binary PGM (P5), PPM (P6) and PAM (P7) images. These are trivial to decode
+// row by row, and pretty much any image tool can write them.
+class PnmStripReader : public FileStripReader {
+public:
+    PnmStripReader(const std::string& _path);
+};
+
+// Headerless RGBA8 pixels, say ones dumped by script. Size can't be guessed
+// from these, thus must be known beforehand.
+class RawStripReader : public FileStripReader {
+public:
+    RawStripReader(const std::string& _path, Point _size);
+};
+
+// Grid indices of tiles that share the same color. Passed to bulk callbacks.
+// Indices are 32-bit, to keep lists of huge maps half as big.
+struct TileIndices {
+    const uint32_t* data;
+    size_t amount;
+
+    const uint32_t* begin() const {
+        return data;
+    }
+
+    const uint32_t* end() const {
+        return data + amount;
+    }
+
+    size_t size() const {
+        return amount;
+    }
+
+    size_t operator[](size_t i) const {
+        return data[i];
+    }
 };
 
 // Class that generates tiled map based on provided color-action pair.
@@ -224,9 +834,126 @@ public:
 template <typename T> class ColorGen {
 protected:
     std::unordered_map<int, std::function<void(T&, size_t)>> callbacks;
-    std::vector<int> grid;
+    std::unordered_map<int, std::function<void(T&, TileIndices)>> bulk_callbacks;
+    // Distinct colors of map file, and index of each tile's color in there
+    std::vector<int> palette;
+    std::vector<uint16_t> indices;
     Point map_size;
 
+    // Tiles handled per task, in parallel mode
+    static constexpr size_t PARALLEL_RANGE = 4096;
+
+    // Invoke callbacks of tiles with these indices into colors. First of
+    // these tiles is tile number offset of map.
+    void dispatch(
+        T& map,
+        const std::vector<int>& colors,
+        const std::vector<uint16_t>& tile_indices,
+        size_t offset,
+        bool parallel) {
+        if (tile_indices.empty()) {
+            return;
+        }
+
+        // Resolve callbacks once per color, instead of once per tile. Extra slot
+        // is for NO_PALETTE_INDEX of overflown palette, and always stays empty.
+        size_t slots = colors.size() + 1;
+        std::vector<std::function<void(T&, size_t)>*> handlers(slots, nullptr);
+        std::vector<std::function<void(T&, TileIndices)>*> bulk_handlers(slots, nullptr);
+        bool has_handlers = false;
+        bool has_bulk_handlers = false;
+        for (size_t i = 0; i < colors.size(); i++) {
+            auto it = callbacks.find(colors[i]);
+            if (it != callbacks.end()) {
+                handlers[i] = &it->second;
+                has_handlers = true;
+            }
+
+            auto bulk_it = bulk_callbacks.find(colors[i]);
+            if (bulk_it != bulk_callbacks.end()) {
+                bulk_handlers[i] = &bulk_it->second;
+                has_bulk_handlers = true;
+            }
+        }
+
+        if (has_handlers) {
+            auto run = [&](size_t first, size_t last) {
+                for (size_t grid_index = first; grid_index < last; grid_index++) {
+                    auto* handler = handlers[tile_indices[grid_index]];
+                    if (handler != nullptr) {
+                        (*handler)(map, offset + grid_index);
+                    }
+                }
+            };
+
+            if (parallel) {
+                get_worker_pool().parallel_for(
+                    tile_indices.size(), PARALLEL_RANGE, run);
+            }
+            else {
+                run(0, tile_indices.size());
+            }
+        }
+
+        if (!has_bulk_handlers) {
+            return;
+        }
+
+        // Group tiles by color (counting sort), skipping ones nobody cares about
+        std::vector<size_t> offsets(slots + 1, 0);
+        for (auto i : tile_indices) {
+            if (bulk_handlers[i] != nullptr) {
+                offsets[i + 1]++;
+            }
+        }
+        for (size_t i = 1; i < offsets.size(); i++) {
+            offsets[i] += offsets[i - 1];
+        }
+
+        std::vector<uint32_t> tiles(offsets.back());
+        std::vector<size_t> cursors(offsets.begin(), offsets.end() - 1);
+        for (size_t grid_index = 0; grid_index < tile_indices.size(); grid_index++) {
+            uint16_t i = tile_indices[grid_index];
+            if (bulk_handlers[i] != nullptr) {
+                tiles[cursors[i]++] = static_cast<uint32_t>(offset + grid_index);
+            }
+        }
+
+        if (!parallel) {
+            for (size_t i = 0; i < colors.size(); i++) {
+                if (bulk_handlers[i] != nullptr) {
+                    TileIndices range = {
+                        tiles.data() + offsets[i], offsets[i + 1] - offsets[i]};
+                    (*bulk_handlers[i])(map, range);
+                }
+            }
+            return;
+        }
+
+        // Lists get cut into pieces, so huge ones don't end up on a single worker
+        struct Piece {
+            std::function<void(T&, TileIndices)>* handler;
+            TileIndices tiles;
+        };
+        std::vector<Piece> pieces;
+        for (size_t i = 0; i < colors.size(); i++) {
+            if (bulk_handlers[i] == nullptr) {
+                continue;
+            }
+            size_t end = offsets[i + 1];
+            for (size_t first = offsets[i]; first < end; first += PARALLEL_RANGE) {
+                size_t amount = std::min(PARALLEL_RANGE, end - first);
+                pieces.push_back({bulk_handlers[i], {tiles.data() + first, amount}});
+            }
+        }
+
+        get_worker_pool().parallel_for(pieces.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                (*pieces[i].handler)(map, pieces[i].tiles);
+            }
+        });
+    }
+
 public:
     ColorGen() {
     }
@@ -241,44 +968,155 @@ public:
         return map_size;
     }
 
+    const std::vector<int>& get_palette() {
+        return palette;
+    }
+
+    // Call callback for each tile of that color
     void add_relationship(Color color, std::function<void(T&, size_t)> callback) {
         callbacks[ColorToInt(color)] = callback;
     }
 
+    // Call callback once with all tiles of that color. Cheaper than the above,
+    // if handler can do something smarter than going tile by tile.
+    // In parallel mode, it may get called multiple times with parts of list.
+    void add_bulk_relationship(
+        Color color, std::function<void(T&, TileIndices)> callback) {
+        bulk_callbacks[ColorToInt(color)] = callback;
+    }
+
     void prepare(Image map_file) {
         // Generally each generator instance must be tied to one map file.
-        // But if its not the case - clearing up current grid.
-        grid.clear();
-
+        // But if its not the case - current grid gets overwritten.
         map_size = {map_file.width, map_file.height};
 
-        grid.reserve(map_size.x * map_size.y);
+        std::vector<int> colors;
+        read_image_colors(map_file, colors);
+        build_palette(colors, palette, indices);
+    }
 
-        for (auto current_y = 0; current_y < map_size.y; current_y++) {
-            for (auto current_x = 0; current_x < map_size.x; current_x++) {
-                grid.push_back(ColorToInt(GetImageColor(map_file, current_x, current_y)));
-            }
-        }
+    // Invoke callbacks of each tile's color. Per-tile callbacks go first, in
+    // order of tiles, then bulk ones.
+    // If parallel is set - callbacks get called from worker threads, on
+    // different parts of map at once. These must be thread-safe then, which
+    // tile map's methods are not.
+    void generate(T& map, bool parallel) {
+        dispatch(map, palette, indices, 0, parallel);
     }
 
     void generate(T& map) {
-        if (grid.size() == 0) {
-            return;
-        }
+        generate(map, false);
+    }
 
-        for (size_t grid_index = 0; grid_index < grid.size(); grid_index++) {
-            int color = grid[grid_index];
-            if (callbacks.count(color) > 0) {
-                callbacks[color](map, grid_index);
-            }
+    // Same as generate(), but reads map file strip_rows rows at a time and
+    // invokes callbacks strip by strip, without ever holding whole grid. Thus
+    // memory used depends on map's width, not on its size. Bulk callbacks get
+    // called once per strip. Doesn't touch grid of prepare().
+    // Returns false if file turned out to be broken - strips before the broken
+    // part get handled anyway.
+    bool generate_streamed(
+        T& map, StripReader& reader, bool parallel, int strip_rows = 128) {
+        map_size = reader.get_size();
+
+        std::vector<int> colors;
+        std::vector<int> strip_palette;
+        std::vector<uint16_t> strip_indices;
+        size_t offset = 0;
+        while (reader.read_rows(strip_rows, colors) > 0) {
+            build_palette(colors, strip_palette, strip_indices);
+            dispatch(map, strip_palette, strip_indices, offset, parallel);
+            offset += strip_indices.size();
         }
+
+        return reader.is_valid() && reader.is_done();
     }
 };
 
 // Deep tile map from Fortune Crawler
 template <typename T> class TileMapDeep : public TileMapBase<T> {
 protected:
+    friend class TileMapFile<T>;
+
     std::vector<std::vector<int>> grid;
+    // Ids on all tiles together, for get_memory_usage() to not go through grid
+    size_t ids_amount = 0;
+
+    // Recount ids after grid has been written directly (say, loaded from file)
+    void count_ids() {
+        ids_amount = 0;
+        for (const auto& ids : grid) {
+            ids_amount += ids.size();
+        }
+    }
+
+    // Entity ids of objects, resolved during layout export. Each object is
+    // looked up once per export, instead of once per tile it's on. Entries
+    // are only valid for export they've been resolved in, thus starting a new
+    // one doesn't need to reset all of them - small delta exports stay small.
+    struct ResolvedEntity {
+        uint32_t export_id = 0;
+        int entity_id = -1;
+    };
+    std::vector<ResolvedEntity> resolved_entities;
+    uint32_t export_id = 0;
+
+    void start_export() {
+        // Grows with ids, but never gets refilled as a whole
+        if (resolved_entities.size() < TileMapBase<T>::map_objects_amount) {
+            resolved_entities.resize(TileMapBase<T>::map_objects_amount);
+        }
+        export_id++;
+        // Wrapped around, thus old entries may look like ones of this export
+        if (export_id == 0) {
+            resolved_entities.assign(resolved_entities.size(), ResolvedEntity());
+            export_id = 1;
+        }
+    }
+
+    int resolve_entity_id(int object_id) {
+        bool is_cached = 0 <= object_id &&
+                         static_cast<size_t>(object_id) < resolved_entities.size();
+        if (is_cached && resolved_entities[object_id].export_id == export_id) {
+            return resolved_entities[object_id].entity_id;
+        }
+
+        int entity_id = -1;
+        auto it = TileMapBase<T>::map_objects.find(object_id);
+        if (it != TileMapBase<T>::map_objects.end()) {
+            entity_id = it->second->get_entity_id();
+        }
+        if (is_cached) {
+            resolved_entities[object_id] = {export_id, entity_id};
+        }
+        return entity_id;
+    }
+
+    // Write entity ids of specified tiles (or of all tiles, if nullptr) into
+    // flat buffers. See get_map_layout() for format.
+    void export_layout(
+        const std::vector<size_t>* tiles,
+        std::vector<size_t>& offsets,
+        std::vector<int>& entity_ids) {
+        size_t amount = tiles != nullptr ? tiles->size() : TileMapBase<T>::grid_size;
+        auto tile_at = [&](size_t i) { return tiles != nullptr ? (*tiles)[i] : i; };
+
+        offsets.resize(amount + 1);
+        size_t total = 0;
+        for (size_t i = 0; i < amount; i++) {
+            offsets[i] = total;
+            total += grid[tile_at(i)].size();
+        }
+        offsets[amount] = total;
+        entity_ids.resize(total);
+
+        start_export();
+        int* out = entity_ids.data();
+        for (size_t i = 0; i < amount; i++) {
+            for (auto object_id : grid[tile_at(i)]) {
+                *out++ = resolve_entity_id(object_id);
+            }
+        }
+    }
 
 public:
     TileMapDeep(Point _map_size, Point _tile_size)
@@ -298,7 +1136,9 @@ public:
                 TileMapBase<T>::map_objects.erase(item);
             }
         }
+        ids_amount -= grid[grid_index].size();
         grid[grid_index].clear();
+        TileMapBase<T>::mark_tile_changed(grid_index);
     }
 
     // Delete specified object from provided tile
@@ -307,12 +1147,16 @@ public:
             TileMapBase<T>::map_objects.erase(grid[grid_index][tile_index]);
         }
         grid[grid_index].erase(grid[grid_index].begin() + tile_index);
+        ids_amount--;
+        TileMapBase<T>::mark_tile_changed(grid_index);
     }
 
     // Place specific object from storage on specified space, without removing it
     // from any other place. Returns true for compatibility reasons - could be void
     bool place_object(size_t grid_index, int object_id) override {
         grid[grid_index].push_back(object_id);
+        ids_amount++;
+        TileMapBase<T>::mark_tile_changed(grid_index);
 
         return true;
     }
@@ -324,6 +1168,117 @@ public:
         place_object(new_grid_index, object_id);
     }
 
+    // Bulk operations on rects of tiles, same as TileMap's. There is nothing
+    // to memcpy here, but tiles keep their memory, and journal still gets a
+    // single change per rect.
+
+    // Replace contents of each tile of rect with copy of ids
+    void fill_rect(TileRect rect, const std::vector<int>& ids) {
+        rect = TileMapBase<T>::clip_rect(rect);
+        TileMapBase<T>::for_each_row_span(
+            rect, [&](int, int first_x, int last_x, size_t index) {
+                for (int x = first_x; x < last_x; x++, index++) {
+                    ids_amount += ids.size() - grid[index].size();
+                    grid[index].assign(ids.begin(), ids.end());
+                }
+            });
+        TileMapBase<T>::mark_rect_changed(rect);
+    }
+
+    // Clear tiles of rect. If delete_from_storage is set - also delete objects
+    // that were on these from map_objects, each one once.
+    void clear_rect(TileRect rect, bool delete_from_storage) {
+        rect = TileMapBase<T>::clip_rect(rect);
+        std::vector<int> ids;
+        TileMapBase<T>::for_each_row_span(
+            rect, [&](int, int first_x, int last_x, size_t index) {
+                for (int x = first_x; x < last_x; x++, index++) {
+                    if (delete_from_storage) {
+                        ids.insert(ids.end(), grid[index].begin(), grid[index].end());
+                    }
+                    ids_amount -= grid[index].size();
+                    grid[index].clear();
+                }
+            });
+
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        for (auto object_id : ids) {
+            TileMapBase<T>::map_objects.erase(object_id);
+        }
+        TileMapBase<T>::mark_rect_changed(rect);
+    }
+
+    // Copy ids of rect's tiles into block. Tiles outside of map are copied as
+    // empty ones.
+    void copy_rect(TileRect rect, DeepTileBlock& block) {
+        block.size = {std::max(rect.width, 0), std::max(rect.height, 0)};
+        block.offsets.assign(static_cast<size_t>(block.size.x) * block.size.y + 1, 0);
+        block.ids.clear();
+
+        for (int y = 0; y < block.size.y; y++) {
+            for (int x = 0; x < block.size.x; x++) {
+                size_t i = static_cast<size_t>(y) * block.size.x + x;
+                block.offsets[i] = static_cast<uint32_t>(block.ids.size());
+
+                Point tile = {rect.x + x, rect.y + y};
+                if (TileMapBase<T>::is_tile_on_map(tile)) {
+                    const std::vector<int>& ids =
+                        grid[TileMapBase<T>::tile_to_index(tile)];
+                    block.ids.insert(block.ids.end(), ids.begin(), ids.end());
+                }
+            }
+        }
+        block.offsets.back() = static_cast<uint32_t>(block.ids.size());
+    }
+
+    // Paste block with its top left corner at specified tile, replacing contents
+    // of tiles. Parts that don't fit on map are skipped. If transparent is set -
+    // empty tiles of block leave tiles below them as they are.
+    void paste(const DeepTileBlock& block, Point tile, bool transparent) {
+        TileRect rect =
+            TileMapBase<T>::clip_rect({tile.x, tile.y, block.size.x, block.size.y});
+
+        TileMapBase<T>::for_each_row_span(
+            rect, [&](int y, int first_x, int last_x, size_t index) {
+                size_t i = static_cast<size_t>(y - tile.y) * block.size.x +
+                           (first_x - tile.x);
+                for (int x = first_x; x < last_x; x++, index++, i++) {
+                    const int* first = block.ids.data() + block.offsets[i];
+                    const int* last = block.ids.data() + block.offsets[i + 1];
+                    if (first != last || !transparent) {
+                        ids_amount += (last - first) - grid[index].size();
+                        grid[index].assign(first, last);
+                    }
+                }
+            });
+        TileMapBase<T>::mark_rect_changed(rect);
+    }
+
+    // Swap contents of rect with ones of same-sized rect at specified tile.
+    // Returns false and does nothing, unless both rects are within map and
+    // don't overlap.
+    bool swap_rects(TileRect rect, Point tile) {
+        if (!TileMapBase<T>::can_swap_rects(rect, tile)) {
+            return false;
+        }
+
+        // Rows of both rects are the same distance apart in grid
+        int64_t distance =
+            static_cast<int64_t>(tile.y - rect.y) * TileMapBase<T>::map_size.x +
+            (tile.x - rect.x);
+        TileMapBase<T>::for_each_row_span(
+            rect, [&](int, int first_x, int last_x, size_t index) {
+                // Swapping vectors only swaps their pointers
+                auto row = grid.begin() + index;
+                std::swap_ranges(row, row + (last_x - first_x), row + distance);
+            });
+
+        TileMapBase<T>::mark_rect_changed(rect);
+        TileMapBase<T>::mark_rect_changed({tile.x, tile.y, rect.width, rect.height});
+        return true;
+    }
+
     // Get first tile that contains object with specified id, or std::nullopt
     std::optional<Point> find_object_tile(int object_id) override {
         for (auto index = 0u; index < TileMapBase<T>::grid_size; index++) {
@@ -349,11 +1304,27 @@ public:
         return std::nullopt;
     }
 
+    // Objects are reported in order of placement, so the last one ends up on top.
+    void for_each_object_id(
+        size_t grid_index, const std::function<void(int)>& fn) override {
+        for (auto object_id : grid[grid_index]) {
+            fn(object_id);
+        }
+    }
+
     bool is_tile_occupied(size_t grid_index) {
         return (grid[grid_index].size() > 1);
     }
 
+    // Ids of objects on tile, in order of placement, without copying. Stays
+    // valid until tile changes.
+    IdSpan get_tile_ids(size_t grid_index) const {
+        const std::vector<int>& ids = grid[grid_index];
+        return {ids.data(), ids.size()};
+    }
+
     // Returns entity ids of each object on map.
+    // Allocates vector per tile - overload below is way cheaper.
     std::vector<std::vector<int>> get_map_layout() {
         std::vector<std::vector<int>> layout = {};
 
@@ -368,4 +1339,40 @@ public:
 
         return layout;
     }
+
+    // Same as above, but flattened into provided buffers, which keep their
+    // memory between calls. Entity ids of tile i are entity_ids from
+    // offsets[i] up to offsets[i + 1].
+    void get_map_layout(std::vector<size_t>& offsets, std::vector<int>& entity_ids) {
+        export_layout(nullptr, offsets, entity_ids);
+    }
+
+    // Layout of tiles changed after revision since, in the same format as
+    // above, with i-th of these being tiles[i]. Returns revision to pass next
+    // time. Needs journal (see enable_journal()) - without it, or if whole map
+    // has changed, every tile is reported.
+    uint64_t get_layout_changes(
+        uint64_t since,
+        std::vector<size_t>& tiles,
+        std::vector<size_t>& offsets,
+        std::vector<int>& entity_ids) {
+        TileJournal* journal = TileMapBase<T>::journal.get();
+        if (journal == nullptr || !journal->get_changes_since(since, tiles)) {
+            tiles.resize(TileMapBase<T>::grid_size);
+            for (size_t i = 0; i < tiles.size(); i++) {
+                tiles[i] = i;
+            }
+        }
+
+        export_layout(&tiles, offsets, entity_ids);
+        return journal != nullptr ? journal->get_revision() : 0;
+    }
+
+    // Lists of tiles are counted by ids these hold, without their spare room
+    MemoryUsage get_memory_usage() const override {
+        MemoryUsage usage = TileMapBase<T>::get_memory_usage();
+        usage.bytes += get_capacity_bytes(grid) + get_capacity_bytes(resolved_entities) +
+                       ids_amount * sizeof(int);
+        return usage;
+    }
 };
@@ -0,0 +1,144 @@
+#include "mapped_file.hpp"
+#include "spdlog/spdlog.h"
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::open(const std::string& path, bool _writable) {
+    close();
+
+    DWORD access = _writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+    HANDLE file = CreateFileA(
+        path.c_str(),
+        access,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        spdlog::warn("Unable to open {}: error {}", path, GetLastError());
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        spdlog::warn("Unable to map {}: file is empty", path);
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(
+        file, nullptr, _writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+    void* view = nullptr;
+    if (mapping != nullptr) {
+        view = MapViewOfFile(
+            mapping, _writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    }
+    if (view == nullptr) {
+        spdlog::warn("Unable to map {}: error {}", path, GetLastError());
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+
+    file_handle = file;
+    mapping_handle = mapping;
+    data = static_cast<unsigned char*>(view);
+    size = static_cast<size_t>(file_size.QuadPart);
+    writable = _writable;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+        CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+    }
+    data = nullptr;
+    size = 0;
+    writable = false;
+    file_handle = nullptr;
+    mapping_handle = nullptr;
+}
+
+bool MappedFile::flush() {
+    if (data == nullptr || !writable) {
+        return false;
+    }
+    return FlushViewOfFile(data, 0) && FlushFileBuffers(file_handle);
+}
+
+#else
+
+bool MappedFile::open(const std::string& path, bool _writable) {
+    close();
+
+    int file = ::open(path.c_str(), _writable ? O_RDWR : O_RDONLY);
+    if (file < 0) {
+        spdlog::warn("Unable to open {}: {}", path, std::strerror(errno));
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size <= 0) {
+        spdlog::warn("Unable to map {}: file is empty", path);
+        ::close(file);
+        return false;
+    }
+
+    size_t file_size = static_cast<size_t>(info.st_size);
+    int protection = _writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* view = mmap(nullptr, file_size, protection, MAP_SHARED, file, 0);
+    if (view == MAP_FAILED) {
+        spdlog::warn("Unable to map {}: {}", path, std::strerror(errno));
+        ::close(file);
+        return false;
+    }
+
+    descriptor = file;
+    data = static_cast<unsigned char*>(view);
+    size = file_size;
+    writable = _writable;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data != nullptr) {
+        munmap(data, size);
+        ::close(descriptor);
+    }
+    data = nullptr;
+    size = 0;
+    writable = false;
+    descriptor = -1;
+}
+
+bool MappedFile::flush() {
+    if (data == nullptr || !writable) {
+        return false;
+    }
+    return msync(data, size, MS_SYNC) == 0;
+}
+
+#endif
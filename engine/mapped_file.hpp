@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// File mapped into memory. Its contents can be read (and, if opened as
+// writable, changed) in place, with OS paging things in and out as needed -
+// so opening even huge files costs next to nothing.
+// Doesn't include any OS headers, since windows.h doesn't get along with
+// raylib.h.
+class MappedFile {
+private:
+    unsigned char* data = nullptr;
+    size_t size = 0;
+    bool writable = false;
+
+#if defined(_WIN32)
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#else
+    int descriptor = -1;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map whole file. Writable mappings are shared, so changes end up in file.
+    // Returns false (and logs why) if file can't be opened or is empty.
+    bool open(const std::string& path, bool _writable);
+    void close();
+
+    // Write changed pages to disk. Without it, these get there eventually.
+    bool flush();
+
+    bool is_open() const {
+        return data != nullptr;
+    }
+
+    bool is_writable() const {
+        return writable;
+    }
+
+    unsigned char* get_data() const {
+        return data;
+    }
+
+    size_t get_size() const {
+        return size;
+    }
+};
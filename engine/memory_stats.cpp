@@ -0,0 +1,132 @@
+#include "memory_stats.hpp"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <map>
+
+// MemoryStats
+void MemoryStats::check_budget(const MemoryStat& stat) {
+    if (!stat.is_over_budget()) {
+        over_budget.erase(stat.name);
+        return;
+    }
+    if (over_budget.insert(stat.name).second) {
+        spdlog::warn(
+            "{} takes {}, which is over its budget of {}",
+            stat.name,
+            format_bytes(stat.usage.bytes),
+            format_bytes(stat.budget));
+    }
+}
+
+int MemoryStats::add_source(
+    const std::string& name, std::function<MemoryUsage()> measure) {
+    int id = next_id++;
+    sources.push_back({id, name, std::move(measure)});
+    return id;
+}
+
+void MemoryStats::remove_source(int id) {
+    sources.erase(
+        std::remove_if(
+            sources.begin(),
+            sources.end(),
+            [id](const Source& source) { return source.id == id; }),
+        sources.end());
+}
+
+void MemoryStats::set_budget(const std::string& name, size_t bytes) {
+    if (bytes == 0) {
+        budgets.erase(name);
+    }
+    else {
+        budgets[name] = bytes;
+    }
+    over_budget.erase(name);
+}
+
+size_t MemoryStats::get_budget(const std::string& name) const {
+    auto it = budgets.find(name);
+    return it != budgets.end() ? it->second : 0;
+}
+
+std::vector<MemoryStat> MemoryStats::collect() {
+    // There are few sources, thus ordered map is fine there
+    std::map<std::string, MemoryUsage> usages;
+    for (const auto& source : sources) {
+        usages[source.name] += source.measure();
+    }
+
+    std::vector<MemoryStat> stats;
+    stats.reserve(usages.size());
+    for (const auto& [name, usage] : usages) {
+        stats.push_back({name, usage, get_budget(name)});
+        check_budget(stats.back());
+    }
+    return stats;
+}
+
+MemoryStat MemoryStats::collect(const std::string& name) {
+    MemoryStat stat = {name, {}, get_budget(name)};
+    for (const auto& source : sources) {
+        if (source.name == name) {
+            stat.usage += source.measure();
+        }
+    }
+    check_budget(stat);
+    return stat;
+}
+
+MemoryUsage MemoryStats::get_total() {
+    MemoryUsage total;
+    for (const auto& source : sources) {
+        total += source.measure();
+    }
+    return total;
+}
+
+MemoryStats& get_memory_stats() {
+    static MemoryStats stats;
+    return stats;
+}
+
+std::string format_bytes(size_t bytes) {
+    if (bytes < 1024) {
+        return fmt::format("{} B", bytes);
+    }
+    if (bytes < 1024 * 1024) {
+        return fmt::format("{:.1f} KB", bytes / 1024.0);
+    }
+    return fmt::format("{:.1f} MB", bytes / (1024.0 * 1024.0));
+}
+
+// MemorySource
+MemorySource::MemorySource(
+    const std::string& name, std::function<MemoryUsage()> measure)
+    : id(get_memory_stats().add_source(name, std::move(measure))) {
+}
+
+MemorySource::~MemorySource() {
+    reset();
+}
+
+MemorySource::MemorySource(MemorySource&& other)
+    : id(other.id) {
+    other.id = -1;
+}
+
+MemorySource& MemorySource::operator=(MemorySource&& other) {
+    if (this != &other) {
+        reset();
+        id = other.id;
+        other.id = -1;
+    }
+    return *this;
+}
+
+void MemorySource::reset() {
+    if (id >= 0) {
+        get_memory_stats().remove_source(id);
+    }
+    id = -1;
+}
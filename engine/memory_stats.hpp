@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Memory held by some subsystem: bytes (estimated, where exact amount is up to
+// driver or allocator) and amount of things these bytes are spent on
+struct MemoryUsage {
+    size_t bytes = 0;
+    size_t amount = 0;
+
+    MemoryUsage& operator+=(const MemoryUsage& other) {
+        bytes += other.bytes;
+        amount += other.amount;
+        return *this;
+    }
+};
+
+// Heap bytes taken by vector's buffer, whether it's filled or not
+template <typename T> size_t get_capacity_bytes(const std::vector<T>& items) {
+    return items.capacity() * sizeof(T);
+}
+
+// Rough size of hash table: buckets, plus a node per item with link and cached
+// hash. Good enough to tell whether it's kilobytes or megabytes.
+template <typename K, typename V, typename... Args>
+size_t get_table_bytes(const std::unordered_map<K, V, Args...>& table) {
+    size_t node_size = sizeof(std::pair<const K, V>) + sizeof(void*) + sizeof(size_t);
+    return table.bucket_count() * sizeof(void*) + table.size() * node_size;
+}
+
+struct MemoryStat {
+    std::string name;
+    MemoryUsage usage;
+    // 0 if there is none
+    size_t budget = 0;
+
+    bool is_over_budget() const {
+        return budget > 0 && usage.bytes > budget;
+    }
+};
+
+// Registry of whatever takes memory, by subsystem name. Nothing gets counted in
+// background - sources are only asked for their usage on collect(), thus these
+// cost nothing between queries. Meant to be used from main thread.
+class MemoryStats {
+private:
+    struct Source {
+        int id;
+        std::string name;
+        std::function<MemoryUsage()> measure;
+    };
+
+    std::vector<Source> sources;
+    int next_id = 0;
+    std::unordered_map<std::string, size_t> budgets;
+    // Names that have been over budget on the last collect(), to not warn
+    // about these each time
+    std::unordered_set<std::string> over_budget;
+
+    void check_budget(const MemoryStat& stat);
+
+public:
+    // Start counting usage measured by fn as part of named subsystem. Sources
+    // with the same name get summed up. Returns id to remove source with.
+    int add_source(const std::string& name, std::function<MemoryUsage()> measure);
+    void remove_source(int id);
+
+    // Bytes subsystem shouldn't exceed. Going over logs a warning once, on
+    // collect(). 0 removes budget.
+    void set_budget(const std::string& name, size_t bytes);
+    size_t get_budget(const std::string& name) const;
+
+    // Measure all subsystems, sorted by name
+    std::vector<MemoryStat> collect();
+    // Measure just one of them
+    MemoryStat collect(const std::string& name);
+
+    // Usage of everything at once
+    MemoryUsage get_total();
+};
+
+// Shared registry, created on first use.
+MemoryStats& get_memory_stats();
+
+// Human-readable size, like "12.5 MB"
+std::string format_bytes(size_t bytes);
+
+// Registration of source that removes it once gone. Handy to keep next to
+// whatever is measured, to not leave registry with dangling callbacks.
+class MemorySource {
+private:
+    int id = -1;
+
+public:
+    MemorySource() = default;
+    MemorySource(const std::string& name, std::function<MemoryUsage()> measure);
+    ~MemorySource();
+
+    MemorySource(MemorySource&& other);
+    MemorySource& operator=(MemorySource&& other);
+    MemorySource(const MemorySource&) = delete;
+    MemorySource& operator=(const MemorySource&) = delete;
+
+    void reset();
+};
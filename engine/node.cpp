@@ -165,6 +165,17 @@ void Node::detach() {
     detach(true);
 }
 
+size_t Node::get_descendants_amount() {
+    size_t amount = 0;
+    for (auto i : children) {
+        // Detached children leave nullptr behind, see detach_child()
+        if (i != nullptr) {
+            amount += 1 + i->get_descendants_amount();
+        }
+    }
+    return amount;
+}
+
 void Node::set_align(Align _align) {
     if (align != _align) {
         align = _align;
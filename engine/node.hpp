@@ -153,6 +153,10 @@ public:
     // Detach node from current parent (if exists)
     void detach();
 
+    // Amount of children, children of children and so on. Goes through whole
+    // branch, thus not something to call each frame on huge ones.
+    size_t get_descendants_amount();
+
     // Set node's alignment, which will affect placement of child nodes (qt-style)
     // TODO: think if apply_align() should be applied right away
     // virtual void set_align(Align _align);
@@ -0,0 +1,652 @@
+#include "pathfinding.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// PathGrid
+PathGrid::PathGrid(int width, int height)
+    : blocked(width, height)
+    , blocked_columns(height, width) {
+}
+
+PathGrid::PathGrid(BitGrid _blocked)
+    : blocked(std::move(_blocked))
+    , blocked_columns(blocked.get_height(), blocked.get_width()) {
+    for (int y = 0; y < blocked.get_height(); y++) {
+        for (int x = 0; x < blocked.get_width(); x++) {
+            if (blocked.get(x, y)) {
+                blocked_columns.set(y, x, true);
+            }
+        }
+    }
+}
+
+void PathGrid::set_cost(int x, int y, uint8_t cost) {
+    cost = std::max<uint8_t>(cost, 1);
+
+    if (costs.empty()) {
+        if (cost == 1) {
+            return;
+        }
+        costs.assign(static_cast<size_t>(get_width()) * get_height(), 1);
+    }
+
+    uint8_t& current = costs[static_cast<size_t>(y) * get_width() + x];
+    if (current == 1 && cost != 1) {
+        custom_costs_amount++;
+    }
+    else if (current != 1 && cost == 1) {
+        custom_costs_amount--;
+    }
+    current = cost;
+}
+
+// Search internals
+namespace {
+
+constexpr float DIAGONAL_COST = 1.41421356f;
+constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+struct OpenNode {
+    float f;
+    uint32_t index;
+};
+
+bool operator>(const OpenNode& a, const OpenNode& b) {
+    return a.f > b.f;
+}
+
+// Per-thread search state. Instead of clearing arrays on each search, entries
+// are stamped with search generation - anything with older stamp is garbage.
+struct SearchBuffers {
+    std::vector<float> g;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> seen;
+    std::vector<uint32_t> closed;
+    std::vector<OpenNode> open;
+    uint32_t generation = 0;
+
+    void prepare(size_t size) {
+        if (seen.size() < size) {
+            g.resize(size);
+            parent.resize(size);
+            seen.assign(size, 0);
+            closed.assign(size, 0);
+            generation = 0;
+        }
+
+        open.clear();
+        generation++;
+        // Wrapped around after 4 billion searches. Unlikely, but possible.
+        if (generation == 0) {
+            std::fill(seen.begin(), seen.end(), 0);
+            std::fill(closed.begin(), closed.end(), 0);
+            generation = 1;
+        }
+    }
+
+    bool is_seen(uint32_t index) const {
+        return seen[index] == generation;
+    }
+
+    bool is_closed(uint32_t index) const {
+        return closed[index] == generation;
+    }
+
+    void push(float f, uint32_t index) {
+        open.push_back({f, index});
+        std::push_heap(open.begin(), open.end(), std::greater<OpenNode>());
+    }
+
+    OpenNode pop() {
+        std::pop_heap(open.begin(), open.end(), std::greater<OpenNode>());
+        OpenNode node = open.back();
+        open.pop_back();
+        return node;
+    }
+};
+
+thread_local SearchBuffers buffers;
+
+float heuristic(int x, int y, int gx, int gy, bool diagonals) {
+    int dx = std::abs(x - gx);
+    int dy = std::abs(y - gy);
+
+    if (!diagonals) {
+        return static_cast<float>(dx + dy);
+    }
+
+    return static_cast<float>(std::max(dx, dy)) +
+           (DIAGONAL_COST - 1.0f) * static_cast<float>(std::min(dx, dy));
+}
+
+int sign(int value) {
+    return (value > 0) - (value < 0);
+}
+
+// Grid, limited to some rect. Everything outside is considered impassable.
+struct SearchArea {
+    const PathGrid& grid;
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+
+    bool passable(int x, int y) const {
+        return min_x <= x && x < max_x && min_y <= y && y < max_y &&
+               grid.is_passable(x, y);
+    }
+
+    uint32_t index(int x, int y) const {
+        return static_cast<uint32_t>(y * grid.get_width() + x);
+    }
+};
+
+// Check if moving from (x, y) by (dx, dy) is allowed
+bool can_step(const SearchArea& area, int x, int y, int dx, int dy) {
+    if (!area.passable(x + dx, y + dy)) {
+        return false;
+    }
+
+    if (dx != 0 && dy != 0) {
+        return area.passable(x + dx, y) && area.passable(x, y + dy);
+    }
+
+    return true;
+}
+
+constexpr int DIRECTIONS[8][2] = {
+    {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
+
+void relax(
+    SearchBuffers& b,
+    uint32_t from,
+    uint32_t to,
+    float g,
+    float h) {
+    if (b.is_closed(to)) {
+        return;
+    }
+
+    if (!b.is_seen(to) || g < b.g[to]) {
+        b.seen[to] = b.generation;
+        b.g[to] = g;
+        b.parent[to] = from;
+        b.push(g + h, to);
+    }
+}
+
+bool search_astar(SearchBuffers& b, const SearchArea& area, Point goal, bool diagonals) {
+    const PathGrid& grid = area.grid;
+    int width = grid.get_width();
+    uint32_t goal_index = area.index(goal.x, goal.y);
+    int directions = diagonals ? 8 : 4;
+
+    while (!b.open.empty()) {
+        OpenNode node = b.pop();
+        if (b.is_closed(node.index)) {
+            continue;
+        }
+        b.closed[node.index] = b.generation;
+
+        if (node.index == goal_index) {
+            return true;
+        }
+
+        int x = static_cast<int>(node.index % width);
+        int y = static_cast<int>(node.index / width);
+
+        for (int d = 0; d < directions; d++) {
+            int dx = DIRECTIONS[d][0];
+            int dy = DIRECTIONS[d][1];
+            if (!can_step(area, x, y, dx, dy)) {
+                continue;
+            }
+
+            int nx = x + dx;
+            int ny = y + dy;
+            float step = (dx != 0 && dy != 0) ? DIAGONAL_COST : 1.0f;
+            relax(
+                b,
+                node.index,
+                area.index(nx, ny),
+                b.g[node.index] + step * grid.get_cost(nx, ny),
+                heuristic(nx, ny, goal.x, goal.y, diagonals));
+        }
+    }
+
+    return false;
+}
+
+// Straight jumps scan lines of bit grid 64 tiles at once. Line is either row
+// of blocked grid, or row of transposed one (e.g column of map).
+struct ScanLines {
+    const BitGrid& grid;
+    // Tiles outside of these are treated as blocked
+    int low;
+    int high;
+    int line_low;
+    int line_high;
+
+    // Bit j is set if tile (start + j) of line is blocked
+    uint64_t load(int line, int start) const {
+        if (line < line_low || line >= line_high || start >= high || start + 64 <= low) {
+            return ~uint64_t(0);
+        }
+
+        const uint64_t* row = grid.get_row(line);
+        int words = static_cast<int>(grid.get_words_per_row());
+        uint64_t bits;
+        if (start >= 0) {
+            int w = start >> 6;
+            int s = start & 63;
+            uint64_t first = w < words ? row[w] : ~uint64_t(0);
+            if (s == 0) {
+                bits = first;
+            }
+            else {
+                uint64_t second = w + 1 < words ? row[w + 1] : ~uint64_t(0);
+                bits = (first >> s) | (second << (64 - s));
+            }
+        }
+        else {
+            // Tiles before the beginning of line
+            int s = -start;
+            bits = (row[0] << s) | ((uint64_t(1) << s) - 1);
+        }
+
+        if (low > start) {
+            bits |= (uint64_t(1) << (low - start)) - 1;
+        }
+        if (high < start + 64) {
+            bits |= ~uint64_t(0) << (high - start);
+        }
+
+        return bits;
+    }
+
+    // Walk line from pos in specified direction. Returns position of jump
+    // point (tile with forced neighbour, or goal), or -1 if hit a wall first.
+    int scan(int line, int pos, int dir, int goal_pos) const {
+        while (true) {
+            // Window covers tiles [start, start + 64). Going backwards, pos is
+            // the last tile of window, thus bits are read from the top.
+            int start = dir > 0 ? pos : pos - 63;
+            uint64_t own = load(line, start);
+            // Neighbour is forced, if its free while one behind it is not
+            uint64_t forced =
+                (~load(line - 1, start) & load(line - 1, start - dir)) |
+                (~load(line + 1, start) & load(line + 1, start - dir));
+            if (goal_pos >= start && goal_pos < start + 64) {
+                forced |= uint64_t(1) << (goal_pos - start);
+            }
+
+            if (dir > 0) {
+                if (own != 0) {
+                    int wall = lowest_bit(own);
+                    forced &= wall == 0 ? 0 : (~uint64_t(0) >> (64 - wall));
+                    return forced != 0 ? start + lowest_bit(forced) : -1;
+                }
+                if (forced != 0) {
+                    return start + lowest_bit(forced);
+                }
+                pos += 64;
+            }
+            else {
+                if (own != 0) {
+                    int wall = highest_bit(own);
+                    forced &= wall == 63 ? 0 : (~uint64_t(0) << (wall + 1));
+                    return forced != 0 ? start + highest_bit(forced) : -1;
+                }
+                if (forced != 0) {
+                    return start + highest_bit(forced);
+                }
+                pos -= 64;
+            }
+        }
+    }
+};
+
+// Straight jump from (x, y), which is the tile right after one we jump from.
+bool jump_straight(
+    const SearchArea& area, int x, int y, int dx, int dy, Point goal, Point& result) {
+    const PathGrid& grid = area.grid;
+
+    if (dy == 0) {
+        ScanLines lines = {
+            grid.get_blocked(), area.min_x, area.max_x, area.min_y, area.max_y};
+        int found = lines.scan(y, x, dx, goal.y == y ? goal.x : -1);
+        if (found < 0) {
+            return false;
+        }
+        result = {found, y};
+        return true;
+    }
+
+    ScanLines lines = {
+        grid.get_blocked_columns(), area.min_y, area.max_y, area.min_x, area.max_x};
+    int found = lines.scan(x, y, dy, goal.x == x ? goal.y : -1);
+    if (found < 0) {
+        return false;
+    }
+    result = {x, found};
+    return true;
+}
+
+// Jump from (x, y) in direction (dx, dy) until something interesting is found.
+// (x, y) is tile right after the one we jump from. Returns false if jump went
+// into a wall or out of bounds. Based on pathfinding.js's variant of jps that
+// never cuts corners.
+bool jump(
+    const SearchArea& area, int x, int y, int dx, int dy, Point goal, Point& result) {
+    if (dx == 0 || dy == 0) {
+        return jump_straight(area, x, y, dx, dy, goal, result);
+    }
+
+    while (true) {
+        if (!area.passable(x, y)) {
+            return false;
+        }
+
+        if (x == goal.x && y == goal.y) {
+            result = {x, y};
+            return true;
+        }
+
+        // Diagonal move - this tile is a jump point if any of straight jumps
+        // from it finds something.
+        Point unused;
+        if (jump_straight(area, x + dx, y, dx, 0, goal, unused) ||
+            jump_straight(area, x, y + dy, 0, dy, goal, unused)) {
+            result = {x, y};
+            return true;
+        }
+
+        if (!area.passable(x + dx, y) || !area.passable(x, y + dy)) {
+            return false;
+        }
+
+        x += dx;
+        y += dy;
+    }
+}
+
+// Directions worth jumping to from (x, y), based on where we came from.
+// Returns amount of directions written into out.
+int prune_neighbours(
+    const SearchArea& area,
+    int x,
+    int y,
+    int px,
+    int py,
+    bool has_parent,
+    int out[8][2]) {
+    int amount = 0;
+    auto add = [&](int dx, int dy) {
+        out[amount][0] = dx;
+        out[amount][1] = dy;
+        amount++;
+    };
+
+    if (!has_parent) {
+        for (auto& d : DIRECTIONS) {
+            if (can_step(area, x, y, d[0], d[1])) {
+                add(d[0], d[1]);
+            }
+        }
+        return amount;
+    }
+
+    int dx = sign(x - px);
+    int dy = sign(y - py);
+
+    if (dx != 0 && dy != 0) {
+        bool vertical = area.passable(x, y + dy);
+        bool horizontal = area.passable(x + dx, y);
+        if (vertical) {
+            add(0, dy);
+        }
+        if (horizontal) {
+            add(dx, 0);
+        }
+        if (vertical && horizontal && area.passable(x + dx, y + dy)) {
+            add(dx, dy);
+        }
+    }
+    else if (dx != 0) {
+        bool next = area.passable(x + dx, y);
+        bool top = area.passable(x, y + 1);
+        bool bottom = area.passable(x, y - 1);
+        if (next) {
+            add(dx, 0);
+            if (top && area.passable(x + dx, y + 1)) {
+                add(dx, 1);
+            }
+            if (bottom && area.passable(x + dx, y - 1)) {
+                add(dx, -1);
+            }
+        }
+        if (top) {
+            add(0, 1);
+        }
+        if (bottom) {
+            add(0, -1);
+        }
+    }
+    else {
+        bool next = area.passable(x, y + dy);
+        bool right = area.passable(x + 1, y);
+        bool left = area.passable(x - 1, y);
+        if (next) {
+            add(0, dy);
+            if (right && area.passable(x + 1, y + dy)) {
+                add(1, dy);
+            }
+            if (left && area.passable(x - 1, y + dy)) {
+                add(-1, dy);
+            }
+        }
+        if (right) {
+            add(1, 0);
+        }
+        if (left) {
+            add(-1, 0);
+        }
+    }
+
+    return amount;
+}
+
+bool search_jps(SearchBuffers& b, const SearchArea& area, Point start, Point goal) {
+    int width = area.grid.get_width();
+    uint32_t start_index = area.index(start.x, start.y);
+    uint32_t goal_index = area.index(goal.x, goal.y);
+
+    while (!b.open.empty()) {
+        OpenNode node = b.pop();
+        if (b.is_closed(node.index)) {
+            continue;
+        }
+        b.closed[node.index] = b.generation;
+
+        if (node.index == goal_index) {
+            return true;
+        }
+
+        int x = static_cast<int>(node.index % width);
+        int y = static_cast<int>(node.index / width);
+        bool has_parent = node.index != start_index;
+        int px = 0;
+        int py = 0;
+        if (has_parent) {
+            px = static_cast<int>(b.parent[node.index] % width);
+            py = static_cast<int>(b.parent[node.index] / width);
+        }
+
+        int directions[8][2];
+        int amount = prune_neighbours(area, x, y, px, py, has_parent, directions);
+
+        for (int d = 0; d < amount; d++) {
+            Point found;
+            int dx = directions[d][0];
+            int dy = directions[d][1];
+            if (!jump(area, x + dx, y + dy, dx, dy, goal, found)) {
+                continue;
+            }
+
+            relax(
+                b,
+                node.index,
+                area.index(found.x, found.y),
+                b.g[node.index] + heuristic(x, y, found.x, found.y, true),
+                heuristic(found.x, found.y, goal.x, goal.y, true));
+        }
+    }
+
+    return false;
+}
+
+// Walk parents from goal back to start. Jump points are not adjacent, thus
+// gaps between them are filled with straight or diagonal lines.
+void build_path(
+    const SearchBuffers& b,
+    int width,
+    uint32_t start_index,
+    uint32_t goal_index,
+    std::vector<Point>& path) {
+    uint32_t current = goal_index;
+    while (true) {
+        Point to = {static_cast<int>(current % width), static_cast<int>(current / width)};
+        path.push_back(to);
+
+        if (current == start_index) {
+            break;
+        }
+
+        uint32_t parent = b.parent[current];
+        Point from = {static_cast<int>(parent % width), static_cast<int>(parent / width)};
+        int dx = sign(from.x - to.x);
+        int dy = sign(from.y - to.y);
+        Point step = {to.x + dx, to.y + dy};
+        while (step.x != from.x || step.y != from.y) {
+            path.push_back(step);
+            step = {step.x + dx, step.y + dy};
+        }
+
+        current = parent;
+    }
+
+    std::reverse(path.begin(), path.end());
+}
+
+bool find_path_in_area(
+    const SearchArea& area,
+    Point start,
+    Point goal,
+    std::vector<Point>& path,
+    PathOptions options,
+    float* cost) {
+    path.clear();
+
+    if (!area.passable(start.x, start.y) || !area.passable(goal.x, goal.y)) {
+        return false;
+    }
+
+    const PathGrid& grid = area.grid;
+    SearchBuffers& b = buffers;
+    b.prepare(static_cast<size_t>(grid.get_width()) * grid.get_height());
+
+    uint32_t start_index = area.index(start.x, start.y);
+    uint32_t goal_index = area.index(goal.x, goal.y);
+    b.seen[start_index] = b.generation;
+    b.g[start_index] = 0.0f;
+    b.parent[start_index] = NO_PARENT;
+    float start_estimate =
+        heuristic(start.x, start.y, goal.x, goal.y, options.allow_diagonals);
+    b.push(start_estimate, start_index);
+
+    bool found;
+    if (options.allow_diagonals && options.use_jump_points && grid.is_uniform()) {
+        found = search_jps(b, area, start, goal);
+    }
+    else {
+        found = search_astar(b, area, goal, options.allow_diagonals);
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    build_path(b, grid.get_width(), start_index, goal_index, path);
+    if (cost != nullptr) {
+        *cost = b.g[goal_index];
+    }
+
+    return true;
+}
+
+} // namespace
+
+bool find_path(
+    const PathGrid& grid,
+    Point start,
+    Point goal,
+    std::vector<Point>& path,
+    PathOptions options,
+    float* cost) {
+    SearchArea area = {grid, 0, 0, grid.get_width(), grid.get_height()};
+    return find_path_in_area(area, start, goal, path, options, cost);
+}
+
+bool find_path(const PathGrid& grid, Point start, Point goal, std::vector<Point>& path) {
+    return find_path(grid, start, goal, path, PathOptions(), nullptr);
+}
+
+bool find_path_in_rect(
+    const PathGrid& grid,
+    TileRect rect,
+    Point start,
+    Point goal,
+    std::vector<Point>& path,
+    PathOptions options,
+    float* cost) {
+    SearchArea area = {
+        grid,
+        std::max(rect.x, 0),
+        std::max(rect.y, 0),
+        std::min(rect.x + rect.width, grid.get_width()),
+        std::min(rect.y + rect.height, grid.get_height())};
+    return find_path_in_area(area, start, goal, path, options, cost);
+}
+
+void find_paths(
+    const PathGrid& grid,
+    const std::vector<PathRequest>& requests,
+    std::vector<PathResult>& results,
+    PathOptions options) {
+    results.resize(requests.size());
+
+    get_worker_pool().parallel_for(
+        requests.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                PathResult& result = results[i];
+                result.cost = 0.0f;
+                result.found = find_path(
+                    grid,
+                    requests[i].start,
+                    requests[i].goal,
+                    result.path,
+                    options,
+                    &result.cost);
+            }
+        });
+}
+
+void find_paths(
+    const PathGrid& grid,
+    const std::vector<PathRequest>& requests,
+    std::vector<PathResult>& results) {
+    find_paths(grid, requests, results, PathOptions());
+}
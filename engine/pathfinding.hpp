@@ -0,0 +1,169 @@
+#pragma once
+
+#include "bitgrid.hpp"
+#include "mapgen.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Grid pathfinding.
+// A* over PathGrid, with jump point search used instead of plain A* when all
+// tiles cost the same (which allows to skip most of the tiles on the way).
+// Searches reuse thread-local buffers, thus repeated queries don't allocate
+// anything, except for the path itself (and even that one is reused if you
+// pass the same vector over and over).
+
+// Passability and movement costs of each tile.
+class PathGrid {
+private:
+    BitGrid blocked;
+    // Same as above, but with rows and columns swapped. Allows to scan columns
+    // word by word, just like rows.
+    BitGrid blocked_columns;
+    // Cost multipliers of entering each tile. Empty while all of them are 1.
+    std::vector<uint8_t> costs;
+    size_t custom_costs_amount = 0;
+
+public:
+    PathGrid() = default;
+    PathGrid(int width, int height);
+    // Build from mask where set bits are tiles that can't be walked through
+    PathGrid(BitGrid _blocked);
+
+    int get_width() const {
+        return blocked.get_width();
+    }
+
+    int get_height() const {
+        return blocked.get_height();
+    }
+
+    // Out-of-bounds tiles are never passable
+    bool is_passable(int x, int y) const {
+        return blocked.is_inside(x, y) && !blocked.get(x, y);
+    }
+
+    void set_passable(int x, int y, bool passable) {
+        blocked.set(x, y, !passable);
+        blocked_columns.set(y, x, !passable);
+    }
+
+    // Cost of entering tile, in range 1..255. Zero will be treated as 1 - use
+    // set_passable() to block things.
+    uint8_t get_cost(int x, int y) const {
+        return costs.empty() ? 1 : costs[static_cast<size_t>(y) * get_width() + x];
+    }
+
+    void set_cost(int x, int y, uint8_t cost);
+
+    // True if all tiles cost the same, thus jump point search can be used
+    bool is_uniform() const {
+        return custom_costs_amount == 0;
+    }
+
+    const BitGrid& get_blocked() const {
+        return blocked;
+    }
+
+    const BitGrid& get_blocked_columns() const {
+        return blocked_columns;
+    }
+};
+
+// Make PathGrid of map's size, with tiles that contain blocking objects set
+// to impassable.
+template <typename T>
+PathGrid make_path_grid(TileMapBase<T>& map, const std::function<bool(T)>& is_blocking) {
+    return PathGrid(make_tile_mask(map, is_blocking));
+}
+
+// Re-evaluate passability of single tile. Call it after tile's content change.
+template <typename T>
+void update_path_grid(
+    PathGrid& grid,
+    TileMapBase<T>& map,
+    size_t grid_index,
+    const std::function<bool(T)>& is_blocking) {
+    Point tile = map.index_to_tile(grid_index);
+    bool blocking = false;
+    map.for_each_object_id(grid_index, [&](int object_id) {
+        blocking = blocking || is_blocking(map.get_object_by_id(object_id));
+    });
+    grid.set_passable(tile.x, tile.y, !blocking);
+}
+
+// Same, for each tile map's journal has recorded since the previous call. If
+// journal is new to reader (first call, or map's journal has been replaced) -
+// whole grid is re-evaluated. Does nothing if map has no journal.
+template <typename T>
+void update_path_grid(
+    PathGrid& grid,
+    TileMapBase<T>& map,
+    TileJournalReader& journal,
+    const std::function<bool(T)>& is_blocking) {
+    TileChanges changes = journal.read(map.get_journal());
+    if (changes.everything) {
+        for (size_t i = 0; i < map.get_grid_size(); i++) {
+            update_path_grid(grid, map, i, is_blocking);
+        }
+        return;
+    }
+    for (size_t i = 0; i < changes.tiles_amount; i++) {
+        update_path_grid(grid, map, changes.tiles[i], is_blocking);
+    }
+}
+
+struct PathOptions {
+    // Diagonal moves are only allowed if both tiles next to them are passable,
+    // thus paths never cut corners of walls.
+    bool allow_diagonals = true;
+    // Use jump point search if grid is uniform. Only makes sense with diagonals.
+    bool use_jump_points = true;
+};
+
+// Find path between two tiles. On success, fills path with tiles from start
+// to goal (both included) and returns true. On failure, path is left empty.
+// If cost is not nullptr - it will receive total cost of path.
+bool find_path(
+    const PathGrid& grid,
+    Point start,
+    Point goal,
+    std::vector<Point>& path,
+    PathOptions options,
+    float* cost);
+bool find_path(const PathGrid& grid, Point start, Point goal, std::vector<Point>& path);
+
+// Same as above, but tiles outside of rect are treated as impassable
+bool find_path_in_rect(
+    const PathGrid& grid,
+    TileRect rect,
+    Point start,
+    Point goal,
+    std::vector<Point>& path,
+    PathOptions options,
+    float* cost);
+
+struct PathRequest {
+    Point start;
+    Point goal;
+};
+
+struct PathResult {
+    bool found = false;
+    float cost = 0.0f;
+    std::vector<Point> path;
+};
+
+// Solve multiple requests at once, spreading them across worker threads.
+// Results are stored in the same order as requests. Keep results vector around
+// between frames, to reuse memory of already allocated paths.
+void find_paths(
+    const PathGrid& grid,
+    const std::vector<PathRequest>& requests,
+    std::vector<PathResult>& results,
+    PathOptions options);
+void find_paths(
+    const PathGrid& grid,
+    const std::vector<PathRequest>& requests,
+    std::vector<PathResult>& results);
@@ -0,0 +1,434 @@
+#include "procgen.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Rows handled per task. Rows of big maps are long enough for that to be
+// plenty of work.
+static constexpr size_t BAND_ROWS = 16;
+
+uint64_t splitmix64(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+// Same as hash_tile(), but with seed that has already been mixed, to not do
+// that for each tile of loops
+static uint64_t hash_mixed(uint64_t mixed_seed, int x, int y) {
+    uint64_t coords =
+        static_cast<uint64_t>(static_cast<uint32_t>(x)) |
+        (static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32);
+    return splitmix64(coords ^ mixed_seed);
+}
+
+uint64_t hash_tile(uint64_t seed, int x, int y) {
+    return hash_mixed(splitmix64(seed), x, y);
+}
+
+// Cheaper 32-bit hash for noise lattice, which needs a few of these per sample.
+// Quality is way worse than of splitmix, but plenty for picking gradients.
+static uint32_t hash_lattice(uint32_t seed, int x, int y) {
+    uint32_t hash = seed ^ (static_cast<uint32_t>(x) * 0x27d4eb2du) ^
+                    (static_cast<uint32_t>(y) * 0x165667b1u);
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+    hash *= 0x297a2d39u;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+// Top 53 bits, as [0, 1)
+static double to_unit(uint64_t value) {
+    return static_cast<double>(value >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// SplitMix
+SplitMix::SplitMix(uint64_t seed)
+    : state(seed) {
+}
+
+uint64_t SplitMix::next() {
+    uint64_t value = splitmix64(state);
+    state += 0x9e3779b97f4a7c15ull;
+    return value;
+}
+
+int SplitMix::next_int(int min, int max) {
+    if (max <= min) {
+        return min;
+    }
+    uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(max) - min) + 1;
+    return static_cast<int>(min + static_cast<int64_t>(next() % range));
+}
+
+float SplitMix::next_float() {
+    return static_cast<float>(to_unit(next()));
+}
+
+// Cellular automata
+void fill_random(BitGrid& mask, float chance, uint64_t seed) {
+    int width = mask.get_width();
+    size_t words = mask.get_words_per_row();
+
+    uint64_t mixed_seed = splitmix64(seed);
+
+    get_worker_pool().parallel_for(
+        mask.get_height(), BAND_ROWS, [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++) {
+                uint64_t* row = mask.get_row(static_cast<int>(y));
+                for (size_t word = 0; word < words; word++) {
+                    uint64_t bits = 0;
+                    int first_x = static_cast<int>(word * 64);
+                    int amount = std::min(64, width - first_x);
+                    for (int bit = 0; bit < amount; bit++) {
+                        uint64_t hash =
+                            hash_mixed(mixed_seed, first_x + bit, static_cast<int>(y));
+                        bits |= static_cast<uint64_t>(to_unit(hash) < chance) << bit;
+                    }
+                    row[word] = bits;
+                }
+            }
+        });
+}
+
+// Add one-bit value to 4-bit counters, stored as bit planes - 64 counters at
+// once. Counters never go past 8 here, thus 4 planes are enough.
+static void add_to_counters(uint64_t planes[4], uint64_t value) {
+    for (int i = 0; i < 4; i++) {
+        uint64_t carry = planes[i] & value;
+        planes[i] ^= value;
+        value = carry;
+    }
+}
+
+// Bits of counters that are at least threshold. Compares planes with threshold
+// from the highest bit down, same as one would compare numbers on paper.
+static uint64_t at_least(const uint64_t planes[4], int threshold) {
+    if (threshold <= 0) {
+        return ~uint64_t(0);
+    }
+    if (threshold > 8) {
+        return 0;
+    }
+
+    uint64_t greater = 0;
+    uint64_t equal = ~uint64_t(0);
+    for (int i = 3; i >= 0; i--) {
+        if ((threshold >> i) & 1) {
+            equal &= planes[i];
+        }
+        else {
+            greater |= equal & planes[i];
+            equal &= ~planes[i];
+        }
+    }
+    return greater | equal;
+}
+
+void smooth_caves(BitGrid& walls, int iterations, const CaveRules& rules) {
+    int width = walls.get_width();
+    int height = walls.get_height();
+    size_t words = walls.get_words_per_row();
+    if (width == 0 || height == 0) {
+        return;
+    }
+
+    uint64_t edge = rules.edge_is_wall ? ~uint64_t(0) : 0;
+    // Padding bits of the last word read as whatever is beyond the border, and
+    // get cleared in results
+    int tail = width & 63;
+    uint64_t padding = tail == 0 ? 0 : ~((uint64_t(1) << tail) - 1);
+    std::vector<uint64_t> edge_row(words, edge);
+
+    BitGrid next(width, height);
+    BitGrid* source = &walls;
+    BitGrid* target = &next;
+
+    for (int step = 0; step < iterations; step++) {
+        const BitGrid& current = *source;
+        BitGrid& result = *target;
+
+        get_worker_pool().parallel_for(height, BAND_ROWS, [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++) {
+                const uint64_t* rows[3] = {
+                    y > 0 ? current.get_row(static_cast<int>(y) - 1) : edge_row.data(),
+                    current.get_row(static_cast<int>(y)),
+                    y + 1 < static_cast<size_t>(height)
+                        ? current.get_row(static_cast<int>(y) + 1)
+                        : edge_row.data()};
+                uint64_t* out = result.get_row(static_cast<int>(y));
+
+                auto word_at = [&](const uint64_t* row, size_t word) {
+                    if (word >= words) {
+                        return edge;
+                    }
+                    return word == words - 1 ? row[word] | (padding & edge) : row[word];
+                };
+
+                for (size_t word = 0; word < words; word++) {
+                    uint64_t planes[4] = {0, 0, 0, 0};
+                    uint64_t center = 0;
+                    for (int r = 0; r < 3; r++) {
+                        uint64_t current_word = word_at(rows[r], word);
+                        uint64_t previous = word > 0 ? word_at(rows[r], word - 1) : edge;
+                        uint64_t following = word_at(rows[r], word + 1);
+                        // Bit x of these is tile at x - 1 and x + 1
+                        uint64_t left = (current_word << 1) | (previous >> 63);
+                        uint64_t right = (current_word >> 1) | (following << 63);
+
+                        add_to_counters(planes, left);
+                        add_to_counters(planes, right);
+                        if (r == 1) {
+                            center = current_word;
+                        }
+                        else {
+                            add_to_counters(planes, current_word);
+                        }
+                    }
+
+                    uint64_t born = ~center & at_least(planes, rules.birth);
+                    uint64_t survived = center & at_least(planes, rules.survival);
+                    out[word] = born | survived;
+                }
+                out[words - 1] &= ~padding;
+            }
+        });
+
+        std::swap(source, target);
+    }
+
+    if (source != &walls) {
+        walls = std::move(*source);
+    }
+}
+
+// Noise
+// std::floor() ends up as library call, unless sse4 is enabled
+static int fast_floor(float value) {
+    int truncated = static_cast<int>(value);
+    return value < static_cast<float>(truncated) ? truncated - 1 : truncated;
+}
+
+static float smooth(float t) {
+    return t * t * (3.0f - 2.0f * t);
+}
+
+float value_noise(float x, float y, uint64_t seed) {
+    int cell_x = fast_floor(x);
+    int cell_y = fast_floor(y);
+    float tx = smooth(x - static_cast<float>(cell_x));
+    float ty = smooth(y - static_cast<float>(cell_y));
+
+    uint32_t lattice_seed = static_cast<uint32_t>(seed ^ (seed >> 32));
+    auto corner = [&](int dx, int dy) {
+        uint32_t hash = hash_lattice(lattice_seed, cell_x + dx, cell_y + dy);
+        return static_cast<float>(hash >> 8) * (1.0f / 16777216.0f);
+    };
+    float top_left = corner(0, 0);
+    float bottom_left = corner(0, 1);
+    float top = top_left + (corner(1, 0) - top_left) * tx;
+    float bottom = bottom_left + (corner(1, 1) - bottom_left) * tx;
+    return top + (bottom - top) * ty;
+}
+
+float simplex_noise(float x, float y, uint64_t seed) {
+    // Skew factors for 2d, (sqrt(3) - 1) / 2 and (3 - sqrt(3)) / 6
+    constexpr float SKEW = 0.36602540378f;
+    constexpr float UNSKEW = 0.21132486540f;
+    // Unit-ish gradients, 8 directions
+    static constexpr float GRADIENTS[8][2] = {
+        {1.0f, 0.0f},
+        {-1.0f, 0.0f},
+        {0.0f, 1.0f},
+        {0.0f, -1.0f},
+        {0.70710678f, 0.70710678f},
+        {-0.70710678f, 0.70710678f},
+        {0.70710678f, -0.70710678f},
+        {-0.70710678f, -0.70710678f}};
+
+    uint32_t lattice_seed = static_cast<uint32_t>(seed ^ (seed >> 32));
+    float skew = (x + y) * SKEW;
+    int cell_x = fast_floor(x + skew);
+    int cell_y = fast_floor(y + skew);
+    float unskew = static_cast<float>(cell_x + cell_y) * UNSKEW;
+    float x0 = x - (static_cast<float>(cell_x) - unskew);
+    float y0 = y - (static_cast<float>(cell_y) - unskew);
+
+    // Which of two triangles of the cell point is in
+    int step_x = x0 > y0 ? 1 : 0;
+    int step_y = 1 - step_x;
+    float x1 = x0 - static_cast<float>(step_x) + UNSKEW;
+    float y1 = y0 - static_cast<float>(step_y) + UNSKEW;
+    float x2 = x0 - 1.0f + 2.0f * UNSKEW;
+    float y2 = y0 - 1.0f + 2.0f * UNSKEW;
+
+    auto contribution = [&](int corner_x, int corner_y, float dx, float dy) {
+        // Branchless, since whether corner is in reach is pure coin flip
+        float falloff = std::max(0.5f - dx * dx - dy * dy, 0.0f);
+        const float* gradient =
+            GRADIENTS[hash_lattice(lattice_seed, corner_x, corner_y) >> 29];
+        falloff *= falloff;
+        return falloff * falloff * (gradient[0] * dx + gradient[1] * dy);
+    };
+
+    float sum = contribution(cell_x, cell_y, x0, y0) +
+                contribution(cell_x + step_x, cell_y + step_y, x1, y1) +
+                contribution(cell_x + 1, cell_y + 1, x2, y2);
+    // Sum stays within about [-1/70, 1/70]
+    return std::clamp(sum * 35.0f + 0.5f, 0.0f, 1.0f);
+}
+
+float sample_noise(const NoiseSettings& noise, int x, int y) {
+    float frequency = 1.0f / std::max(noise.scale, 1.0f);
+    float amplitude = 1.0f;
+    float sum = 0.0f;
+    float total = 0.0f;
+
+    for (int octave = 0; octave < std::max(noise.octaves, 1); octave++) {
+        float nx = static_cast<float>(x) * frequency;
+        float ny = static_cast<float>(y) * frequency;
+        uint64_t seed = splitmix64(noise.seed + static_cast<uint64_t>(octave));
+        float value = noise.kind == NoiseKind::Value ? value_noise(nx, ny, seed)
+                                                     : simplex_noise(nx, ny, seed);
+        sum += value * amplitude;
+        total += amplitude;
+        frequency *= 2.0f;
+        amplitude *= noise.persistence;
+    }
+
+    return sum / total;
+}
+
+void fill_noise(std::vector<float>& field, Point size, const NoiseSettings& noise) {
+    field.resize(static_cast<size_t>(size.x) * size.y);
+    get_worker_pool().parallel_for(size.y, BAND_ROWS, [&](size_t first, size_t last) {
+        for (size_t y = first; y < last; y++) {
+            float* row = field.data() + y * size.x;
+            for (int x = 0; x < size.x; x++) {
+                row[x] = sample_noise(noise, x, static_cast<int>(y));
+            }
+        }
+    });
+}
+
+void threshold_noise(BitGrid& mask, const NoiseSettings& noise, float threshold) {
+    int width = mask.get_width();
+    size_t words = mask.get_words_per_row();
+
+    get_worker_pool().parallel_for(
+        mask.get_height(), BAND_ROWS, [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++) {
+                uint64_t* row = mask.get_row(static_cast<int>(y));
+                std::fill(row, row + words, 0);
+                for (int x = 0; x < width; x++) {
+                    float value = sample_noise(noise, x, static_cast<int>(y));
+                    row[x >> 6] |= static_cast<uint64_t>(value >= threshold) << (x & 63);
+                }
+            }
+        });
+}
+
+// Dungeons
+struct DungeonBuilder {
+    const BspSettings& settings;
+    SplitMix random;
+    DungeonLayout layout;
+
+    Point get_center(const TileRect& room) {
+        return {room.x + room.width / 2, room.y + room.height / 2};
+    }
+
+    // L-shaped corridor between centers of two rooms
+    void connect(const TileRect& first, const TileRect& second) {
+        Point from = get_center(first);
+        Point to = get_center(second);
+        // Corner is either at from's row or at from's column
+        Point corner = random.next() & 1 ? Point{to.x, from.y} : Point{from.x, to.y};
+
+        auto add_segment = [&](Point a, Point b) {
+            layout.corridors.push_back(
+                {std::min(a.x, b.x),
+                 std::min(a.y, b.y),
+                 std::abs(a.x - b.x) + 1,
+                 std::abs(a.y - b.y) + 1});
+        };
+        add_segment(from, corner);
+        add_segment(corner, to);
+    }
+
+    // Returns index of some room within area, to connect area to its sibling
+    // with. There is always at least one, since areas never get too small.
+    size_t split(TileRect area, int depth) {
+        int min_leaf =
+            std::max(settings.min_leaf, settings.min_room + settings.padding * 2);
+        bool can_split_x = area.width >= min_leaf * 2;
+        bool can_split_y = area.height >= min_leaf * 2;
+
+        if (depth >= settings.max_depth || (!can_split_x && !can_split_y)) {
+            return place_room(area);
+        }
+
+        // Splitting across the longer side keeps areas from turning into stripes
+        bool split_x = can_split_x && (!can_split_y || area.width >= area.height);
+        TileRect first = area;
+        TileRect second = area;
+        if (split_x) {
+            first.width = random.next_int(min_leaf, area.width - min_leaf);
+            second.x += first.width;
+            second.width -= first.width;
+        }
+        else {
+            first.height = random.next_int(min_leaf, area.height - min_leaf);
+            second.y += first.height;
+            second.height -= first.height;
+        }
+
+        size_t first_room = split(first, depth + 1);
+        size_t second_room = split(second, depth + 1);
+        connect(layout.rooms[first_room], layout.rooms[second_room]);
+        return random.next() & 1 ? first_room : second_room;
+    }
+
+    size_t place_room(TileRect area) {
+        int padding = settings.padding;
+        int max_width = std::max(area.width - padding * 2, 1);
+        int max_height = std::max(area.height - padding * 2, 1);
+        int width = random.next_int(std::min(settings.min_room, max_width), max_width);
+        int height = random.next_int(std::min(settings.min_room, max_height), max_height);
+
+        TileRect room = {
+            area.x + padding + random.next_int(0, max_width - width),
+            area.y + padding + random.next_int(0, max_height - height),
+            width,
+            height};
+        layout.rooms.push_back(room);
+        return layout.rooms.size() - 1;
+    }
+};
+
+DungeonLayout make_dungeon(Point map_size, const BspSettings& settings, uint64_t seed) {
+    DungeonBuilder builder = {settings, SplitMix(seed), {}};
+    if (map_size.x > 0 && map_size.y > 0) {
+        builder.split({0, 0, map_size.x, map_size.y}, 0);
+    }
+    return builder.layout;
+}
+
+void carve_rects(BitGrid& mask, const std::vector<TileRect>& rects, bool value) {
+    for (const auto& rect : rects) {
+        int first_x = std::max(rect.x, 0);
+        int last_x = std::min(rect.x + rect.width, mask.get_width());
+        int first_y = std::max(rect.y, 0);
+        int last_y = std::min(rect.y + rect.height, mask.get_height());
+
+        for (int y = first_y; y < last_y; y++) {
+            for (int x = first_x; x < last_x; x++) {
+                mask.set(x, y, value);
+            }
+        }
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "bitgrid.hpp"
+#include "mapgen.hpp"
+#include "spdlog/spdlog.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Procedural map generation stages.
+// Unlike ColorGen, these don't need any hand-drawn image - each stage fills or
+// reshapes BitGrid of walls (or float field of heights), and paint_mask() turns
+// the result into TileMap's ids. Stages are meant to be chained:
+//   BitGrid walls(width, height);
+//   fill_random(walls, 0.45f, seed);
+//   smooth_caves(walls, 5, {});
+//   carve_rects(walls, make_dungeon(map_size, {}, seed).rooms, false);
+//   paint_mask(map, walls, wall_id, floor_id);
+// All the randomness is derived from seed and tile coordinates, not from order
+// of evaluation - thus results are the same no matter how many threads there
+// are.
+
+// Stateless splitmix64 - good enough to turn any number into random-looking one
+uint64_t splitmix64(uint64_t value);
+
+// Random-looking number of tile, derived from seed
+uint64_t hash_tile(uint64_t seed, int x, int y);
+
+// Sequential splitmix64 generator, for things that can't be done per-tile
+class SplitMix {
+private:
+    uint64_t state;
+
+public:
+    SplitMix(uint64_t seed);
+
+    uint64_t next();
+
+    // Within [min, max], both included
+    int next_int(int min, int max);
+
+    // Within [0, 1)
+    float next_float();
+};
+
+// Set each bit with specified chance
+void fill_random(BitGrid& mask, float chance, uint64_t seed);
+
+// Cellular automata rules. Tile becomes wall if it has at least birth wall
+// neighbours (out of 8), and stays wall if it has at least survival ones.
+// Default ones are the classic "4-5" caves.
+struct CaveRules {
+    int birth = 5;
+    int survival = 4;
+    // Count tiles beyond borders as walls, which closes caves at map's edges
+    bool edge_is_wall = true;
+};
+
+// Run automata on walls for specified amount of steps. Neighbours are counted
+// 64 tiles at once with bitwise adders, and rows are split between workers.
+void smooth_caves(BitGrid& walls, int iterations, const CaveRules& rules);
+
+enum class NoiseKind {
+    // Interpolated random values on grid - blocky, but cheap
+    Value,
+    Simplex
+};
+
+struct NoiseSettings {
+    NoiseKind kind = NoiseKind::Simplex;
+    // Size of the biggest features, in tiles
+    float scale = 64.0f;
+    // Each next octave has twice the frequency and persistence times the
+    // amplitude of the previous one
+    int octaves = 4;
+    float persistence = 0.5f;
+    uint64_t seed = 0;
+};
+
+// Single octave at specified point, within [0, 1]
+float value_noise(float x, float y, uint64_t seed);
+float simplex_noise(float x, float y, uint64_t seed);
+
+// All octaves of noise at specified tile, within [0, 1]
+float sample_noise(const NoiseSettings& noise, int x, int y);
+
+// Fill field with noise of each tile, row by row
+void fill_noise(std::vector<float>& field, Point size, const NoiseSettings& noise);
+
+// Set bits of tiles with noise at or above threshold, clear the rest
+void threshold_noise(BitGrid& mask, const NoiseSettings& noise, float threshold);
+
+struct BspSettings {
+    // Areas are split until these get smaller than twice of that
+    int min_leaf = 16;
+    int max_depth = 12;
+    int min_room = 4;
+    // Space between room and border of its area
+    int padding = 1;
+};
+
+// Rooms plus corridors between them. Corridors are 1 tile wide, made of two
+// rects each (horizontal and vertical parts).
+struct DungeonLayout {
+    std::vector<TileRect> rooms;
+    std::vector<TileRect> corridors;
+};
+
+// Split map into areas with binary space partition, place room into each and
+// connect rooms of sibling areas. Every room is reachable from every other one.
+DungeonLayout make_dungeon(Point map_size, const BspSettings& settings, uint64_t seed);
+
+// Set or clear bits of rects, say to carve rooms out of walls
+void carve_rects(BitGrid& mask, const std::vector<TileRect>& rects, bool value);
+
+// Write set_id into tiles with bit set, and clear_id into the rest. Mask must
+// have the same size as map, else nothing gets painted.
+template <typename T>
+void paint_mask(TileMap<T>& map, const BitGrid& mask, int set_id, int clear_id) {
+    Point map_size = map.get_map_size();
+    if (mask.get_width() != map_size.x || mask.get_height() != map_size.y) {
+        spdlog::warn(
+            "Unable to paint {}x{} mask onto {}x{} map",
+            mask.get_width(),
+            mask.get_height(),
+            map_size.x,
+            map_size.y);
+        return;
+    }
+
+    map.write_rows(
+        [&](int y, int* ids) {
+            const uint64_t* row = mask.get_row(y);
+            for (int x = 0; x < mask.get_width(); x++) {
+                ids[x] = (row[x >> 6] >> (x & 63)) & 1 ? set_id : clear_id;
+            }
+        },
+        true);
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "memory_stats.hpp"
 #include "raylib.h"
 #include <functional>
 #include <vector>
@@ -144,7 +145,7 @@ public:
 
         // Else querrying results from children.
         // This may be inefficient and may need a rework. TODO
-        for (auto directon: children) {
+        for (auto direction: children) {
             std::vector<T> dir_vec = direction.query_range(range);
             results.insert(results.end(), dir_vec.begin(), dir_vec.end());
         }
@@ -168,4 +169,14 @@ public:
 
         children.clear();
     }
+
+    // Buffers of this node and all of its descendants. Amount is of items.
+    MemoryUsage get_memory_usage() const {
+        MemoryUsage usage = {get_capacity_bytes(items) + get_capacity_bytes(children),
+                             items.size()};
+        for (const auto& child : children) {
+            usage += child.get_memory_usage();
+        }
+        return usage;
+    }
 };
@@ -1,4 +1,5 @@
 #include "scene.hpp"
+#include "atlas.hpp"
 // To add vectors
 #include "raybuff.hpp"
 #include "spdlog/spdlog.h"
@@ -153,6 +154,10 @@ LayerStorage::~LayerStorage() {
     if (current_scene != nullptr) {
         delete current_scene;
     }
+    // Scene that was about to be switched to
+    if (next_scene != nullptr && next_scene != current_scene) {
+        delete next_scene;
+    }
 }
 
 // Scene manager
@@ -199,6 +204,21 @@ void SceneManager::update(float dt) {
 
 
     EndDrawing();
+    finish_texture_bind_frame();
+}
+
+void SceneManager::clear() {
+    layers.clear();
+}
+
+size_t SceneManager::get_nodes_amount() {
+    size_t amount = 0;
+    for (auto& [_, i]: layers) {
+        if (i.current_scene != nullptr) {
+            amount += i.current_scene->get_nodes_amount();
+        }
+    }
+    return amount;
 }
 
 SceneManager::~SceneManager() {
@@ -32,7 +32,7 @@ protected:
     // For now, lets assume all scenes are 2D. This will give us headache
     // if we will later decide to introduce 3D scenes, but for now lets not
     // bother about it. Camera is required for node inspector to work.
-    Camera2D camera;
+    Camera2D camera = {{0.0f, 0.0f}, {0.0f, 0.0f}, 0.0f, 1.0f};
 
     void update_recursive(float dt);
     void draw_recursive();
@@ -65,6 +65,11 @@ public:
 
     void detach_child(Node* node);
 
+    // All nodes attached to scene, not counting the root
+    size_t get_nodes_amount() {
+        return root.get_descendants_amount();
+    }
+
     virtual void update(float dt);
     virtual void draw();
 };
@@ -134,6 +139,13 @@ public:
         return &layers.at(layer_name);
     }
 
+    // Delete all layers with their scenes. Say, before things scenes use (like
+    // asset storages) are gone.
+    void clear();
+
+    // Nodes of current scenes of all layers, children of children included
+    size_t get_nodes_amount();
+
     void update(float dt);
     bool active = true;
     bool is_active();
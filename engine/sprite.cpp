@@ -5,10 +5,18 @@
 
 Sprite::Sprite(const Texture2D* _spritesheet, Rectangle _rect)
     : spritesheet(_spritesheet)
-    , rect(_rect) {
+    , rect(_rect)
+    , source_id(_spritesheet->id) {
+}
+
+Sprite::Sprite(const AtlasRegion& region)
+    : spritesheet(region.texture)
+    , rect(region.rect)
+    , source_id(region.source_id) {
 }
 
 void Sprite::draw(Vector2 pos) {
+    count_texture_bind(spritesheet->id, source_id);
     DrawTextureRec(*spritesheet, rect, pos, WHITE);
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "atlas.hpp"
 #include "utility.hpp"
 #include "scene.hpp"
 #include "raylib.h"
@@ -9,9 +10,12 @@ class Sprite {
 private:
     const Texture2D* spritesheet;
     Rectangle rect;
+    unsigned int source_id;
 
 public:
     Sprite(const Texture2D* spritesheet, Rectangle rect);
+    // Sprite out of SpriteStorage's region, which may be packed into atlas
+    Sprite(const AtlasRegion& region);
     // TODO: consider using DrawTexturePro under the hood, to allow for angle
     // and colored masks.
     void draw(Vector2 pos);
@@ -1,43 +1,446 @@
 #include "storage.hpp"
 #include "raylib.h"
+
+#include <algorithm>
+#include <cstring>
 #include <string>
 
 
-Texture2D SpriteStorage::load_data(const std::string &path) {
-    return LoadTexture(path.c_str());
+// Whole texture as region, for sprites that aren't packed
+static AtlasRegion make_whole_region(const Texture2D* texture) {
+    float width = static_cast<float>(texture->width);
+    float height = static_cast<float>(texture->height);
+    return {texture, {0.0f, 0.0f, width, height}, texture->id};
+}
+
+// Same as what LoadTexture() does, just split in halves
+Image SpriteStorage::decode_data(const std::string &path) {
+    return prepare_image(LoadImage(path.c_str()));
+}
+
+Image SpriteStorage::decode_packed_data(
+    const PackData& data, const std::string& extension) {
+    return prepare_image(LoadImageFromMemory(
+        extension.c_str(), data.get_data(), static_cast<int>(data.get_size())));
+}
+
+Image SpriteStorage::prepare_image(Image image) {
+    // Converting right there, while on worker
+    if (use_atlas && image.data != nullptr &&
+        image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) {
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    }
+    return image;
+}
+
+bool SpriteStorage::is_decoded(const Image& data) {
+    return data.data != nullptr;
+}
+
+Texture2D SpriteStorage::finalize_data(Image data) {
+    Texture2D texture = LoadTextureFromImage(data);
+    UnloadImage(data);
+    return texture;
+}
+
+void SpriteStorage::discard_data(Image data) {
+    UnloadImage(data);
 }
 
 void SpriteStorage::unload_data(Texture2D data) {
     UnloadTexture(data);
 }
 
+// Mipmaps aren't generated for storage's textures, thus just the base level
+size_t SpriteStorage::get_data_size(const Texture2D& data) {
+    return static_cast<size_t>(GetPixelDataSize(data.width, data.height, data.format));
+}
+
+void SpriteStorage::store_data(const std::string& key, Image data) {
+    if (use_atlas) {
+        unpacked.push_back({key, data});
+        return;
+    }
+
+    AsyncStorage<Texture2D, Image>::store_data(key, data);
+    // Reloaded texture may have different size
+    auto it = regions.find(key);
+    if (it != regions.end()) {
+        it->second = make_whole_region(&items.at(key));
+    }
+}
+
+void SpriteStorage::reload_data(const std::string& key, Image data) {
+    // Still waiting for build_atlas()
+    for (auto& [unpacked_key, image] : unpacked) {
+        if (unpacked_key == key) {
+            UnloadImage(image);
+            image = data;
+            return;
+        }
+    }
+
+    auto it = regions.find(key);
+    bool is_packed = it != regions.end() && !is_loaded(key);
+    if (!is_packed) {
+        AsyncStorage<Texture2D, Image>::reload_data(key, data);
+        if (it != regions.end()) {
+            it->second = make_whole_region(&items.at(key));
+        }
+        return;
+    }
+
+    // Packed sprite that still fits into its place gets written right there
+    AtlasRegion& region = it->second;
+    bool is_same_size = data.width == static_cast<int>(region.rect.width) &&
+                        data.height == static_cast<int>(region.rect.height);
+    if (is_same_size) {
+        if (data.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) {
+            ImageFormat(&data, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        }
+        UpdateTextureRec(*region.texture, region.rect, data.data);
+        UnloadImage(data);
+        spdlog::info("Reloaded {}", key);
+        return;
+    }
+
+    // Else it gets texture of its own, and its place within page stays unused
+    // until storage is cleared
+    put_item(key, finalize_data(data), true);
+    region = make_whole_region(&items.at(key));
+    spdlog::info("Reloaded {}, it doesn't fit into atlas anymore", key);
+}
+
+MemoryUsage SpriteStorage::get_memory_usage() const {
+    MemoryUsage usage = AsyncStorage<Texture2D, Image>::get_memory_usage();
+    for (const auto& page : pages) {
+        usage.bytes +=
+            static_cast<size_t>(GetPixelDataSize(page.width, page.height, page.format));
+    }
+    usage.amount += pages.size();
+    for (const auto& [_, image] : unpacked) {
+        usage.bytes += static_cast<size_t>(
+            GetPixelDataSize(image.width, image.height, image.format));
+    }
+    return usage;
+}
+
 SpriteStorage::~SpriteStorage() {
     clear();
 }
 
+void SpriteStorage::enable_atlas(const AtlasSettings& settings) {
+    use_atlas = true;
+    atlas_settings = settings;
+}
+
+void SpriteStorage::load(const std::string &path, const std::string &extension) {
+    if (use_atlas) {
+        load_async(path, extension);
+        finish();
+        build_atlas();
+        return;
+    }
+
+    AsyncStorage<Texture2D, Image>::load(path, extension);
+    for (auto& [key, region] : regions) {
+        region = make_whole_region(&items.at(key));
+    }
+}
+
+void SpriteStorage::load_pack(
+    const AssetPack& pack, const std::string& directory, const std::string& extension) {
+    if (use_atlas) {
+        load_pack_async(pack, directory, extension);
+        finish();
+        build_atlas();
+        return;
+    }
+
+    AsyncStorage<Texture2D, Image>::load_pack(pack, directory, extension);
+    for (auto& [key, region] : regions) {
+        region = make_whole_region(&items.at(key));
+    }
+}
+
+void SpriteStorage::build_atlas() {
+    if (unpacked.empty()) {
+        return;
+    }
+
+    // Tallest first, which keeps skyline flat
+    std::sort(unpacked.begin(), unpacked.end(), [](const auto& a, const auto& b) {
+        if (a.second.height != b.second.height) {
+            return a.second.height > b.second.height;
+        }
+        return a.second.width > b.second.width;
+    });
+
+    struct Placement {
+        size_t page;
+        int x;
+        int y;
+    };
+    std::vector<SkylinePacker> packers;
+    std::vector<Placement> placements;
+    int page_size = atlas_settings.page_size;
+    int padding = atlas_settings.padding;
+
+    for (auto& [key, image] : unpacked) {
+        if (image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) {
+            ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        }
+
+        Placement placement = {0, 0, 0};
+        while (placement.page < packers.size() &&
+               !packers[placement.page].pack(
+                   image.width, image.height, placement.x, placement.y)) {
+            placement.page++;
+        }
+        if (placement.page == packers.size()) {
+            // Images that don't fit into page get one of their own size
+            packers.emplace_back(
+                std::max(image.width, page_size),
+                std::max(image.height, page_size),
+                padding);
+            packers.back().pack(image.width, image.height, placement.x, placement.y);
+        }
+        placements.push_back(placement);
+    }
+
+    // Pages get cropped to what's been used, the last one is usually half-empty
+    std::vector<std::vector<unsigned char>> pixels(packers.size());
+    for (size_t page = 0; page < packers.size(); page++) {
+        const SkylinePacker& packer = packers[page];
+        pixels[page].resize(
+            static_cast<size_t>(packer.get_width()) * packer.get_used_height() * 4, 0);
+    }
+
+    for (size_t i = 0; i < unpacked.size(); i++) {
+        const Image& image = unpacked[i].second;
+        const Placement& placement = placements[i];
+        size_t page_stride = static_cast<size_t>(packers[placement.page].get_width()) * 4;
+        size_t image_stride = static_cast<size_t>(image.width) * 4;
+        unsigned char* target =
+            pixels[placement.page].data() + placement.y * page_stride + placement.x * 4;
+        const unsigned char* source = static_cast<const unsigned char*>(image.data);
+        for (int y = 0; y < image.height; y++) {
+            std::memcpy(
+                target + y * page_stride, source + y * image_stride, image_stride);
+        }
+    }
+
+    size_t first_page = pages.size();
+    for (size_t page = 0; page < packers.size(); page++) {
+        Image page_image = {
+            pixels[page].data(),
+            packers[page].get_width(),
+            packers[page].get_used_height(),
+            1,
+            PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+        pages.push_back(LoadTextureFromImage(page_image));
+        atlas_stats.page_pixels +=
+            static_cast<size_t>(page_image.width) * page_image.height;
+    }
+
+    for (size_t i = 0; i < unpacked.size(); i++) {
+        auto& [key, image] = unpacked[i];
+        const Placement& placement = placements[i];
+        regions[key] = {
+            &pages[first_page + placement.page],
+            {static_cast<float>(placement.x),
+             static_cast<float>(placement.y),
+             static_cast<float>(image.width),
+             static_cast<float>(image.height)},
+            next_source_id++};
+        atlas_stats.used_pixels += static_cast<size_t>(image.width) * image.height;
+        are_region_ids_outdated = true;
+        UnloadImage(image);
+    }
+
+    atlas_stats.pages = pages.size();
+    atlas_stats.sprites += unpacked.size();
+    spdlog::info(
+        "Packed {} sprites into {} atlas pages, {:.1f}% occupied",
+        unpacked.size(),
+        packers.size(),
+        atlas_stats.get_occupancy() * 100.0f);
+    unpacked.clear();
+}
+
+const AtlasRegion* SpriteStorage::get_region(const std::string& key) {
+    auto it = regions.find(key);
+    if (it != regions.end()) {
+        return &it->second;
+    }
 
-Sound SoundStorage::load_data(const std::string &path) {
-    return LoadSound(path.c_str());
+    // Not packed, thus it's a whole texture of its own. That throws if there
+    // is no such texture either.
+    AtlasRegion region = make_whole_region((*this)[key]);
+    are_region_ids_outdated = true;
+    return &regions.emplace(key, region).first->second;
+}
+
+const AtlasRegion* SpriteStorage::get_region(AssetId id) {
+    if (are_region_ids_outdated) {
+        region_ids.clear();
+        region_ids.reserve(regions.size());
+        for (const auto& named_region : regions) {
+            region_ids.add(AssetId(named_region.first), &named_region);
+        }
+        region_ids.build([](const NamedRegion* a, const NamedRegion* b) {
+            spdlog::error(
+                "Ids of {} and {} collide, one of these should be renamed",
+                a->first,
+                b->first);
+        });
+        are_region_ids_outdated = false;
+    }
+
+    const NamedRegion* const* region = region_ids.find(id);
+    if (region != nullptr) {
+        return &(*region)->second;
+    }
+
+    // Not packed or not looked up yet - going through name, which makes its
+    // region and gets ids rebuilt on the next call
+    AssetRecord<Texture2D>* record = find_record(id);
+    if (record == nullptr) {
+        throw std::out_of_range("No sprite with such id");
+    }
+    return get_region(record->key);
+}
+
+void SpriteStorage::clear() {
+    AsyncStorage<Texture2D, Image>::clear();
+    for (auto& [_, image] : unpacked) {
+        UnloadImage(image);
+    }
+    unpacked.clear();
+    for (const auto& page : pages) {
+        UnloadTexture(page);
+    }
+    pages.clear();
+    regions.clear();
+    region_ids.clear();
+    are_region_ids_outdated = false;
+    atlas_stats = {};
+}
+
+
+Wave SoundStorage::decode_data(const std::string &path) {
+    return LoadWave(path.c_str());
+}
+
+Wave SoundStorage::decode_packed_data(
+    const PackData& data, const std::string& extension) {
+    return LoadWaveFromMemory(
+        extension.c_str(), data.get_data(), static_cast<int>(data.get_size()));
+}
+
+bool SoundStorage::is_decoded(const Wave& data) {
+    return data.data != nullptr;
+}
+
+Sound SoundStorage::finalize_data(Wave data) {
+    Sound sound = LoadSoundFromWave(data);
+    UnloadWave(data);
+    return sound;
+}
+
+void SoundStorage::discard_data(Wave data) {
+    UnloadWave(data);
 }
 
 void SoundStorage::unload_data(Sound data) {
     UnloadSound(data);
 }
 
+// Sounds are converted to format of audio device, which is what stream says
+size_t SoundStorage::get_data_size(const Sound& data) {
+    return static_cast<size_t>(data.frameCount) * data.stream.channels *
+           data.stream.sampleSize / 8;
+}
+
 SoundStorage::~SoundStorage() {
     clear();
 }
 
 
-// Idk if its good idea to keep all streams in memory. But will do for now. TODO
+MusicStorage::MusicStorage() {
+    set_budget(4);
+}
+
 Music MusicStorage::load_data(const std::string &path) {
     return LoadMusicStream(path.c_str());
 }
 
+// Stored files get streamed right from mapped pack
+Music MusicStorage::load_packed_data(PackData data, const std::string& extension) {
+    Music music = LoadMusicStreamFromMemory(
+        extension.c_str(), data.get_data(), static_cast<int>(data.get_size()));
+    if (!data.is_in_place() && music.ctxData != nullptr) {
+        packed_buffers.emplace(music.ctxData, std::move(data));
+    }
+    return music;
+}
+
 void MusicStorage::unload_data(Music data) {
     UnloadMusicStream(data);
+    packed_buffers.erase(data.ctxData);
+}
+
+size_t MusicStorage::get_data_size(const Music&) {
+    return 1;
+}
+
+size_t MusicStorage::get_budgeted_size() const {
+    return get_unused_size();
+}
+
+// Managers keep copies of playing music, thus closing it would pull stream
+// from under them
+bool MusicStorage::is_evictable(const Music& data) {
+    return !IsMusicStreamPlaying(data);
+}
+
+void MusicStorage::load(const std::string& path, const std::string& extension) {
+    index(path, extension);
+}
+
+void MusicStorage::load_pack(
+    const AssetPack& pack, const std::string& directory, const std::string& extension) {
+    index_pack(pack, directory, extension);
+}
+
+void MusicStorage::set_max_open_streams(size_t amount) {
+    set_budget(amount);
+}
+
+void MusicStorage::set_idle_timeout(float seconds) {
+    idle_timeout = std::chrono::duration<float>(seconds);
+}
+
+void MusicStorage::update() {
+    size_t amount = evict_idle(idle_timeout);
+    if (amount > 0) {
+        spdlog::debug("Closed {} idle music streams", amount);
+    }
+}
+
+MemoryUsage MusicStorage::get_memory_usage() const {
+    MemoryUsage usage = {0, get_open_streams()};
+    for (const auto& [_, buffer] : packed_buffers) {
+        usage.bytes += buffer.get_size();
+    }
+    return usage;
 }
 
 MusicStorage::~MusicStorage() {
     clear();
 }
+
+void MusicStorage::clear() {
+    Storage<Music>::clear();
+    packed_buffers.clear();
+}
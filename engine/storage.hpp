@@ -1,34 +1,375 @@
 #pragma once
 
+#include "asset_id.hpp"
+#include "asset_pack.hpp"
+#include "atlas.hpp"
+#include "decoded_cache.hpp"
+#include "file_watcher.hpp"
+#include "memory_stats.hpp"
 #include "raylib.h"
+#include "spdlog/spdlog.h"
+#include "workers.hpp"
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include <functional>
 
 
+// Bookkeeping of single storage item: where to load it from, how much memory
+// it takes and who uses it
+template <typename T> struct AssetRecord {
+    std::string key;
+    // Either path of file, or entry of pack
+    std::string path;
+    const AssetPack* pack = nullptr;
+    const AssetPack::Entry* entry = nullptr;
+    std::string extension;
+
+    bool is_loaded = false;
+    // Item within storage, while it's loaded
+    const T* data = nullptr;
+    // Pinned items have been handed out as raw pointers, thus never get evicted
+    bool is_pinned = false;
+    size_t size = 0;
+    int references = 0;
+    // Position among unreferenced items, if it's there, and since when
+    bool is_unused = false;
+    typename std::list<AssetRecord*>::iterator unused_pos;
+    std::chrono::steady_clock::time_point released_at;
+};
+
+template <typename T> class Storage;
+
+// Reference-counted pointer to storage item. Item stays loaded for as long as
+// any handle to it exists, and may be evicted after the last one is gone.
+// Main thread only, and handles must be gone before storage is cleared.
+template <typename T> class AssetHandle {
+private:
+    Storage<T>* storage = nullptr;
+    AssetRecord<T>* record = nullptr;
+    const T* data = nullptr;
+
+    void release() {
+        if (record != nullptr) {
+            storage->release(*record);
+        }
+        storage = nullptr;
+        record = nullptr;
+        data = nullptr;
+    }
+
+public:
+    AssetHandle() = default;
+
+    AssetHandle(Storage<T>* _storage, AssetRecord<T>* _record, const T* _data)
+        : storage(_storage)
+        , record(_record)
+        , data(_data) {
+        record->references++;
+    }
+
+    AssetHandle(const AssetHandle& other)
+        : storage(other.storage)
+        , record(other.record)
+        , data(other.data) {
+        if (record != nullptr) {
+            record->references++;
+        }
+    }
+
+    AssetHandle(AssetHandle&& other) noexcept
+        : storage(other.storage)
+        , record(other.record)
+        , data(other.data) {
+        other.storage = nullptr;
+        other.record = nullptr;
+        other.data = nullptr;
+    }
+
+    AssetHandle& operator=(AssetHandle other) noexcept {
+        std::swap(storage, other.storage);
+        std::swap(record, other.record);
+        std::swap(data, other.data);
+        return *this;
+    }
+
+    ~AssetHandle() {
+        release();
+    }
+
+    const T* get() const {
+        return data;
+    }
+
+    const T& operator*() const {
+        return *data;
+    }
+
+    const T* operator->() const {
+        return data;
+    }
+
+    explicit operator bool() const {
+        return data != nullptr;
+    }
+};
+
 template <typename T> class Storage {
+    friend class AssetHandle<T>;
+
+private:
+    std::unordered_map<std::string, AssetRecord<T>> records;
+    // Loaded items without handles, least recently used first
+    std::list<AssetRecord<T>*> unused;
+    size_t budget = std::numeric_limits<size_t>::max();
+    size_t resident_size = 0;
+    // Part of that taken by unused items
+    size_t unused_size = 0;
+
+    // Records by ids. Gets rebuilt on first lookup after new records appear,
+    // which is usually once - after everything has been loaded or indexed.
+    AssetIdTable<AssetRecord<T>*> ids;
+    bool are_ids_outdated = false;
+
+    AssetRecord<T>& get_record(const std::string& key) {
+        auto [it, is_new] = records.try_emplace(key);
+        if (is_new) {
+            it->second.key = key;
+            are_ids_outdated = true;
+        }
+        return it->second;
+    }
+
+    void build_ids() {
+        ids.clear();
+        ids.reserve(records.size());
+        for (auto& [key, record] : records) {
+            ids.add(AssetId(key), &record);
+        }
+        ids.build([](const AssetRecord<T>* a, const AssetRecord<T>* b) {
+            spdlog::error(
+                "Ids of {} and {} collide, one of these should be renamed",
+                a->key,
+                b->key);
+        });
+        are_ids_outdated = false;
+    }
+
+    void forget_unused(AssetRecord<T>& record) {
+        if (record.is_unused) {
+            unused.erase(record.unused_pos);
+            record.is_unused = false;
+            unused_size -= record.size;
+        }
+    }
+
+    // Load indexed item, if it isn't there yet
+    const T* load_record(AssetRecord<T>& record) {
+        if (!record.is_loaded) {
+            if (record.pack == nullptr && record.path.empty()) {
+                // Evicted item that hasn't been indexed, there is nothing to
+                // load it from
+                return nullptr;
+            }
+            if (record.pack != nullptr) {
+                T item = {};
+                bool is_loaded =
+                    load_pack_entry(*record.pack, *record.entry, record.extension, item);
+                if (!is_loaded) {
+                    return nullptr;
+                }
+                put_item(record.key, item, false);
+            }
+            else {
+                put_item(record.key, load_data(record.path), false);
+            }
+        }
+        return record.data;
+    }
+
+    // Load and pin item, since pointer to it is about to be handed out
+    const T* pin_record(AssetRecord<T>& record) {
+        if (!record.is_pinned) {
+            forget_unused(record);
+            record.is_pinned = true;
+        }
+        return load_record(record);
+    }
+
+    AssetHandle<T> acquire_record(AssetRecord<T>& record) {
+        forget_unused(record);
+        // Referencing it first, so loading doesn't evict it right away
+        record.references++;
+        const T* data = load_record(record);
+        record.references--;
+        if (data == nullptr) {
+            return {};
+        }
+        return AssetHandle<T>(this, &record, data);
+    }
+
+    void release(AssetRecord<T>& record) {
+        record.references--;
+        if (record.references == 0 && record.is_loaded && !record.is_pinned) {
+            unused.push_back(&record);
+            record.unused_pos = std::prev(unused.end());
+            record.is_unused = true;
+            record.released_at = std::chrono::steady_clock::now();
+            unused_size += record.size;
+            trim();
+        }
+    }
+
+    // Unload unused item. Returns next unused one.
+    typename std::list<AssetRecord<T>*>::iterator evict(
+        typename std::list<AssetRecord<T>*>::iterator position) {
+        AssetRecord<T>* record = *position;
+        record->is_unused = false;
+        record->is_loaded = false;
+        record->data = nullptr;
+        resident_size -= record->size;
+        unused_size -= record->size;
+        record->size = 0;
+
+        auto it = items.find(record->key);
+        unload_data(it->second);
+        items.erase(it);
+        return unused.erase(position);
+    }
+
 protected:
     std::unordered_map<std::string, T> items;
 
+    // Directories items have been loaded or indexed from, with extensions of
+    // their files
+    std::vector<std::pair<std::string, std::string>> source_directories;
+
+    // Record with that id, or nullptr
+    AssetRecord<T>* find_record(AssetId id) {
+        if (are_ids_outdated) {
+            build_ids();
+        }
+        AssetRecord<T>* const* record = ids.find(id);
+        return record != nullptr ? *record : nullptr;
+    }
+
     // Data loader. Pure-virtual, implementation-dependant.
     // Designed to wrap calls to raylib functions, but may work differently.
     virtual T load_data(const std::string &path) = 0;
 
+    // Same, but for file taken from AssetPack. Extension tells what kind of file
+    // that is. Data may be taken over - say, if it needs to outlive the call.
+    virtual T load_packed_data(PackData data, const std::string& extension) = 0;
+
+    // Unpack and load file from pack. False if it can't be unpacked.
+    virtual bool load_pack_entry(
+        const AssetPack& pack,
+        const AssetPack::Entry& entry,
+        const std::string& extension,
+        T& item) {
+        PackData data = pack.read(entry);
+        if (!data.is_valid()) {
+            return false;
+        }
+        item = load_packed_data(std::move(data), extension);
+        return true;
+    }
+
     // Data unloader. Same as above, but not pure-virtual to avoid UB
     // Not quite sure if it work rn tho. TODO
     virtual void unload_data(T) {}
 
+    // Memory item takes (say, in vram), counted against budget
+    virtual size_t get_data_size(const T&) {
+        return 0;
+    }
+
+    // Whether unused item may be unloaded right now. Items that can't be
+    // keep their place among unused ones, and get evicted once they can.
+    virtual bool is_evictable(const T&) {
+        return true;
+    }
+
+    // Size that is kept within budget. Everything loaded, by default.
+    virtual size_t get_budgeted_size() const {
+        return resident_size;
+    }
+
+    size_t get_unused_size() const {
+        return unused_size;
+    }
+
+    // Evict unused items, least recently used first, until everything fits
+    // into budget
+    void trim() {
+        for (auto it = unused.begin();
+             get_budgeted_size() > budget && it != unused.end();) {
+            it = is_evictable(*(*it)->data) ? evict(it) : std::next(it);
+        }
+    }
+
+    // Put loaded item into storage, replacing previous one with the same key.
+    // Items loaded eagerly should be pinned, since these have been around
+    // before handles - and thus may be used without them.
+    void put_item(const std::string& key, T data, bool pin) {
+        AssetRecord<T>& record = get_record(key);
+        if (pin) {
+            forget_unused(record);
+            record.is_pinned = true;
+        }
+        auto it = items.find(key);
+        if (it != items.end()) {
+            unload_data(it->second);
+            resident_size -= record.size;
+            if (record.is_unused) {
+                unused_size -= record.size;
+            }
+        }
+
+        T& item = items[key];
+        item = data;
+        record.is_loaded = true;
+        // Map nodes don't move, thus that stays valid until item is erased
+        record.data = &item;
+        record.size = get_data_size(data);
+        resident_size += record.size;
+        if (record.is_unused) {
+            unused_size += record.size;
+        }
+        trim();
+    }
+
 public:
     virtual ~Storage() = default;
 
     // Unload all data and clear storage.
     // Should be called in destructor automatically, but can also be used manually.
     virtual void clear() {
+        for (const auto& [key, record] : records) {
+            if (record.references > 0) {
+                spdlog::warn("{} is being cleared while still in use", key);
+            }
+        }
         for (const auto &kv: items) {
             unload_data(kv.second);
         }
         items.clear();
+        source_directories.clear();
+        records.clear();
+        unused.clear();
+        ids.clear();
+        are_ids_outdated = false;
+        resident_size = 0;
+        unused_size = 0;
     }
 
     // TODO: return tuple of files found and files successfully loaded
@@ -43,45 +384,679 @@ public:
             extension.c_str(),
             false
         );
+        source_directories.push_back({path, extension});
 
         for (auto current = 0ul; current < files.count; current++) {
             std::string name_key(GetFileNameWithoutExt(files.paths[current]));
-            items[name_key] = load_data(files.paths[current]);
+            put_item(name_key, load_data(files.paths[current]), true);
+        }
+
+        UnloadDirectoryFiles(files);
+    }
+
+    // Same as load(), but files are taken from directory within pack. Keys are
+    // the same as these would be with unpacked files.
+    virtual void load_pack(
+        const AssetPack& pack,
+        const std::string& directory,
+        const std::string& extension) {
+        pack.for_each_file(directory, extension, [&](const AssetPack::Entry& entry) {
+            T item = {};
+            if (load_pack_entry(pack, entry, extension, item)) {
+                put_item(AssetPack::get_stem(pack.get_name(entry)), item, true);
+            }
+        });
+    }
+
+    // Remember where files are, without loading anything. These get loaded
+    // on first acquire() (or operator[]) instead.
+    void index(const std::string& path, const std::string& extension) {
+        FilePathList files = LoadDirectoryFilesEx(path.c_str(), extension.c_str(), false);
+        source_directories.push_back({path, extension});
+
+        for (auto current = 0ul; current < files.count; current++) {
+            AssetRecord<T>& record =
+                get_record(GetFileNameWithoutExt(files.paths[current]));
+            record.path = files.paths[current];
+            record.pack = nullptr;
+            record.entry = nullptr;
         }
 
         UnloadDirectoryFiles(files);
     }
 
+    // Same, but for files within pack. Pack must outlive storage.
+    void index_pack(
+        const AssetPack& pack,
+        const std::string& directory,
+        const std::string& extension) {
+        pack.for_each_file(directory, extension, [&](const AssetPack::Entry& entry) {
+            AssetRecord<T>& record =
+                get_record(AssetPack::get_stem(pack.get_name(entry)));
+            record.pack = &pack;
+            record.entry = &entry;
+            record.extension = extension;
+        });
+    }
+
+    // Handle to item, loading it if needed. Empty handle if there is no such
+    // item, or it can't be loaded.
+    AssetHandle<T> acquire(const std::string& key) {
+        auto it = records.find(key);
+        if (it == records.end()) {
+            spdlog::warn("Unable to acquire {}: no such item", key);
+            return {};
+        }
+        return acquire_record(it->second);
+    }
+
+    AssetHandle<T> acquire(AssetId id) {
+        AssetRecord<T>* record = find_record(id);
+        if (record == nullptr) {
+            spdlog::warn("Unable to acquire {:#x}: no such item", id.get_value());
+            return {};
+        }
+        return acquire_record(*record);
+    }
+
+    // Memory limit of items without handles, in whatever get_data_size() counts.
+    // Unused items get evicted once everything takes more than that.
+    void set_budget(size_t _budget) {
+        budget = _budget;
+        trim();
+    }
+
+    size_t get_budget() const {
+        return budget;
+    }
+
+    // Evict unused items that haven't been used for longer than timeout, and
+    // whatever doesn't fit into budget. Returns how many items have been evicted.
+    size_t evict_idle(std::chrono::duration<float> timeout) {
+        size_t amount = items.size();
+        auto now = std::chrono::steady_clock::now();
+        // Items become unused in order, thus the oldest ones are first
+        for (auto it = unused.begin(); it != unused.end();) {
+            if (now - (*it)->released_at < timeout) {
+                break;
+            }
+            it = is_evictable(*(*it)->data) ? evict(it) : std::next(it);
+        }
+        trim();
+        return amount - items.size();
+    }
+
+    size_t get_resident_size() const {
+        return resident_size;
+    }
+
+    // Memory taken by loaded items, for MemoryStats. Same as resident size,
+    // unless get_data_size() counts something other than bytes.
+    virtual MemoryUsage get_memory_usage() const {
+        return {resident_size, items.size()};
+    }
+
+    bool is_loaded(const std::string& key) const {
+        return items.find(key) != items.end();
+    }
+
     // Returns not actual content, but constant pointer to it, to refrain from
-    // copying large data chunks around
+    // copying large data chunks around. Since there is no telling how long
+    // pointer is kept, indexed items get loaded and pinned - never evicted.
     const T* operator[](const std::string& key) {
+        auto it = records.find(key);
+        if (it != records.end()) {
+            pin_record(it->second);
+        }
+
         // Using .at() and not [] there, because default implementation of []
         // makes it hard to debug things - instead of throwing an error on
         // non-existing value, it will return something weird
         return &items.at(key);
     }
+
+    // Same, but returns nullptr instead of throwing if there is no such item
+    // (say, it's still being loaded in background). Doesn't load anything, but
+    // pins what is loaded - it's a raw pointer all the same.
+    const T* try_get(const std::string& key) {
+        auto it = items.find(key);
+        if (it == items.end()) {
+            return nullptr;
+        }
+        auto record = records.find(key);
+        if (record != records.end()) {
+            pin_record(record->second);
+        }
+        return &it->second;
+    }
+
+    // Same as these, but without hashing strings and going through map
+    const T* operator[](AssetId id) {
+        AssetRecord<T>* record = find_record(id);
+        const T* data = record != nullptr ? pin_record(*record) : nullptr;
+        if (data == nullptr) {
+            throw std::out_of_range("No loaded item with such id");
+        }
+        return data;
+    }
+
+    const T* try_get(AssetId id) {
+        AssetRecord<T>* record = find_record(id);
+        if (record == nullptr || record->data == nullptr) {
+            return nullptr;
+        }
+        return pin_record(*record);
+    }
+};
+
+// Storage that can load files in background.
+// Loading is split in two: decode_data() reads file and decodes it into D (say,
+// Image), and runs on workers. finalize_data() turns that into T (say, Texture2D)
+// and runs on main thread, since gpu can't be touched from anywhere else. Main
+// thread calls finalize() each frame with time budget, thus loading screen
+// keeps drawing while assets trickle in.
+template <typename T, typename D> class AsyncStorage : public Storage<T> {
+private:
+    struct Decoded {
+        std::string key;
+        std::string path;
+        D data;
+        bool is_valid;
+        // Changed file of item that's already there
+        bool is_reload;
+    };
+
+    // Shared with workers
+    std::mutex mutex;
+    std::condition_variable has_finished;
+    std::deque<Decoded> decoded;
+    size_t in_flight = 0;
+
+    // Main thread only
+    size_t requested = 0;
+    size_t finished = 0;
+
+    DecodedCache* cache = nullptr;
+
+    // Hot reload, main thread only
+    bool is_hot_reload_enabled = false;
+    FileWatcher watcher;
+    // Indices of source directories, by ids of these within watcher
+    std::unordered_map<int, size_t> watched_directories;
+    // How many of source directories are watched already
+    size_t watched_amount = 0;
+
+    // Decoded data from cache, if it's there. Else whatever decode() returns,
+    // which gets cached for the next time.
+    template <typename F> D decode_cached(const CacheSource& source, F decode) {
+        D data = {};
+        if (cache != nullptr && cache->read(source, data)) {
+            return data;
+        }
+        data = decode();
+        if (cache != nullptr && is_decoded(data)) {
+            cache->write(source, data);
+        }
+        return data;
+    }
+
+    // Decode changed file again, for reload_data()
+    void reload_file(const std::string& file_path) {
+        std::string name_key(GetFileNameWithoutExt(file_path.c_str()));
+        submit_decode(
+            name_key,
+            file_path,
+            [this, file_path]() {
+                return decode_cached(CacheSource::from_file(file_path), [&]() {
+                    return decode_data(file_path);
+                });
+            },
+            true);
+    }
+
+    void wait_for_workers() {
+        std::unique_lock<std::mutex> lock(mutex);
+        has_finished.wait(lock, [this]() { return in_flight == 0; });
+    }
+
+    // Run decode() on workers, and queue its result for finalize(). Reloads
+    // don't count as requested files, so they don't show up on loading screens.
+    template <typename F>
+    void submit_decode(
+        const std::string& name_key,
+        const std::string& file_path,
+        F decode,
+        bool is_reload = false) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            in_flight++;
+        }
+        if (!is_reload) {
+            requested++;
+        }
+
+        get_worker_pool().submit([this, name_key, file_path, decode, is_reload]() {
+            D data = decode();
+            bool is_valid = is_decoded(data);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            decoded.push_back({name_key, file_path, data, is_valid, is_reload});
+            in_flight--;
+            has_finished.notify_all();
+        });
+    }
+
+protected:
+    // Runs on workers, thus must not touch gpu, audio device or storage itself
+    virtual D decode_data(const std::string& path) = 0;
+    virtual D decode_packed_data(const PackData& data, const std::string& extension) = 0;
+    // Whether decoding went fine
+    virtual bool is_decoded(const D& data) = 0;
+    // Runs on main thread. Takes ownership of data.
+    virtual T finalize_data(D data) = 0;
+    // Free decoded data that won't be finalized
+    virtual void discard_data(D data) = 0;
+
+    T load_data(const std::string& path) override {
+        return finalize_data(decode_cached(CacheSource::from_file(path), [&]() {
+            return decode_data(path);
+        }));
+    }
+
+    T load_packed_data(PackData data, const std::string& extension) override {
+        return finalize_data(decode_packed_data(data, extension));
+    }
+
+    // Same as default one, but goes through cache - and doesn't unpack file
+    // at all if it's there
+    bool load_pack_entry(
+        const AssetPack& pack,
+        const AssetPack::Entry& entry,
+        const std::string& extension,
+        T& item) override {
+        bool is_unpacked = true;
+        D data = decode_cached(CacheSource::from_pack(pack, entry), [&]() {
+            PackData packed = pack.read(entry);
+            is_unpacked = packed.is_valid();
+            return is_unpacked ? decode_packed_data(packed, extension) : D{};
+        });
+        if (!is_unpacked) {
+            return false;
+        }
+        item = finalize_data(data);
+        return true;
+    }
+
+    // Runs on main thread, for each successfully decoded file. Finalizes data
+    // and puts it into storage, but may be overriden to do something else.
+    virtual void store_data(const std::string& key, D data) {
+        // Replaces (and unloads) the previous item with the same key, if any
+        Storage<T>::put_item(key, finalize_data(data), true);
+    }
+
+    // Runs on main thread, for each changed file that's been decoded again.
+    // Item gets replaced within the same map node, thus pointers to it stay
+    // valid and just see new contents. Items that aren't loaded are left
+    // alone, since they will be loaded from changed file anyway.
+    virtual void reload_data(const std::string& key, D data) {
+        if (!Storage<T>::is_loaded(key)) {
+            discard_data(data);
+            return;
+        }
+        Storage<T>::put_item(key, finalize_data(data), false);
+        spdlog::info("Reloaded {}", key);
+    }
+
+public:
+    // Workers may still hold pointer to storage, thus waiting for them. Derived
+    // storages should call clear() in their destructors, to free whatever has
+    // been decoded but not finalized.
+    ~AsyncStorage() override {
+        wait_for_workers();
+    }
+
+    void clear() override {
+        wait_for_workers();
+        for (auto& item : decoded) {
+            discard_data(item.data);
+        }
+        decoded.clear();
+        requested = 0;
+        finished = 0;
+        watcher.close();
+        watched_directories.clear();
+        watched_amount = 0;
+        Storage<T>::clear();
+    }
+
+    // Take decoded data from cache instead of decoding it, whenever it's there.
+    // Cache must outlive storage, and may be shared between storages.
+    void set_cache(DecodedCache* _cache) {
+        wait_for_workers();
+        cache = _cache;
+    }
+
+    // Same as load(), but files get decoded on workers. Items appear in
+    // storage as finalize() gets to them.
+    void load_async(const std::string& path, const std::string& extension) {
+        FilePathList files = LoadDirectoryFilesEx(path.c_str(), extension.c_str(), false);
+        Storage<T>::source_directories.push_back({path, extension});
+
+        for (auto current = 0ul; current < files.count; current++) {
+            std::string file_path = files.paths[current];
+            std::string name_key(GetFileNameWithoutExt(files.paths[current]));
+            submit_decode(name_key, file_path, [this, file_path]() {
+                return decode_cached(CacheSource::from_file(file_path), [&]() {
+                    return decode_data(file_path);
+                });
+            });
+        }
+
+        UnloadDirectoryFiles(files);
+    }
+
+    // Same as load_pack(), but in background. Pack must stay open until
+    // loading is done. Unpacking deflated files happens on workers too.
+    void load_pack_async(
+        const AssetPack& pack,
+        const std::string& directory,
+        const std::string& extension) {
+        pack.for_each_file(directory, extension, [&](const AssetPack::Entry& entry) {
+            std::string file_path(pack.get_name(entry));
+            const AssetPack* source = &pack;
+            const AssetPack::Entry* packed = &entry;
+            submit_decode(
+                AssetPack::get_stem(file_path),
+                file_path,
+                [this, source, packed, extension]() {
+                    CacheSource cache_source = CacheSource::from_pack(*source, *packed);
+                    return decode_cached(cache_source, [&]() {
+                        PackData data = source->read(*packed);
+                        if (!data.is_valid()) {
+                            return D{};
+                        }
+                        return decode_packed_data(data, extension);
+                    });
+                });
+        });
+    }
+
+    // Turn decoded files into items, until budget (in seconds) runs out. At
+    // least one file gets finalized per call, if there is any, so loading
+    // never stalls. Returns amount of finalized files.
+    size_t finalize(float budget) {
+        using Clock = std::chrono::steady_clock;
+        auto start = Clock::now();
+        size_t amount = 0;
+
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (decoded.empty()) {
+                break;
+            }
+            Decoded item = std::move(decoded.front());
+            decoded.pop_front();
+            lock.unlock();
+
+            if (!item.is_valid) {
+                spdlog::warn("Unable to load {}", item.path);
+                discard_data(item.data);
+            }
+            else if (item.is_reload) {
+                reload_data(item.key, item.data);
+            }
+            else {
+                store_data(item.key, item.data);
+            }
+            if (!item.is_reload) {
+                finished++;
+            }
+            amount++;
+
+            std::chrono::duration<float> elapsed = Clock::now() - start;
+            if (elapsed.count() >= budget) {
+                break;
+            }
+        }
+
+        return amount;
+    }
+
+    // Watch directories that items are loaded (or indexed) from, and reload
+    // files that change there. Meant for development - say, to see edited art
+    // without restarting. Packs aren't watched. Linux only, for now.
+    void enable_hot_reload() {
+        if (!FileWatcher::is_supported()) {
+            spdlog::warn("Hot reload isn't supported on this platform");
+            return;
+        }
+        is_hot_reload_enabled = true;
+    }
+
+    // Should be called each frame, with hot reload enabled. Starts decoding
+    // changed files on workers, then finalizes whatever's been decoded - thus
+    // items are swapped between frames, never while something's drawn.
+    size_t update_hot_reload(float budget) {
+        if (!is_hot_reload_enabled) {
+            return 0;
+        }
+
+        // Directories loaded since the last call
+        auto& directories = Storage<T>::source_directories;
+        for (; watched_amount < directories.size(); watched_amount++) {
+            const auto& [path, extension] = directories[watched_amount];
+            int id = watcher.watch(path);
+            if (id >= 0) {
+                watched_directories[id] = watched_amount;
+            }
+        }
+
+        for (const FileChange& change : watcher.poll()) {
+            auto it = watched_directories.find(change.directory);
+            if (it == watched_directories.end()) {
+                continue;
+            }
+            const auto& [path, extension] = directories[it->second];
+            // Changes got lost, thus everything there is reloaded - reload_data()
+            // skips whatever isn't loaded anyway
+            if (change.path.empty()) {
+                FilePathList files =
+                    LoadDirectoryFilesEx(path.c_str(), extension.c_str(), false);
+                for (auto current = 0ul; current < files.count; current++) {
+                    reload_file(files.paths[current]);
+                }
+                UnloadDirectoryFiles(files);
+            }
+            else if (IsFileExtension(change.path.c_str(), extension.c_str())) {
+                reload_file(change.path);
+            }
+        }
+
+        return finalize(budget);
+    }
+
+    // Block until everything requested with load_async() is finalized
+    void finish() {
+        wait_for_workers();
+        finalize(std::numeric_limits<float>::infinity());
+    }
+
+    // Amount of files requested with load_async(), and how many of these are
+    // done - either finalized or failed
+    size_t get_requested() {
+        return requested;
+    }
+
+    size_t get_finished() {
+        return finished;
+    }
+
+    // Within [0, 1], for loading screens
+    float get_progress() {
+        if (requested == 0) {
+            return 1.0f;
+        }
+        return static_cast<float>(finished) / static_cast<float>(requested);
+    }
+
+    bool is_loading() {
+        return finished < requested;
+    }
+};
+
+struct AtlasSettings {
+    // Width and height of atlas pages. Images larger than that get textures
+    // of their own.
+    int page_size = 2048;
+    int padding = 1;
 };
 
-class SpriteStorage : public Storage<Texture2D> {
+struct AtlasStats {
+    size_t pages = 0;
+    size_t sprites = 0;
+    // Pixels of packed images, and of pages they've been packed into
+    size_t used_pixels = 0;
+    size_t page_pixels = 0;
+
+    // Within [0, 1]
+    float get_occupancy() const {
+        if (page_pixels == 0) {
+            return 0.0f;
+        }
+        return static_cast<float>(used_pixels) / static_cast<float>(page_pixels);
+    }
+};
+
+class SpriteStorage : public AsyncStorage<Texture2D, Image> {
+private:
+    bool use_atlas = false;
+    AtlasSettings atlas_settings;
+
+    // Decoded images, waiting for build_atlas()
+    std::vector<std::pair<std::string, Image>> unpacked;
+    // Deque, since regions point into it
+    std::deque<Texture2D> pages;
+    std::unordered_map<std::string, AtlasRegion> regions;
+    // Regions by ids, rebuilt on lookup after new ones appear
+    using NamedRegion = std::pair<const std::string, AtlasRegion>;
+    AssetIdTable<const NamedRegion*> region_ids;
+    bool are_region_ids_outdated = false;
+    AtlasStats atlas_stats;
+    // Ids of packed sprites, for texture switch stats. Far above what gpu
+    // hands out, to not collide with actual textures.
+    unsigned int next_source_id = 1u << 31;
+
+    // Pages are plain rgba, thus images for these get converted right away
+    Image prepare_image(Image image);
+
 protected:
-    virtual Texture2D load_data(const std::string &path) override;
+    virtual Image decode_data(const std::string &path) override;
+    virtual Image decode_packed_data(
+        const PackData& data, const std::string& extension) override;
+    virtual bool is_decoded(const Image& data) override;
+    virtual Texture2D finalize_data(Image data) override;
+    virtual void discard_data(Image data) override;
     virtual void unload_data(Texture2D data) override;
+    virtual size_t get_data_size(const Texture2D& data) override;
+    virtual void store_data(const std::string& key, Image data) override;
+    virtual void reload_data(const std::string& key, Image data) override;
 public:
     ~SpriteStorage();
+
+    // Pack sprites loaded from now on into atlas pages. Must be called before
+    // loading anything. Packed sprites are only accessible with get_region() -
+    // operator[] has no textures of their own to return.
+    void enable_atlas(const AtlasSettings& settings);
+
+    // In atlas mode, these load everything and pack it right away
+    void load(const std::string &path, const std::string &extension) override;
+    void load_pack(
+        const AssetPack& pack,
+        const std::string& directory,
+        const std::string& extension) override;
+
+    // Pack images loaded since the last call into new pages and upload these.
+    // With load_async(), should be called once loading is done.
+    void build_atlas();
+
+    // Part of texture to draw for sprite, in atlas mode or not. Throws if
+    // there is no such sprite (or it isn't packed yet). Sprites loaded lazily
+    // never get packed, and get pinned like with operator[].
+    const AtlasRegion* get_region(const std::string& key);
+    const AtlasRegion* get_region(AssetId id);
+
+    AtlasStats get_atlas_stats() {
+        return atlas_stats;
+    }
+
+    // Textures of their own and atlas pages, plus images waiting for atlas
+    MemoryUsage get_memory_usage() const override;
+
+    void clear() override;
 };
 
-class SoundStorage : public Storage<Sound> {
+class SoundStorage : public AsyncStorage<Sound, Wave> {
 protected:
-    virtual Sound load_data(const std::string &path) override;
+    virtual Wave decode_data(const std::string &path) override;
+    virtual Wave decode_packed_data(
+        const PackData& data, const std::string& extension) override;
+    virtual bool is_decoded(const Wave& data) override;
+    virtual Sound finalize_data(Wave data) override;
+    virtual void discard_data(Wave data) override;
     virtual void unload_data(Sound data) override;
+    virtual size_t get_data_size(const Sound& data) override;
 public:
     ~SoundStorage();
 };
 
+// Each open stream holds decoder, buffers and file, thus these are only opened
+// once acquired. Files are indexed by load() and load_pack(), and streams
+// nobody holds handles to get closed once there are too many of them, or once
+// they've been idle for a while - but never while they are playing.
+// Handles should be kept for as long as stream is used, paused or not.
 class MusicStorage : public Storage<Music> {
+private:
+    // Music is streamed right from memory it's been loaded from, thus deflated
+    // packed files stay unpacked for as long as their streams are open
+    std::unordered_map<void*, PackData> packed_buffers;
+    std::chrono::duration<float> idle_timeout = std::chrono::seconds(30);
+
 protected:
     virtual Music load_data(const std::string &path) override;
+    virtual Music load_packed_data(PackData data, const std::string& extension) override;
     virtual void unload_data(Music data) override;
+    // Budget counts streams, not bytes
+    virtual size_t get_data_size(const Music& data) override;
+    // Streams in use don't count towards the limit
+    virtual size_t get_budgeted_size() const override;
+    virtual bool is_evictable(const Music& data) override;
 public:
+    MusicStorage();
     ~MusicStorage();
+
+    // These only index files
+    void load(const std::string& path, const std::string& extension) override;
+    void load_pack(
+        const AssetPack& pack,
+        const std::string& directory,
+        const std::string& extension) override;
+
+    // Streams open at once, not counting these that are in use
+    void set_max_open_streams(size_t amount);
+
+    void set_idle_timeout(float seconds);
+
+    // Close streams that have been idle for too long. Should be called each
+    // frame, or at least every now and then.
+    void update();
+
+    size_t get_open_streams() const {
+        return get_resident_size();
+    }
+
+    // Bytes of unpacked files streams play from. Decoders have buffers of their
+    // own, but there is no asking miniaudio how large these are.
+    MemoryUsage get_memory_usage() const override;
+
+    void clear() override;
 };
@@ -1,4 +1,5 @@
 #include "text.hpp"
+#include "atlas.hpp"
 #include "spdlog/spdlog.h"
 
 // Basic text
@@ -34,6 +35,7 @@ Rectangle Text::get_rect() {
 void Text::draw(Vector2 pos, Font font, int size, int spacing, Color color) {
     // Not DrawTextPro, since its matrix-based thingy
     // Would rather apply it as additional method to use on top of visual objects
+    count_texture_bind(font.texture.id, font.texture.id);
     DrawTextEx(font, txt.c_str(), pos, size, spacing, color);
 }
 
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "mapgen.hpp"
+#include "raylib.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Tile map geometry with sizes known at compile time.
+// TileMapBase keeps its sizes in runtime Points, thus each conversion between
+// world positions, tiles and grid indices costs a division or two. With sizes
+// as template arguments, tile sizes (which must be powers of two) turn these
+// into shifts, and map width turns into either shift (if its a power of two
+// too) or multiplication by constant.
+// Meant for hot loops - mouse picking, looking up tiles of entities, etc:
+//   using Geometry = TileGeometry<16, 16, 256, 256>;
+//   if (Geometry::matches(map)) {...}
+// Unlike TileMapBase, positions are rounded down - so these only agree for
+// positions within map.
+
+constexpr bool is_power_of_two(int value) {
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+constexpr int log2_of(int value) {
+    int result = 0;
+    while (value > 1) {
+        value >>= 1;
+        result++;
+    }
+    return result;
+}
+
+template <int TILE_WIDTH, int TILE_HEIGHT, int MAP_WIDTH, int MAP_HEIGHT>
+class TileGeometry {
+    static_assert(
+        is_power_of_two(TILE_WIDTH) && is_power_of_two(TILE_HEIGHT),
+        "Tile sizes must be powers of two");
+    static_assert(MAP_WIDTH > 0 && MAP_HEIGHT > 0, "Map must not be empty");
+
+private:
+    static constexpr int SHIFT_X = log2_of(TILE_WIDTH);
+    static constexpr int SHIFT_Y = log2_of(TILE_HEIGHT);
+
+public:
+    static constexpr Point TILE_SIZE = {TILE_WIDTH, TILE_HEIGHT};
+    static constexpr Point MAP_SIZE = {MAP_WIDTH, MAP_HEIGHT};
+    static constexpr size_t GRID_SIZE = static_cast<size_t>(MAP_WIDTH) * MAP_HEIGHT;
+
+    // Check that map has exactly these sizes, before using geometry with it
+    template <typename M> static bool matches(M& map) {
+        Point tile_size = map.get_tile_size();
+        Point map_size = map.get_map_size();
+        return tile_size.x == TILE_WIDTH && tile_size.y == TILE_HEIGHT &&
+               map_size.x == MAP_WIDTH && map_size.y == MAP_HEIGHT;
+    }
+
+    static constexpr bool is_tile_on_map(Point tile) {
+        // Negative values turn into huge unsigned ones, thus one check per axis
+        return static_cast<unsigned>(tile.x) < static_cast<unsigned>(MAP_WIDTH) &&
+               static_cast<unsigned>(tile.y) < static_cast<unsigned>(MAP_HEIGHT);
+    }
+
+    static bool is_vec_on_map(Vector2 vec) {
+        return 0.0f <= vec.x && vec.x < static_cast<float>(MAP_WIDTH * TILE_WIDTH) &&
+               0.0f <= vec.y && vec.y < static_cast<float>(MAP_HEIGHT * TILE_HEIGHT);
+    }
+
+    static constexpr size_t tile_to_index(Point tile) {
+        return static_cast<size_t>(tile.y) * MAP_WIDTH + tile.x;
+    }
+
+    static constexpr Point index_to_tile(size_t index) {
+        // Compilers turn these into shift and mask, or into multiplication
+        return {static_cast<int>(index % MAP_WIDTH), static_cast<int>(index / MAP_WIDTH)};
+    }
+
+    static Point vec_to_tile(Vector2 vec) {
+        return {
+            static_cast<int>(vec.x) >> SHIFT_X, static_cast<int>(vec.y) >> SHIFT_Y};
+    }
+
+    static size_t vec_to_index(Vector2 vec) {
+        return tile_to_index(vec_to_tile(vec));
+    }
+
+    static Vector2 tile_to_vec(Point tile) {
+        // Multiplying, since shifting negative values left is undefined. Its
+        // a shift either way, once compiled.
+        return {
+            static_cast<float>(tile.x * TILE_WIDTH),
+            static_cast<float>(tile.y * TILE_HEIGHT)};
+    }
+
+    static Vector2 index_to_vec(size_t index) {
+        return tile_to_vec(index_to_tile(index));
+    }
+
+    // Batch versions of the above. Plain loops over arrays, which compilers
+    // vectorize - way faster than calling conversions one by one, when there
+    // are hundreds of entities to look up.
+
+    static void vecs_to_tiles(const Vector2* vecs, Point* tiles, size_t amount) {
+        for (size_t i = 0; i < amount; i++) {
+            tiles[i] = vec_to_tile(vecs[i]);
+        }
+    }
+
+    static void vecs_to_indices(const Vector2* vecs, size_t* indices, size_t amount) {
+        for (size_t i = 0; i < amount; i++) {
+            indices[i] = vec_to_index(vecs[i]);
+        }
+    }
+
+    static void tiles_to_vecs(const Point* tiles, Vector2* vecs, size_t amount) {
+        for (size_t i = 0; i < amount; i++) {
+            vecs[i] = tile_to_vec(tiles[i]);
+        }
+    }
+
+    static void tiles_to_indices(const Point* tiles, size_t* indices, size_t amount) {
+        for (size_t i = 0; i < amount; i++) {
+            indices[i] = tile_to_index(tiles[i]);
+        }
+    }
+
+    static void indices_to_tiles(const size_t* indices, Point* tiles, size_t amount) {
+        for (size_t i = 0; i < amount; i++) {
+            tiles[i] = index_to_tile(indices[i]);
+        }
+    }
+};
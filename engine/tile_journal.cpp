@@ -0,0 +1,371 @@
+#include "tile_journal.hpp"
+
+#include <algorithm>
+
+// Log
+TileJournal::Log::Log(size_t indices_amount)
+    : pending((indices_amount + 63) / 64, 0) {
+}
+
+void TileJournal::Log::record(uint32_t index) {
+    uint64_t& word = pending[index / 64];
+    uint64_t bit = uint64_t(1) << (index % 64);
+    if ((word & bit) == 0) {
+        word |= bit;
+        entries.push_back(index);
+    }
+}
+
+void TileJournal::Log::record_run(uint32_t first, uint32_t amount) {
+    uint32_t last = first + amount;
+    while (first < last) {
+        uint32_t offset = first % 64;
+        uint32_t bits_amount = std::min<uint32_t>(64 - offset, last - first);
+        uint64_t mask = bits_amount == 64 ? ~uint64_t(0)
+                                          : ((uint64_t(1) << bits_amount) - 1) << offset;
+
+        uint64_t& word = pending[first / 64];
+        uint64_t fresh = mask & ~word;
+        word |= fresh;
+        // Usually either all of these are fresh or none are
+        for (uint32_t i = 0; i < bits_amount && fresh != 0; i++) {
+            if ((fresh >> (offset + i)) & 1) {
+                entries.push_back(first + i);
+            }
+        }
+
+        first += bits_amount;
+    }
+}
+
+void TileJournal::Log::mark_read() {
+    for (uint64_t position = horizon; position < get_end(); position++) {
+        uint32_t index = entries[position - base];
+        pending[index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+    horizon = get_end();
+}
+
+void TileJournal::Log::trim(uint64_t position) {
+    size_t amount = static_cast<size_t>(position - base);
+    // Erasing from the front is linear, thus only doing that once there is
+    // a good chunk to erase
+    if (amount == 0 || amount < entries.size() / 2) {
+        return;
+    }
+
+    // These may be unread by anyone (if the only subscriber has just left),
+    // thus their bits must be cleared too
+    for (uint64_t i = std::max(horizon, base); i < position; i++) {
+        uint32_t index = entries[i - base];
+        pending[index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+    horizon = std::max(horizon, position);
+
+    entries.erase(entries.begin(), entries.begin() + amount);
+    base = position;
+}
+
+void TileJournal::Log::drop() {
+    std::fill(pending.begin(), pending.end(), 0);
+    base = get_end();
+    horizon = base;
+    entries.clear();
+}
+
+// TileJournal
+TileJournal::TileJournal(int _width, int _height, int _chunk_size)
+    : width(std::max(_width, 1))
+    , tiles_amount(static_cast<size_t>(width) * std::max(_height, 0))
+    , chunk_size(std::max(_chunk_size, 1))
+    , chunks_x((width + chunk_size - 1) / chunk_size)
+    , tiles(tiles_amount)
+    , chunks(
+          static_cast<size_t>(chunks_x) *
+          ((std::max(_height, 0) + chunk_size - 1) / chunk_size))
+    , max_entries(std::max<size_t>(tiles_amount, 1024)) {
+}
+
+void TileJournal::overflow() {
+    for (auto& subscriber : subscribers) {
+        if (!subscriber.active) {
+            continue;
+        }
+        if (subscriber.tiles_cursor < tiles.get_end()) {
+            subscriber.overflown = true;
+        }
+    }
+
+    tiles.drop();
+    chunks.drop();
+    for (auto& subscriber : subscribers) {
+        subscriber.tiles_cursor = tiles.get_end();
+        subscriber.chunks_cursor = chunks.get_end();
+    }
+}
+
+void TileJournal::compact_history() {
+    // Dropping superseded changes once history has doubled since the last
+    // time, thus it's never more than twice of what is still relevant. Order
+    // is kept, so history stays sorted by revision.
+    if (history.size() > compacted_size * 2 + 1024) {
+        auto is_superseded = [this](const Change& change) {
+            auto first = tile_revisions.begin() + change.tile;
+            return std::find(first, first + change.amount, change.revision) ==
+                   first + change.amount;
+        };
+        history.erase(
+            std::remove_if(history.begin(), history.end(), is_superseded), history.end());
+        compacted_size = history.size();
+    }
+}
+
+void TileJournal::track_revisions() {
+    if (is_tracking_revisions) {
+        return;
+    }
+    is_tracking_revisions = true;
+    tile_revisions.assign(tiles_amount, 0);
+    everything_revision = revision;
+}
+
+void TileJournal::record(size_t grid_index) {
+    revision++;
+    if (is_tracking_revisions) {
+        tile_revisions[grid_index] = revision;
+        history.push_back({static_cast<uint32_t>(grid_index), 1, revision});
+        compact_history();
+    }
+
+    if (subscribers_amount == 0) {
+        return;
+    }
+
+    tiles.record(static_cast<uint32_t>(grid_index));
+    chunks.record(static_cast<uint32_t>(get_chunk_index(grid_index)));
+
+    if (tiles.entries.size() > max_entries) {
+        overflow();
+    }
+}
+
+void TileJournal::record_rect(int x, int y, int rect_width, int rect_height) {
+    if (rect_width <= 0 || rect_height <= 0) {
+        return;
+    }
+
+    // Whole rect shares one revision, as if it was a single change
+    revision++;
+    if (is_tracking_revisions) {
+        for (int row = y; row < y + rect_height; row++) {
+            size_t index = static_cast<size_t>(row) * width + x;
+            std::fill_n(tile_revisions.begin() + index, rect_width, revision);
+            history.push_back(
+                {static_cast<uint32_t>(index),
+                 static_cast<uint32_t>(rect_width),
+                 revision});
+        }
+        compact_history();
+    }
+
+    if (subscribers_amount == 0) {
+        return;
+    }
+
+    // No point to log what is going to be dropped right away
+    if (static_cast<size_t>(rect_width) * rect_height > max_entries) {
+        for (auto& subscriber : subscribers) {
+            subscriber.overflown = subscriber.active;
+        }
+        overflow();
+        return;
+    }
+
+    int first_chunk = x / chunk_size;
+    int last_chunk = (x + rect_width - 1) / chunk_size;
+    for (int row = y; row < y + rect_height; row++) {
+        size_t index = static_cast<size_t>(row) * width + x;
+        tiles.record_run(static_cast<uint32_t>(index), static_cast<uint32_t>(rect_width));
+
+        size_t chunks_row = static_cast<size_t>(row / chunk_size) * chunks_x;
+        for (int chunk = first_chunk; chunk <= last_chunk; chunk++) {
+            chunks.record(static_cast<uint32_t>(chunks_row + chunk));
+        }
+    }
+
+    if (tiles.entries.size() > max_entries) {
+        overflow();
+    }
+}
+
+void TileJournal::record_everything() {
+    revision++;
+    everything_revision = revision;
+    history.clear();
+    compacted_size = 0;
+
+    if (subscribers_amount == 0) {
+        return;
+    }
+
+    for (auto& subscriber : subscribers) {
+        subscriber.overflown = subscriber.active;
+    }
+    overflow();
+}
+
+size_t TileJournal::subscribe() {
+    Subscriber subscriber = {tiles.get_end(), chunks.get_end(), true, false};
+    subscribers_amount++;
+
+    // Reusing slots of ones who've left, so ids stay small
+    for (size_t id = 0; id < subscribers.size(); id++) {
+        if (!subscribers[id].active) {
+            subscribers[id] = subscriber;
+            return id;
+        }
+    }
+
+    subscribers.push_back(subscriber);
+    return subscribers.size() - 1;
+}
+
+void TileJournal::unsubscribe(size_t id) {
+    if (id >= subscribers.size() || !subscribers[id].active) {
+        return;
+    }
+
+    subscribers[id].active = false;
+    subscribers_amount--;
+    if (subscribers_amount == 0) {
+        tiles.drop();
+        chunks.drop();
+    }
+}
+
+TileChanges TileJournal::read(size_t id) {
+    TileChanges changes;
+    if (id >= subscribers.size() || !subscribers[id].active) {
+        return changes;
+    }
+
+    // Dropping what everyone has read first, since it moves entries around
+    uint64_t tiles_min = tiles.get_end();
+    uint64_t chunks_min = chunks.get_end();
+    for (auto& subscriber : subscribers) {
+        if (subscriber.active) {
+            tiles_min = std::min(tiles_min, subscriber.tiles_cursor);
+            chunks_min = std::min(chunks_min, subscriber.chunks_cursor);
+        }
+    }
+    tiles.trim(tiles_min);
+    chunks.trim(chunks_min);
+
+    Subscriber& subscriber = subscribers[id];
+    changes.everything = subscriber.overflown;
+    changes.tiles = tiles.entries.data() + (subscriber.tiles_cursor - tiles.base);
+    changes.tiles_amount = static_cast<size_t>(tiles.get_end() - subscriber.tiles_cursor);
+    changes.chunks = chunks.entries.data() + (subscriber.chunks_cursor - chunks.base);
+    changes.chunks_amount =
+        static_cast<size_t>(chunks.get_end() - subscriber.chunks_cursor);
+
+    subscriber.overflown = false;
+    subscriber.tiles_cursor = tiles.get_end();
+    subscriber.chunks_cursor = chunks.get_end();
+    tiles.mark_read();
+    chunks.mark_read();
+
+    return changes;
+}
+
+bool TileJournal::get_changes_since(uint64_t since, std::vector<size_t>& changed) {
+    changed.clear();
+    track_revisions();
+    if (since < everything_revision) {
+        return false;
+    }
+
+    auto first = std::upper_bound(
+        history.begin(), history.end(), since, [](uint64_t value, const Change& change) {
+            return value < change.revision;
+        });
+    for (auto it = first; it != history.end(); it++) {
+        // Only the last change of tile counts, so each one is reported once
+        for (size_t tile = it->tile; tile < it->tile + it->amount; tile++) {
+            if (tile_revisions[tile] == it->revision) {
+                changed.push_back(tile);
+            }
+        }
+    }
+    return true;
+}
+
+MemoryUsage TileJournal::get_memory_usage() const {
+    size_t bytes = sizeof(TileJournal);
+    for (const Log* log : {&tiles, &chunks}) {
+        bytes += get_capacity_bytes(log->entries) + get_capacity_bytes(log->pending);
+    }
+    bytes += get_capacity_bytes(subscribers) + get_capacity_bytes(tile_revisions) +
+             get_capacity_bytes(history);
+    return {bytes, tiles.entries.size() + chunks.entries.size()};
+}
+
+// TileJournalReader
+TileJournalReader::~TileJournalReader() {
+    follow(nullptr);
+}
+
+TileJournalReader::TileJournalReader(TileJournalReader&& other)
+    : journal(std::move(other.journal))
+    , id(other.id)
+    , is_fresh(other.is_fresh) {
+    other.journal = nullptr;
+}
+
+TileJournalReader& TileJournalReader::operator=(TileJournalReader&& other) {
+    if (this != &other) {
+        follow(nullptr);
+        journal = std::move(other.journal);
+        id = other.id;
+        is_fresh = other.is_fresh;
+        other.journal = nullptr;
+    }
+    return *this;
+}
+
+void TileJournalReader::follow(std::shared_ptr<TileJournal> _journal) {
+    if (journal != nullptr) {
+        journal->unsubscribe(id);
+    }
+    journal = std::move(_journal);
+    is_fresh = journal != nullptr;
+    if (journal != nullptr) {
+        id = journal->subscribe();
+    }
+}
+
+TileChanges TileJournalReader::read() {
+    if (journal == nullptr) {
+        return {};
+    }
+    TileChanges changes = journal->read(id);
+    if (is_fresh) {
+        changes.everything = true;
+        is_fresh = false;
+    }
+    return changes;
+}
+
+TileChanges TileJournalReader::read(const std::shared_ptr<TileJournal>& current) {
+    if (current != journal) {
+        follow(current);
+    }
+    return read();
+}
+
+void TileJournalReader::skip() {
+    if (journal != nullptr) {
+        journal->read(id);
+    }
+    is_fresh = false;
+}
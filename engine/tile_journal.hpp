@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include "memory_stats.hpp"
+#include <memory>
+#include <vector>
+
+// Journal of tile map changes.
+// Renderers, pathfinding grids, fov caches, save files and whatever else
+// mirrors map's state need to know which tiles have changed, to update only
+// these instead of rescanning whole map. Map records each changed tile here,
+// and each of these systems subscribes and reads changes at its own pace -
+// say, once per frame.
+// Changes are kept as a log of tile indices plus a log of coarser chunk
+// indices, both without duplicates among entries nobody has read yet.
+// Things that don't want to subscribe (say, ui that asks for map state once in
+// a while) can use revisions instead - each change bumps journal's revision,
+// and tiles changed after any given revision can be asked for. Revisions of
+// tiles are only tracked once someone asks for them, thus journal costs next
+// to nothing while nobody is reading it.
+
+// Changes subscriber hasn't seen yet. Pointers stay valid until the next
+// change gets recorded or subscriber reads journal again.
+struct TileChanges {
+    const uint32_t* tiles = nullptr;
+    size_t tiles_amount = 0;
+    const uint32_t* chunks = nullptr;
+    size_t chunks_amount = 0;
+    // Too much has changed while subscriber wasn't looking, thus journal has
+    // dropped details. Whole map should be treated as changed.
+    bool everything = false;
+
+    bool empty() const {
+        return tiles_amount == 0 && !everything;
+    }
+};
+
+class TileJournal {
+private:
+    // Log of changed tiles or chunks. Entries everyone has read get dropped
+    // from the front, thus base is position of the first one since journal
+    // has been created.
+    struct Log {
+        std::vector<uint32_t> entries;
+        uint64_t base = 0;
+        // Bits of indices that are already in the part of log nobody has read
+        // yet, thus don't need to be recorded again
+        std::vector<uint64_t> pending;
+        // Furthest point anyone has read log up to
+        uint64_t horizon = 0;
+
+        Log(size_t indices_amount);
+
+        uint64_t get_end() const {
+            return base + entries.size();
+        }
+
+        void record(uint32_t index);
+        // Same for indices from first up to first + amount, 64 at a time
+        void record_run(uint32_t first, uint32_t amount);
+        // Someone has read everything, thus all indices may be recorded again
+        void mark_read();
+        // Drop entries before position, if there are enough of these
+        void trim(uint64_t position);
+        void drop();
+    };
+
+    // Run of tiles and revision these have changed at. History keeps the last
+    // change of each tile, plus whatever superseded ones haven't been compacted
+    // away yet. Single tiles are runs of 1, bulk changes get a run per row.
+    struct Change {
+        uint32_t tile;
+        uint32_t amount;
+        uint64_t revision;
+    };
+
+    struct Subscriber {
+        uint64_t tiles_cursor;
+        uint64_t chunks_cursor;
+        bool active;
+        bool overflown;
+    };
+
+    int width;
+    size_t tiles_amount;
+    int chunk_size;
+    int chunks_x;
+
+    Log tiles;
+    Log chunks;
+
+    std::vector<Subscriber> subscribers;
+    size_t subscribers_amount = 0;
+    // Logs longer than that get dropped, and laggards get "everything" instead
+    size_t max_entries;
+
+    // Creation of journal counts as change of everything, since whatever has
+    // happened before it is unknown. Thus revision 0 is older than anything.
+    uint64_t revision = 1;
+    // Revision of the last change of each tile, and history of changes. Both
+    // are empty until track_revisions().
+    bool is_tracking_revisions = false;
+    std::vector<uint64_t> tile_revisions;
+    std::vector<Change> history;
+    // Size of history after the last compaction
+    size_t compacted_size = 0;
+    // Revision of the last record_everything(), or of the start of tracking
+    uint64_t everything_revision = 1;
+
+    // Forget all unread changes. Ones who haven't read these get "everything".
+    void overflow();
+    void compact_history();
+
+public:
+    TileJournal(int _width, int _height, int _chunk_size);
+
+    // Remember that tile has changed
+    void record(size_t grid_index);
+
+    // Remember that all tiles of rect have changed at once. Rect must be
+    // within map.
+    void record_rect(int x, int y, int rect_width, int rect_height);
+
+    // Whole map has changed (loaded from file, regenerated, etc)
+    void record_everything();
+
+    // Returns id to read changes with. Subscriber only gets changes recorded
+    // after subscription.
+    size_t subscribe();
+    void unsubscribe(size_t id);
+
+    // Get changes since the previous read, and mark these as seen. Tiles may
+    // repeat, if they've changed again after someone else has read them.
+    TileChanges read(size_t id);
+
+    int get_chunk_size() const {
+        return chunk_size;
+    }
+
+    size_t get_chunk_index(size_t grid_index) const {
+        size_t x = grid_index % width;
+        size_t y = grid_index / width;
+        return (y / chunk_size) * chunks_x + x / chunk_size;
+    }
+
+    // Increases with each recorded change. Cheap way to check if anything has
+    // happened at all.
+    uint64_t get_revision() const {
+        return revision;
+    }
+
+    // Start keeping revisions of tiles. Whatever has happened before counts
+    // as change of everything. Done by get_changes_since() on its first call,
+    // but may be called in advance to not get "everything" from it.
+    void track_revisions();
+
+    // Without tracking, all tiles count as changed at the current revision
+    uint64_t get_tile_revision(size_t grid_index) const {
+        if (!is_tracking_revisions) {
+            return revision;
+        }
+        return std::max(tile_revisions[grid_index], everything_revision);
+    }
+
+    // Fill changed with indices of tiles changed after revision since, each
+    // one once, in order of their last change. Returns false if whole map has
+    // changed since then - changed is left empty in that case.
+    bool get_changes_since(uint64_t since, std::vector<size_t>& changed);
+
+    // Logs, history and revisions of tiles. Amount is of unread log entries.
+    MemoryUsage get_memory_usage() const;
+};
+
+// Subscription to journal, for things that mirror map and read its changes
+// every now and then. Holds journal alive, thus may outlive map. Changes made
+// before journal has been followed are unknown, thus the first read after
+// follow() reports everything.
+class TileJournalReader {
+private:
+    std::shared_ptr<TileJournal> journal;
+    size_t id = 0;
+    bool is_fresh = false;
+
+public:
+    TileJournalReader() = default;
+    ~TileJournalReader();
+
+    TileJournalReader(TileJournalReader&& other);
+    TileJournalReader& operator=(TileJournalReader&& other);
+    TileJournalReader(const TileJournalReader&) = delete;
+    TileJournalReader& operator=(const TileJournalReader&) = delete;
+
+    // Subscribe to journal, dropping the previous one. nullptr just unsubscribes.
+    void follow(std::shared_ptr<TileJournal> _journal);
+
+    // Changes since the previous read. Nothing, if there is no journal.
+    TileChanges read();
+    // Same, but follows current journal first, if it's not the one already
+    // followed. Handy to pass map's get_journal() there each time.
+    TileChanges read(const std::shared_ptr<TileJournal>& current);
+
+    // Forget whatever is unread. Say, mirror has just been synced with map.
+    void skip();
+
+    const std::shared_ptr<TileJournal>& get_journal() const {
+        return journal;
+    }
+};
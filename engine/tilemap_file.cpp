@@ -0,0 +1,286 @@
+#include "tilemap_file.hpp"
+#include "spdlog/spdlog.h"
+
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+MapFile::Header* MapFile::get_header() const {
+    return reinterpret_cast<Header*>(file.get_data());
+}
+
+MapFile::Entry* MapFile::get_entries() const {
+    return reinterpret_cast<Entry*>(file.get_data() + sizeof(Header));
+}
+
+const int32_t* MapFile::get_section(const Entry& entry) const {
+    return reinterpret_cast<const int32_t*>(file.get_data() + entry.offset);
+}
+
+bool MapFile::validate() {
+    size_t file_size = file.get_size();
+    auto fail = [&](const char* reason) {
+        spdlog::warn("Map file {} is broken: {}", path, reason);
+        return false;
+    };
+
+    if (file_size < sizeof(Header)) {
+        return fail("too small to be a map");
+    }
+
+    Header* header = get_header();
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        return fail("not a map file");
+    }
+    if (header->version != VERSION) {
+        return fail("unsupported version");
+    }
+    if (header->byte_order != ORDER_MARK) {
+        return fail("made on platform with different byte order");
+    }
+    if (header->layout > static_cast<uint32_t>(MapLayout::Deep)) {
+        return fail("unknown layout");
+    }
+    if (header->file_size != file_size) {
+        return fail("size doesn't match the header, file may be truncated");
+    }
+    // TileMapBase counts tiles in int, thus these can't be bigger than that
+    if (header->map_width <= 0 || header->map_height <= 0 ||
+        static_cast<uint64_t>(header->map_width) * header->map_height >
+            static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+        return fail("invalid map size");
+    }
+    if (header->chunk_size != CHUNK_SIZE) {
+        return fail("unsupported chunk size");
+    }
+
+    info = {
+        static_cast<MapLayout>(header->layout),
+        {header->map_width, header->map_height},
+        {header->tile_width, header->tile_height},
+        header->placeholder_id,
+        header->objects_amount};
+    chunks_amount = {
+        (info.map_size.x + CHUNK_SIZE - 1) / CHUNK_SIZE,
+        (info.map_size.y + CHUNK_SIZE - 1) / CHUNK_SIZE};
+    size_t chunks_total = static_cast<size_t>(chunks_amount.x) * chunks_amount.y;
+
+    if (sizeof(Header) + chunks_total * sizeof(Entry) > file_size) {
+        return fail("chunk table is out of file");
+    }
+
+    auto is_inside = [&](const Entry& entry) {
+        return entry.offset % sizeof(int32_t) == 0 && entry.used <= entry.capacity &&
+               entry.offset <= file_size &&
+               entry.capacity * sizeof(int32_t) <= file_size - entry.offset;
+    };
+
+    if (!is_inside(header->objects) || header->objects.used % 2 != 0) {
+        return fail("object table is out of file");
+    }
+
+    // Flat chunks need no checks beyond size. Deep ones also need offsets to
+    // be in order and within chunk, since these are used without any checks.
+    Entry* entries = get_entries();
+    for (size_t chunk = 0; chunk < chunks_total; chunk++) {
+        const Entry& entry = entries[chunk];
+        if (!is_inside(entry)) {
+            return fail("chunk is out of file");
+        }
+
+        if (info.layout == MapLayout::Flat) {
+            if (entry.used != CHUNK_TILES) {
+                return fail("chunk has wrong size");
+            }
+            continue;
+        }
+
+        if (entry.used < CHUNK_TILES + 1) {
+            return fail("chunk has wrong size");
+        }
+        const int32_t* offsets = get_section(entry);
+        int32_t ids_amount = static_cast<int32_t>(entry.used - CHUNK_TILES - 1);
+        bool is_ordered = offsets[0] == 0 && offsets[CHUNK_TILES] == ids_amount;
+        for (size_t i = 0; i < CHUNK_TILES && is_ordered; i++) {
+            is_ordered = offsets[i] <= offsets[i + 1];
+        }
+        if (!is_ordered) {
+            return fail("chunk has invalid tile offsets");
+        }
+    }
+
+    return true;
+}
+
+bool MapFile::open(const std::string& _path, bool writable) {
+    close();
+    path = _path;
+
+    if (!file.open(path, writable)) {
+        return false;
+    }
+
+    if (!validate()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MapFile::close() {
+    file.close();
+    info = {};
+    chunks_amount = {0, 0};
+}
+
+bool MapFile::write(
+    const std::string& _path,
+    const MapFileInfo& _info,
+    const ChunkWriter& get_chunk,
+    const std::vector<int32_t>& objects) {
+    // Old file may be mapped. Windows won't replace it then.
+    close();
+    path = _path;
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = ORDER_MARK;
+    header.layout = static_cast<uint32_t>(_info.layout);
+    header.map_width = _info.map_size.x;
+    header.map_height = _info.map_size.y;
+    header.tile_width = _info.tile_size.x;
+    header.tile_height = _info.tile_size.y;
+    header.placeholder_id = _info.placeholder_id;
+    header.objects_amount = _info.objects_amount;
+    header.chunk_size = CHUNK_SIZE;
+
+    size_t chunks_total =
+        static_cast<size_t>((_info.map_size.x + CHUNK_SIZE - 1) / CHUNK_SIZE) *
+        ((_info.map_size.y + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    std::vector<Entry> entries(chunks_total);
+
+    std::string temp_path = path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        spdlog::warn("Unable to write map file {}", temp_path);
+        return false;
+    }
+
+    static const char zeros[DATA_ALIGNMENT] = {};
+    auto write_zeros = [&](uint64_t amount) {
+        while (amount > 0) {
+            uint64_t piece = std::min<uint64_t>(amount, sizeof(zeros));
+            out.write(zeros, static_cast<std::streamsize>(piece));
+            amount -= piece;
+        }
+    };
+
+    // Header and chunk table are written last, once offsets are known
+    uint64_t offset = sizeof(Header) + chunks_total * sizeof(Entry);
+    uint64_t data_start = (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+    write_zeros(data_start);
+    offset = data_start;
+
+    using Section = std::vector<int32_t>;
+    auto write_section = [&](Entry& entry, const Section& data, size_t spare) {
+        entry.offset = offset;
+        entry.used = static_cast<uint32_t>(data.size());
+        entry.capacity = static_cast<uint32_t>(data.size() + spare);
+        out.write(
+            reinterpret_cast<const char*>(data.data()),
+            static_cast<std::streamsize>(data.size() * sizeof(int32_t)));
+        write_zeros(spare * sizeof(int32_t));
+        offset += static_cast<uint64_t>(entry.capacity) * sizeof(int32_t);
+    };
+
+    std::vector<int32_t> payload;
+    for (size_t chunk = 0; chunk < chunks_total; chunk++) {
+        payload.clear();
+        get_chunk(chunk, payload);
+        // Flat chunks never change their size
+        size_t spare = _info.layout == MapLayout::Deep ? payload.size() / 4 + 16 : 0;
+        write_section(entries[chunk], payload, spare);
+    }
+    write_section(header.objects, objects, std::max<size_t>(objects.size() / 4, 128));
+
+    header.file_size = offset;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    out.write(
+        reinterpret_cast<const char*>(entries.data()),
+        static_cast<std::streamsize>(entries.size() * sizeof(Entry)));
+    out.close();
+
+    std::error_code error;
+    if (out.fail()) {
+        spdlog::warn("Unable to write map file {}", temp_path);
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        spdlog::warn("Unable to replace map file {}: {}", path, error.message());
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    return open(path, true);
+}
+
+bool MapFile::rewrite_section(Entry& entry, const std::vector<int32_t>& payload) {
+    if (!file.is_writable() || payload.size() > entry.capacity) {
+        return false;
+    }
+
+    std::memcpy(
+        file.get_data() + entry.offset, payload.data(), payload.size() * sizeof(int32_t));
+    entry.used = static_cast<uint32_t>(payload.size());
+    return true;
+}
+
+bool MapFile::rewrite_chunk(size_t chunk, const std::vector<int32_t>& payload) {
+    return rewrite_section(get_entries()[chunk], payload);
+}
+
+bool MapFile::rewrite_objects(const std::vector<int32_t>& objects, int objects_amount) {
+    Header* header = get_header();
+    if (!rewrite_section(header->objects, objects)) {
+        return false;
+    }
+    header->objects_amount = objects_amount;
+    info.objects_amount = objects_amount;
+    return true;
+}
+
+bool MapFile::flush() {
+    return file.flush();
+}
+
+const int32_t* MapFile::get_chunk(size_t chunk, size_t& amount) const {
+    const Entry& entry = get_entries()[chunk];
+    amount = entry.used;
+    return get_section(entry);
+}
+
+const int32_t* MapFile::get_objects(size_t& amount) const {
+    const Entry& entry = get_header()->objects;
+    amount = entry.used;
+    return get_section(entry);
+}
+
+int32_t MapFile::get_tile_id(Point tile) const {
+    size_t amount;
+    const int32_t* ids = get_chunk(get_chunk_index(tile), amount);
+    return ids[(tile.y % CHUNK_SIZE) * CHUNK_SIZE + tile.x % CHUNK_SIZE];
+}
+
+const int32_t* MapFile::get_tile_ids(Point tile, size_t& amount) const {
+    size_t chunk_amount;
+    const int32_t* offsets = get_chunk(get_chunk_index(tile), chunk_amount);
+    size_t i = (tile.y % CHUNK_SIZE) * CHUNK_SIZE + tile.x % CHUNK_SIZE;
+    amount = static_cast<size_t>(offsets[i + 1] - offsets[i]);
+    return offsets + CHUNK_TILES + 1 + offsets[i];
+}
@@ -0,0 +1,474 @@
+#pragma once
+
+#include "mapgen.hpp"
+#include "mapped_file.hpp"
+#include "spdlog/spdlog.h"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Binary file format for tile maps.
+// Grid is stored chunk by chunk, thus file can be memory-mapped and used in
+// place, and chunks that have changed can be rewritten without touching the
+// rest of file. Loading is mapping the file and checking its tables - there is
+// no per-tile parsing, tiles are copied into map row by row.
+// Objects can't be saved as is, since T may be anything. Thus each object gets
+// stored as a single number (entity id, kind of tile, etc) - what it means is
+// up to whoever saves and loads the map.
+// Numbers are stored in native byte order. Files made on machine with the
+// other one are rejected.
+
+enum class MapLayout : uint32_t {
+    // TileMap - single object id per tile
+    Flat,
+    // TileMapDeep - any amount of object ids per tile
+    Deep
+};
+
+struct MapFileInfo {
+    MapLayout layout;
+    Point map_size;
+    Point tile_size;
+    int placeholder_id;
+    // Id that map's storage would give to the next new object
+    int objects_amount;
+};
+
+// Map file itself, without any knowledge of map classes.
+// Each chunk is CHUNK_SIZE x CHUNK_SIZE tiles, row by row. Chunks on map's
+// edges are padded. Contents of chunk depend on layout:
+// - Flat: id of each tile, padding tiles hold placeholder.
+// - Deep: offsets of each tile's ids (plus one for the end of the last tile),
+// followed by ids themselves. Padding tiles are empty.
+// Objects are stored as pairs of object id and its value, sorted by id.
+class MapFile {
+public:
+    static constexpr int CHUNK_SIZE = 32;
+    static constexpr size_t CHUNK_TILES = CHUNK_SIZE * CHUNK_SIZE;
+    static constexpr uint32_t VERSION = 1;
+
+    // Fills payload of chunk with specified number
+    using ChunkWriter = std::function<void(size_t, std::vector<int32_t>&)>;
+
+private:
+    // Where section is, and how much of it is used. Both are in int32s.
+    // Deep chunks and objects get some spare room, so these can grow a bit
+    // without rewriting the whole file.
+    struct Entry {
+        uint64_t offset;
+        uint32_t used;
+        uint32_t capacity;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        // Must read as ORDER_MARK, else file has been made on other platform
+        uint32_t byte_order;
+        uint32_t layout;
+        int32_t map_width;
+        int32_t map_height;
+        int32_t tile_width;
+        int32_t tile_height;
+        int32_t placeholder_id;
+        int32_t objects_amount;
+        int32_t chunk_size;
+        Entry objects;
+        uint64_t file_size;
+    };
+
+    static constexpr char MAGIC[8] = {'M', 'B', 'T', 'M', 'A', 'P', '\0', '\0'};
+    static constexpr uint32_t ORDER_MARK = 0x01020304;
+    // Chunk data starts on its own page, so flat chunks map to pages 1:1
+    static constexpr uint64_t DATA_ALIGNMENT = 4096;
+
+    MappedFile file;
+    std::string path;
+    MapFileInfo info = {};
+    Point chunks_amount = {0, 0};
+
+    Header* get_header() const;
+    Entry* get_entries() const;
+    const int32_t* get_section(const Entry& entry) const;
+    bool rewrite_section(Entry& entry, const std::vector<int32_t>& payload);
+    // Check that all tables point within file and make sense. Logs what's wrong.
+    bool validate();
+
+public:
+    MapFile() = default;
+
+    // Map existing file and check its tables
+    bool open(const std::string& _path, bool writable);
+    void close();
+
+    // Write whole file anew, then open it as writable. File gets written next
+    // to old one first, thus if saving fails midway - old one stays intact.
+    bool write(
+        const std::string& _path,
+        const MapFileInfo& _info,
+        const ChunkWriter& get_chunk,
+        const std::vector<int32_t>& objects);
+
+    // Replace contents of chunk in place. Returns false if these don't fit
+    // into space reserved for chunk - file must be written anew then.
+    bool rewrite_chunk(size_t chunk, const std::vector<int32_t>& payload);
+    bool rewrite_objects(const std::vector<int32_t>& objects, int objects_amount);
+
+    // Push rewritten chunks to disk
+    bool flush();
+
+    bool is_open() const {
+        return file.is_open();
+    }
+
+    bool is_writable() const {
+        return file.is_writable();
+    }
+
+    const std::string& get_path() const {
+        return path;
+    }
+
+    const MapFileInfo& get_info() const {
+        return info;
+    }
+
+    Point get_chunks_amount() const {
+        return chunks_amount;
+    }
+
+    size_t get_chunk_index(Point tile) const {
+        return static_cast<size_t>(tile.y / CHUNK_SIZE) * chunks_amount.x +
+               tile.x / CHUNK_SIZE;
+    }
+
+    // Contents of chunk, right from mapped memory
+    const int32_t* get_chunk(size_t chunk, size_t& amount) const;
+    const int32_t* get_objects(size_t& amount) const;
+
+    // Id of object on tile of flat map, read in place
+    int32_t get_tile_id(Point tile) const;
+
+    // Ids of objects on tile of deep map, read in place
+    const int32_t* get_tile_ids(Point tile, size_t& amount) const;
+};
+
+// Saves map into file and loads it back. Works with both TileMap (flat) and
+// TileMapDeep (deep). Loading requires map of the same size - so, open() the
+// file first, then create map based on get_info() and load() into it.
+template <typename T> class TileMapFile {
+private:
+    MapFile file;
+    std::string path;
+    // Chunks with tiles changed since the last save
+    std::vector<uint8_t> dirty_chunks;
+    // Map's journal, if it has one. Followed since the last save or load, when
+    // file and map have been the same.
+    TileJournalReader journal;
+
+    static size_t get_chunk_tile(Point map_size, size_t chunk, size_t tile) {
+        int chunks_x = (map_size.x + MapFile::CHUNK_SIZE - 1) / MapFile::CHUNK_SIZE;
+        int x = static_cast<int>(chunk % chunks_x) * MapFile::CHUNK_SIZE +
+                static_cast<int>(tile % MapFile::CHUNK_SIZE);
+        int y = static_cast<int>(chunk / chunks_x) * MapFile::CHUNK_SIZE +
+                static_cast<int>(tile / MapFile::CHUNK_SIZE);
+        if (x >= map_size.x || y >= map_size.y) {
+            return SIZE_MAX;
+        }
+        return static_cast<size_t>(y) * map_size.x + x;
+    }
+
+    static void make_chunk(TileMap<T>& map, size_t chunk, std::vector<int32_t>& payload) {
+        payload.assign(MapFile::CHUNK_TILES, map.placeholder_id);
+        for (size_t i = 0; i < MapFile::CHUNK_TILES; i++) {
+            size_t grid_index = get_chunk_tile(map.map_size, chunk, i);
+            if (grid_index != SIZE_MAX) {
+                payload[i] = map.grid[grid_index];
+            }
+        }
+    }
+
+    static void make_chunk(
+        TileMapDeep<T>& map, size_t chunk, std::vector<int32_t>& payload) {
+        payload.assign(MapFile::CHUNK_TILES + 1, 0);
+        for (size_t i = 0; i < MapFile::CHUNK_TILES; i++) {
+            payload[i] = static_cast<int32_t>(payload.size() - MapFile::CHUNK_TILES - 1);
+            size_t grid_index = get_chunk_tile(map.map_size, chunk, i);
+            if (grid_index != SIZE_MAX) {
+                auto& ids = map.grid[grid_index];
+                payload.insert(payload.end(), ids.begin(), ids.end());
+            }
+        }
+        payload[MapFile::CHUNK_TILES] =
+            static_cast<int32_t>(payload.size() - MapFile::CHUNK_TILES - 1);
+    }
+
+    static std::vector<int32_t> make_objects(
+        TileMapBase<T>& map, const std::function<int32_t(const T&)>& to_value) {
+        std::vector<int> ids;
+        ids.reserve(map.map_objects.size());
+        for (auto& [id, object] : map.map_objects) {
+            ids.push_back(id);
+        }
+        // Storage is unordered, but files better not depend on its whims
+        std::sort(ids.begin(), ids.end());
+
+        std::vector<int32_t> objects;
+        objects.reserve(ids.size() * 2);
+        for (auto id : ids) {
+            objects.push_back(id);
+            objects.push_back(to_value(map.map_objects[id]));
+        }
+        return objects;
+    }
+
+    static MapFileInfo make_info(TileMap<T>& map) {
+        return {
+            MapLayout::Flat,
+            map.map_size,
+            map.tile_size,
+            map.placeholder_id,
+            static_cast<int>(map.map_objects_amount)};
+    }
+
+    static MapFileInfo make_info(TileMapDeep<T>& map) {
+        return {
+            MapLayout::Deep,
+            map.map_size,
+            map.tile_size,
+            -1,
+            static_cast<int>(map.map_objects_amount)};
+    }
+
+    // Check that file is the right one to be loaded into map
+    bool can_load(MapLayout layout, TileMapBase<T>& map) {
+        if (!file.is_open() && !open()) {
+            return false;
+        }
+
+        const MapFileInfo& info = file.get_info();
+        if (info.layout != layout || info.map_size.x != map.map_size.x ||
+            info.map_size.y != map.map_size.y) {
+            spdlog::warn(
+                "Map file {} has {}x{} {} map, which doesn't fit into {}x{} one",
+                path,
+                info.map_size.x,
+                info.map_size.y,
+                info.layout == MapLayout::Flat ? "flat" : "deep",
+                map.map_size.x,
+                map.map_size.y);
+            return false;
+        }
+        return true;
+    }
+
+    void load_objects(
+        TileMapBase<T>& map, const std::function<T(int32_t)>& from_value) {
+        size_t amount;
+        const int32_t* objects = file.get_objects(amount);
+        map.map_objects.clear();
+        for (size_t i = 0; i + 1 < amount; i += 2) {
+            map.map_objects[objects[i]] = from_value(objects[i + 1]);
+        }
+        map.map_objects_amount = file.get_info().objects_amount;
+    }
+
+    void reset_dirty_chunks() {
+        Point chunks = file.get_chunks_amount();
+        dirty_chunks.assign(static_cast<size_t>(chunks.x) * chunks.y, 0);
+    }
+
+    // File matches map now, thus whatever journal has recorded so far is saved
+    void sync_journal(TileMapBase<T>& map) {
+        if (journal.get_journal() != map.journal) {
+            journal.follow(map.journal);
+        }
+        journal.skip();
+    }
+
+    // Mark chunks with tiles map has changed since the last sync
+    void read_journal(TileMapBase<T>& map) {
+        TileChanges changes = journal.read(map.journal);
+        if (changes.everything) {
+            std::fill(dirty_chunks.begin(), dirty_chunks.end(), 1);
+            return;
+        }
+        // Journal's chunks are numbered the same way, if these are as big
+        bool is_same_chunks = map.journal != nullptr &&
+                              map.journal->get_chunk_size() == MapFile::CHUNK_SIZE;
+        if (is_same_chunks) {
+            for (size_t i = 0; i < changes.chunks_amount; i++) {
+                dirty_chunks[changes.chunks[i]] = 1;
+            }
+            return;
+        }
+        for (size_t i = 0; i < changes.tiles_amount; i++) {
+            mark_tile_dirty(changes.tiles[i]);
+        }
+    }
+
+public:
+    TileMapFile(const std::string& _path)
+        : path(_path) {
+    }
+
+    // Map the file, without loading anything yet
+    bool open() {
+        if (!file.open(path, false)) {
+            return false;
+        }
+        reset_dirty_chunks();
+        return true;
+    }
+
+    const MapFileInfo& get_info() const {
+        return file.get_info();
+    }
+
+    // File itself, to read tiles in place, without loading the map
+    const MapFile& get_file() const {
+        return file;
+    }
+
+    // Remember that tile has changed since the last save. If map has journal,
+    // save_changes() picks changed tiles from it - this is only needed for
+    // changes map doesn't know about. Else, must be called after each change.
+    void mark_tile_dirty(size_t grid_index) {
+        if (dirty_chunks.empty()) {
+            return;
+        }
+        int width = file.get_info().map_size.x;
+        Point tile = {
+            static_cast<int>(grid_index % width), static_cast<int>(grid_index / width)};
+        dirty_chunks[file.get_chunk_index(tile)] = 1;
+    }
+
+    // Write whole map
+    template <typename M>
+    bool save(M& map, const std::function<int32_t(const T&)>& to_value) {
+        auto get_chunk = [&](size_t chunk, std::vector<int32_t>& payload) {
+            make_chunk(map, chunk, payload);
+        };
+        bool is_written =
+            file.write(path, make_info(map), get_chunk, make_objects(map, to_value));
+        if (is_written) {
+            reset_dirty_chunks();
+            sync_journal(map);
+        }
+        return is_written;
+    }
+
+    // Write only chunks with changed tiles, in place. Objects are always
+    // written, since there is no way to know if these have changed. If file
+    // isn't there yet or changes don't fit into it - whole map gets written.
+    template <typename M>
+    bool save_changes(M& map, const std::function<int32_t(const T&)>& to_value) {
+        MapFileInfo info = make_info(map);
+        if (!file.is_open() || file.get_info().layout != info.layout ||
+            file.get_info().map_size.x != info.map_size.x ||
+            file.get_info().map_size.y != info.map_size.y ||
+            file.get_info().placeholder_id != info.placeholder_id) {
+            return save(map, to_value);
+        }
+
+        if (!file.is_writable() && !file.open(path, true)) {
+            return save(map, to_value);
+        }
+
+        read_journal(map);
+        std::vector<int32_t> payload;
+        for (size_t chunk = 0; chunk < dirty_chunks.size(); chunk++) {
+            if (!dirty_chunks[chunk]) {
+                continue;
+            }
+            make_chunk(map, chunk, payload);
+            if (!file.rewrite_chunk(chunk, payload)) {
+                return save(map, to_value);
+            }
+        }
+
+        if (!file.rewrite_objects(make_objects(map, to_value), info.objects_amount)) {
+            return save(map, to_value);
+        }
+
+        reset_dirty_chunks();
+        sync_journal(map);
+        return file.flush();
+    }
+
+    bool load(TileMap<T>& map, const std::function<T(int32_t)>& from_value) {
+        if (!can_load(MapLayout::Flat, map)) {
+            return false;
+        }
+
+        // Chunks are copied row by row, each chunk row is a single memcpy
+        Point chunks = file.get_chunks_amount();
+        Point map_size = map.map_size;
+        get_worker_pool().parallel_for(
+            static_cast<size_t>(chunks.x) * chunks.y, 16, [&](size_t first, size_t last) {
+                for (size_t chunk = first; chunk < last; chunk++) {
+                    size_t amount;
+                    const int32_t* ids = file.get_chunk(chunk, amount);
+                    int x = static_cast<int>(chunk % chunks.x) * MapFile::CHUNK_SIZE;
+                    int y = static_cast<int>(chunk / chunks.x) * MapFile::CHUNK_SIZE;
+                    int width = std::min(MapFile::CHUNK_SIZE, map_size.x - x);
+                    int height = std::min(MapFile::CHUNK_SIZE, map_size.y - y);
+                    for (int row = 0; row < height; row++) {
+                        size_t grid_index = static_cast<size_t>(y + row) * map_size.x + x;
+                        std::memcpy(
+                            map.grid.data() + grid_index,
+                            ids + row * MapFile::CHUNK_SIZE,
+                            width * sizeof(int32_t));
+                    }
+                }
+            });
+
+        map.placeholder_id = file.get_info().placeholder_id;
+        load_objects(map, from_value);
+        if (map.journal != nullptr) {
+            map.journal->record_everything();
+        }
+        reset_dirty_chunks();
+        sync_journal(map);
+        return true;
+    }
+
+    bool load(TileMapDeep<T>& map, const std::function<T(int32_t)>& from_value) {
+        if (!can_load(MapLayout::Deep, map)) {
+            return false;
+        }
+
+        Point chunks = file.get_chunks_amount();
+        Point map_size = map.map_size;
+        get_worker_pool().parallel_for(
+            static_cast<size_t>(chunks.x) * chunks.y, 16, [&](size_t first, size_t last) {
+                for (size_t chunk = first; chunk < last; chunk++) {
+                    size_t amount;
+                    const int32_t* offsets = file.get_chunk(chunk, amount);
+                    const int32_t* ids = offsets + MapFile::CHUNK_TILES + 1;
+                    for (size_t i = 0; i < MapFile::CHUNK_TILES; i++) {
+                        size_t grid_index = get_chunk_tile(map_size, chunk, i);
+                        if (grid_index != SIZE_MAX) {
+                            map.grid[grid_index].assign(
+                                ids + offsets[i], ids + offsets[i + 1]);
+                        }
+                    }
+                }
+            });
+        map.count_ids();
+
+        load_objects(map, from_value);
+        if (map.journal != nullptr) {
+            map.journal->record_everything();
+        }
+        reset_dirty_chunks();
+        sync_journal(map);
+        return true;
+    }
+};
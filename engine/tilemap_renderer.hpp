@@ -0,0 +1,446 @@
+#pragma once
+
+#include "mapgen.hpp"
+#include "node.hpp"
+#include "scene.hpp"
+#include "utility.hpp"
+#include "raylib.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Tile map rendering.
+// Renderer splits map into square chunks of tiles. Chunks that are visible by
+// scene's camera get baked into their own RenderTexture2D, thus drawing whole
+// visible part of map costs one draw call per chunk, instead of one per tile.
+// Chunk gets re-baked only after some tile in it has been marked as dirty.
+// If map has journal enabled, changed tiles are picked from it on their own.
+
+// Texture and part of it that should be used to draw specific tile object.
+struct TileGraphic {
+    const Texture2D* texture;
+    Rectangle rect;
+};
+
+// Counters of the last frame. Draw calls are draw requests issued to raylib.
+// Texture switches are the amount of times these requests changed texture,
+// which is what forces raylib to flush its draw batch.
+struct TileMapRenderStats {
+    size_t draw_calls = 0;
+    size_t texture_switches = 0;
+    size_t tiles_drawn = 0;
+    size_t chunks_drawn = 0;
+    // Baking happens on update(), thus these are counted separately from above
+    size_t chunks_baked = 0;
+    size_t bake_draw_calls = 0;
+    size_t bake_texture_switches = 0;
+};
+
+template <typename T> class TileMapRenderer : public Node {
+protected:
+    struct Chunk {
+        RenderTexture2D texture = {};
+        bool baked = false;
+        bool dirty = true;
+        // Last frame this chunk has been visible. Used to evict stale textures
+        size_t last_used = 0;
+    };
+
+    struct CachedGraphic {
+        TileGraphic graphic = {nullptr, {0.0f, 0.0f, 0.0f, 0.0f}};
+        bool resolved = false;
+        bool visible = false;
+    };
+
+    TileMapBase<T>* map;
+    std::function<std::optional<TileGraphic>(T)> get_graphic;
+
+    // Graphics of objects, indexed by object id. Since map never reuses ids
+    // of deleted objects, its safe to keep these around. If object's look has
+    // changed - call invalidate_graphics().
+    std::vector<CachedGraphic> graphics;
+    TileGraphic placeholder_graphic = {nullptr, {0.0f, 0.0f, 0.0f, 0.0f}};
+
+    int chunk_size;
+    Point chunks_amount;
+    std::vector<Chunk> chunks;
+
+    bool use_cache = true;
+    // Amount of baked chunks to keep in memory. Chunks that are out of view get
+    // unloaded after going over this limit, starting from the oldest one.
+    size_t max_cached_chunks = 64;
+    size_t cached_chunks = 0;
+    size_t frame = 0;
+
+    // Visible part of map, in tiles. Right and bottom borders are exclusive.
+    Point view_min = {0, 0};
+    Point view_max = {0, 0};
+
+    TileMapRenderStats stats;
+    const Texture2D* last_texture = nullptr;
+
+    // Subscription to map's journal, if it has one
+    TileJournalReader journal;
+
+    // Mark chunks with tiles that have changed since the last frame. Once
+    // journal gets enabled or replaced, everything counts as changed.
+    void read_journal() {
+        TileChanges changes = journal.read(map->get_journal());
+        bool is_same_chunks = journal.get_journal() != nullptr &&
+                              journal.get_journal()->get_chunk_size() == chunk_size;
+        if (changes.everything) {
+            mark_all_dirty();
+        }
+        else if (is_same_chunks) {
+            for (size_t i = 0; i < changes.chunks_amount; i++) {
+                chunks[changes.chunks[i]].dirty = true;
+            }
+        }
+        else {
+            for (size_t i = 0; i < changes.tiles_amount; i++) {
+                mark_tile_dirty(changes.tiles[i]);
+            }
+        }
+    }
+
+    const TileGraphic* resolve_graphic(int object_id) {
+        if (object_id < 0) {
+            // Negative ids can only be placeholders, these aren't worth caching
+            auto g = get_graphic(map->get_object_by_id(object_id));
+            if (!g) {
+                return nullptr;
+            }
+            placeholder_graphic = g.value();
+            return &placeholder_graphic;
+        }
+
+        size_t id = static_cast<size_t>(object_id);
+        if (id >= graphics.size()) {
+            graphics.resize(id + 1);
+        }
+
+        CachedGraphic& cached = graphics[id];
+        if (!cached.resolved) {
+            auto g = get_graphic(map->get_object_by_id(object_id));
+            cached.resolved = true;
+            cached.visible = g.has_value();
+            if (cached.visible) {
+                cached.graphic = g.value();
+            }
+        }
+
+        return cached.visible ? &cached.graphic : nullptr;
+    }
+
+    // Draw every object of specified tile at pos, updating provided counters
+    void draw_tile(size_t grid_index, Vector2 pos, size_t& draw_calls, size_t& switches) {
+        map->for_each_object_id(grid_index, [&](int object_id) {
+            const TileGraphic* g = resolve_graphic(object_id);
+            if (g == nullptr) {
+                return;
+            }
+
+            if (g->texture != last_texture) {
+                last_texture = g->texture;
+                switches++;
+            }
+            DrawTextureRec(*g->texture, g->rect, pos, WHITE);
+            draw_calls++;
+        });
+    }
+
+    Rectangle get_chunk_rect(size_t chunk_index) {
+        Point tile_size = map->get_tile_size();
+        Point map_size = map->get_map_size();
+        int cx = chunk_index % chunks_amount.x;
+        int cy = chunk_index / chunks_amount.x;
+        int tiles_x = std::min(chunk_size, map_size.x - cx * chunk_size);
+        int tiles_y = std::min(chunk_size, map_size.y - cy * chunk_size);
+
+        return {
+            static_cast<float>(cx * chunk_size * tile_size.x),
+            static_cast<float>(cy * chunk_size * tile_size.y),
+            static_cast<float>(tiles_x * tile_size.x),
+            static_cast<float>(tiles_y * tile_size.y)};
+    }
+
+    void bake_chunk(size_t chunk_index) {
+        Chunk& chunk = chunks[chunk_index];
+        Rectangle rect = get_chunk_rect(chunk_index);
+
+        if (!chunk.baked) {
+            chunk.texture = LoadRenderTexture(
+                static_cast<int>(rect.width), static_cast<int>(rect.height));
+            chunk.baked = true;
+            cached_chunks++;
+        }
+
+        Point tile_size = map->get_tile_size();
+        Point map_size = map->get_map_size();
+        int first_x = chunk_index % chunks_amount.x * chunk_size;
+        int first_y = chunk_index / chunks_amount.x * chunk_size;
+        int last_x = std::min(first_x + chunk_size, map_size.x);
+        int last_y = std::min(first_y + chunk_size, map_size.y);
+
+        last_texture = nullptr;
+        BeginTextureMode(chunk.texture);
+        ClearBackground(BLANK);
+        for (int y = first_y; y < last_y; y++) {
+            size_t grid_index = static_cast<size_t>(y) * map_size.x + first_x;
+            for (int x = first_x; x < last_x; x++, grid_index++) {
+                draw_tile(
+                    grid_index,
+                    {static_cast<float>((x - first_x) * tile_size.x),
+                     static_cast<float>((y - first_y) * tile_size.y)},
+                    stats.bake_draw_calls,
+                    stats.bake_texture_switches);
+            }
+        }
+        EndTextureMode();
+
+        chunk.dirty = false;
+        stats.chunks_baked++;
+    }
+
+    void unload_chunk(Chunk& chunk) {
+        if (chunk.baked) {
+            UnloadRenderTexture(chunk.texture);
+            chunk.baked = false;
+            chunk.dirty = true;
+            cached_chunks--;
+        }
+    }
+
+    // Unload the oldest out-of-view chunks, if there are too many of them
+    void evict_chunks() {
+        if (cached_chunks <= max_cached_chunks) {
+            return;
+        }
+
+        std::vector<size_t> stale;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (chunks[i].baked && chunks[i].last_used != frame) {
+                stale.push_back(i);
+            }
+        }
+        std::sort(stale.begin(), stale.end(), [this](size_t a, size_t b) {
+            return chunks[a].last_used < chunks[b].last_used;
+        });
+
+        for (auto i : stale) {
+            if (cached_chunks <= max_cached_chunks) {
+                break;
+            }
+            unload_chunk(chunks[i]);
+        }
+    }
+
+    // Calculate which tiles are visible by scene's camera
+    void update_view() {
+        Camera2D camera = {{0.0f, 0.0f}, {0.0f, 0.0f}, 0.0f, 1.0f};
+        Scene* scene = get_scene();
+        if (scene != nullptr) {
+            camera = scene->get_camera();
+        }
+
+        Vector2 window = get_window_size();
+        Vector2 corners[4] = {
+            GetScreenToWorld2D({0.0f, 0.0f}, camera),
+            GetScreenToWorld2D({window.x, 0.0f}, camera),
+            GetScreenToWorld2D({0.0f, window.y}, camera),
+            GetScreenToWorld2D({window.x, window.y}, camera)};
+
+        // Camera may be rotated, thus using bounding box of all corners
+        Vector2 low = corners[0];
+        Vector2 high = corners[0];
+        for (auto& c : corners) {
+            low = {std::min(low.x, c.x), std::min(low.y, c.y)};
+            high = {std::max(high.x, c.x), std::max(high.y, c.y)};
+        }
+
+        Vector2 origin = get_world_pos();
+        Point tile_size = map->get_tile_size();
+        Point map_size = map->get_map_size();
+
+        view_min = {
+            std::clamp(
+                static_cast<int>(std::floor((low.x - origin.x) / tile_size.x)),
+                0,
+                map_size.x),
+            std::clamp(
+                static_cast<int>(std::floor((low.y - origin.y) / tile_size.y)),
+                0,
+                map_size.y)};
+        view_max = {
+            std::clamp(
+                static_cast<int>(std::ceil((high.x - origin.x) / tile_size.x)),
+                0,
+                map_size.x),
+            std::clamp(
+                static_cast<int>(std::ceil((high.y - origin.y) / tile_size.y)),
+                0,
+                map_size.y)};
+    }
+
+    bool is_view_empty() {
+        return view_min.x >= view_max.x || view_min.y >= view_max.y;
+    }
+
+public:
+    TileMapRenderer(
+        TileMapBase<T>* _map,
+        std::function<std::optional<TileGraphic>(T)> _get_graphic,
+        int _chunk_size)
+        : map(_map)
+        , get_graphic(_get_graphic)
+        , chunk_size(std::max(_chunk_size, 1)) {
+        Point map_size = map->get_map_size();
+        chunks_amount = {
+            (map_size.x + chunk_size - 1) / chunk_size,
+            (map_size.y + chunk_size - 1) / chunk_size};
+        chunks.resize(static_cast<size_t>(chunks_amount.x) * chunks_amount.y);
+        add_tag("TileMapRenderer");
+    }
+
+    TileMapRenderer(
+        TileMapBase<T>* _map, std::function<std::optional<TileGraphic>(T)> _get_graphic)
+        : TileMapRenderer(_map, _get_graphic, 16) {
+    }
+
+    ~TileMapRenderer() {
+        for (auto& chunk : chunks) {
+            unload_chunk(chunk);
+        }
+    }
+
+    // Toggle chunk caching. Without it, each visible tile is drawn separately.
+    // Mostly useful for maps that change each frame, or to compare stats.
+    void set_caching(bool enabled) {
+        use_cache = enabled;
+        if (!use_cache) {
+            for (auto& chunk : chunks) {
+                unload_chunk(chunk);
+            }
+        }
+    }
+
+    void set_max_cached_chunks(size_t amount) {
+        max_cached_chunks = amount;
+    }
+
+    // Schedule re-bake of chunk that contains specified tile.
+    // Must be called after each change of tile's content, else old look of
+    // chunk will be drawn - unless map has journal enabled.
+    void mark_tile_dirty(size_t grid_index) {
+        Point tile = map->index_to_tile(grid_index);
+        size_t chunk = (tile.y / chunk_size) * chunks_amount.x + tile.x / chunk_size;
+        chunks[chunk].dirty = true;
+    }
+
+    void mark_all_dirty() {
+        for (auto& chunk : chunks) {
+            chunk.dirty = true;
+        }
+    }
+
+    // Forget cached object graphics. Use it if get_graphic's result has changed
+    void invalidate_graphics() {
+        graphics.clear();
+        mark_all_dirty();
+    }
+
+    const TileMapRenderStats& get_stats() {
+        return stats;
+    }
+
+    void update(float) override {
+        frame++;
+        stats.chunks_baked = 0;
+        stats.bake_draw_calls = 0;
+        stats.bake_texture_switches = 0;
+
+        read_journal();
+        update_view();
+        if (!use_cache || is_view_empty()) {
+            return;
+        }
+
+        // Baking is done there and not in draw(), because switching render
+        // target would reset transformations of BeginMode2D, if its active.
+        for (int cy = view_min.y / chunk_size; cy * chunk_size < view_max.y; cy++) {
+            for (int cx = view_min.x / chunk_size; cx * chunk_size < view_max.x; cx++) {
+                size_t chunk_index = static_cast<size_t>(cy) * chunks_amount.x + cx;
+                Chunk& chunk = chunks[chunk_index];
+                chunk.last_used = frame;
+                if (chunk.dirty) {
+                    bake_chunk(chunk_index);
+                }
+            }
+        }
+
+        evict_chunks();
+    }
+
+    // Map is drawn in world coordinates, with its top left corner at node's
+    // world position.
+    void draw() override {
+        stats.draw_calls = 0;
+        stats.texture_switches = 0;
+        stats.tiles_drawn = 0;
+        stats.chunks_drawn = 0;
+        last_texture = nullptr;
+
+        if (is_view_empty()) {
+            return;
+        }
+
+        Vector2 origin = get_world_pos();
+
+        if (!use_cache) {
+            Point tile_size = map->get_tile_size();
+            Point map_size = map->get_map_size();
+            for (int y = view_min.y; y < view_max.y; y++) {
+                size_t grid_index = static_cast<size_t>(y) * map_size.x + view_min.x;
+                for (int x = view_min.x; x < view_max.x; x++, grid_index++) {
+                    draw_tile(
+                        grid_index,
+                        {origin.x + x * tile_size.x, origin.y + y * tile_size.y},
+                        stats.draw_calls,
+                        stats.texture_switches);
+                }
+            }
+            stats.tiles_drawn =
+                static_cast<size_t>(view_max.x - view_min.x) * (view_max.y - view_min.y);
+            return;
+        }
+
+        for (int cy = view_min.y / chunk_size; cy * chunk_size < view_max.y; cy++) {
+            for (int cx = view_min.x / chunk_size; cx * chunk_size < view_max.x; cx++) {
+                size_t chunk_index = static_cast<size_t>(cy) * chunks_amount.x + cx;
+                Chunk& chunk = chunks[chunk_index];
+                if (!chunk.baked) {
+                    // Shouldn't happen, unless view has changed between
+                    // update() and draw() calls
+                    continue;
+                }
+
+                Rectangle rect = get_chunk_rect(chunk_index);
+                // Render textures are upside down, thus negative height
+                DrawTextureRec(
+                    chunk.texture.texture,
+                    {0.0f, 0.0f, rect.width, -rect.height},
+                    {origin.x + rect.x, origin.y + rect.y},
+                    WHITE);
+                stats.draw_calls++;
+                stats.texture_switches++;
+                stats.chunks_drawn++;
+            }
+        }
+        stats.tiles_drawn =
+            static_cast<size_t>(view_max.x - view_min.x) * (view_max.y - view_min.y);
+    }
+};
@@ -41,8 +41,15 @@ void TextureObserver::set_texture(const Texture* t) {
     texture = t;
 }
 
+void TextureObserver::set_region(const AtlasRegion* r) {
+    region = r;
+}
+
 void TextureObserver::update(float) {
-    if ((texture != nullptr) && (button != nullptr)) {
+    if ((region != nullptr) && (button != nullptr)) {
+        button->set_region(*region);
+    }
+    else if ((texture != nullptr) && (button != nullptr)) {
         button->set_texture(texture);
     }
 }
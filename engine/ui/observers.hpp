@@ -54,11 +54,13 @@ public:
 class TextureObserver: public ButtonStateObserver {
 private:
     const Texture* texture = nullptr;
+    const AtlasRegion* region = nullptr;
     Button* button = nullptr;
 
 public:
     void attach_to_button(Button* b);
     void set_texture(const Texture* t);
+    void set_region(const AtlasRegion* r);
 
     void update(float) override;
 };
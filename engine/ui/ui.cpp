@@ -15,6 +15,10 @@ const TextComponent& UiText::get_text_component() {
     return text_component;
 }
 
+void UiText::set_text(const std::string& txt) {
+    text_component.set_text(txt);
+}
+
 std::string UiText::get_string() {
     return text_component.to_string();
 }
@@ -30,7 +34,18 @@ Button::Button(Rectangle r) : RectangleNode(r) {
 }
 
 void Button::set_texture(const Texture2D* t) {
-    texture = t;
+    if (t == nullptr) {
+        region = {nullptr, {0.0f, 0.0f, 0.0f, 0.0f}, 0};
+        return;
+    }
+    region = {
+        t,
+        {0.0f, 0.0f, static_cast<float>(t->width), static_cast<float>(t->height)},
+        t->id};
+}
+
+void Button::set_region(const AtlasRegion& r) {
+    region = r;
 }
 
 void Button::set_subject(ButtonState state, ButtonStateSubject* sub) {
@@ -85,9 +100,10 @@ std::string Button::to_string() {
 }
 
 void Button::draw() {
-    if (texture != nullptr) {
+    if (region.texture != nullptr) {
         // spdlog::info("{}", get_world_pos());
-        DrawTextureV(*texture, get_world_pos(), WHITE);
+        count_texture_bind(region.texture->id, region.source_id);
+        DrawTextureRec(*region.texture, region.rect, get_world_pos(), WHITE);
     }
 }
 
@@ -152,6 +168,72 @@ void MousePosReporter::draw() {
 }
 
 
+// TextureSwitchReporter
+TextureSwitchReporter::TextureSwitchReporter()
+    : RectangleNode({0.0f, 60.0f, 0.0f, 0.0f}) {
+    add_tag("TextureSwitchReporter");
+}
+
+void TextureSwitchReporter::update(float) {
+    TextureBindStats new_stats = get_texture_bind_stats();
+    if (new_stats.switches != stats.switches ||
+        new_stats.unpacked_switches != stats.unpacked_switches) {
+        stats = new_stats;
+        text_comp.set_text(
+            TextFormat(
+                format,
+                static_cast<int>(stats.switches),
+                static_cast<int>(stats.unpacked_switches) -
+                    static_cast<int>(stats.switches)
+            )
+        );
+    }
+}
+
+void TextureSwitchReporter::draw() {
+    text_comp.draw();
+}
+
+
+// MemoryReporter
+MemoryReporter::MemoryReporter(Vector2 pos)
+    : RectangleNode({pos.x, pos.y, 0.0f, 0.0f}) {
+    add_tag("MemoryReporter");
+}
+
+void MemoryReporter::update(float dt) {
+    // Measuring is not free, thus not doing it each frame
+    since_refresh += dt;
+    if (!is_first_update && since_refresh < refresh_time) {
+        return;
+    }
+    is_first_update = false;
+    since_refresh = 0.0f;
+
+    std::string desc = "Memory:";
+    bool is_over_budget = false;
+    for (const auto& stat : get_memory_stats().collect()) {
+        desc += "\n" + stat.name + ": ";
+        // Some subsystems only know how many things they have
+        if (stat.usage.bytes > 0) {
+            desc += format_bytes(stat.usage.bytes) + " ";
+        }
+        desc += "(" + std::to_string(stat.usage.amount) + ")";
+        if (stat.budget > 0) {
+            desc += " / " + format_bytes(stat.budget);
+        }
+        is_over_budget = is_over_budget || stat.is_over_budget();
+    }
+
+    text_comp.set_text(desc);
+    text_comp.set_color(is_over_budget ? RED : DEFAULT_TEXT_COLOR);
+}
+
+void MemoryReporter::draw() {
+    text_comp.draw();
+}
+
+
 // NodeInspector
 NodeInspector::NodeInspector(LayerStorage* r)
     : RectangleNode({0.0f, 90.0f, 0.0f, 0.0f})
@@ -8,6 +8,8 @@
 #include <tuple>
 #include <unordered_map>
 #include <vector>
+#include "engine/atlas.hpp"
+#include "engine/memory_stats.hpp"
 #include "engine/utility.hpp"
 #include "engine/text.hpp"
 #include "engine/scene.hpp"
@@ -28,6 +30,8 @@ public:
 
     const TextComponent& get_text_component();
 
+    void set_text(const std::string& txt);
+
     std::string get_string();
 
     void draw() override;
@@ -37,12 +41,14 @@ class Button : public RectangleNode {
 protected:
     // TODO: move texture and text handling to the component's observer
     ButtonComponent button_comp = ButtonComponent(this);
-    const Texture2D* texture = nullptr;
+    AtlasRegion region = {nullptr, {0.0f, 0.0f, 0.0f, 0.0f}, 0};
 
 public:
     Button(Rectangle r);
 
     void set_texture(const Texture2D* t);
+    // Same, but only part of texture gets drawn (say, sprite packed into atlas)
+    void set_region(const AtlasRegion& r);
     void set_subject(ButtonState state, ButtonStateSubject* sub);
 
     ButtonStateSubject* get_subject(ButtonState state);
@@ -106,6 +112,40 @@ public:
     void draw() override;
 };
 
+// Texture switches of the last frame, and how many of these atlas saves
+class TextureSwitchReporter: public RectangleNode {
+private:
+    TextureBindStats stats;
+
+protected:
+    TextComponent text_comp = TextComponent(this);
+    const char* format = "Texture switches: %i (%i saved by atlas)";
+
+public:
+    TextureSwitchReporter();
+
+    void update(float) override;
+    void draw() override;
+};
+
+// Memory of each subsystem registered in MemoryStats, refreshed every now and
+// then. Turns red while anything is over its budget.
+class MemoryReporter: public RectangleNode {
+private:
+    float refresh_time = 0.5f;
+    float since_refresh = 0.0f;
+    bool is_first_update = true;
+
+protected:
+    TextComponent text_comp = TextComponent(this);
+
+public:
+    MemoryReporter(Vector2 pos);
+
+    void update(float dt) override;
+    void draw() override;
+};
+
 
 class LayerStorage;
 
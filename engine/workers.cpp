@@ -0,0 +1,128 @@
+#include "workers.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+WorkerPool::WorkerPool(size_t threads_amount) {
+    if (threads_amount == 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        threads_amount = cores > 1 ? cores - 1 : 1;
+    }
+
+    workers.reserve(threads_amount);
+    for (size_t i = 0; i < threads_amount; i++) {
+        workers.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+WorkerPool::WorkerPool()
+    : WorkerPool(0) {
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    has_tasks.notify_all();
+
+    for (auto& i : workers) {
+        i.join();
+    }
+}
+
+void WorkerPool::worker_loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            has_tasks.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+            // Finish whats left in queue before quitting
+            if (queue.empty()) {
+                return;
+            }
+
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        task();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(task));
+    }
+    has_tasks.notify_one();
+}
+
+size_t WorkerPool::get_threads_amount() {
+    return workers.size() + 1;
+}
+
+void WorkerPool::parallel_for(
+    size_t count,
+    size_t min_range,
+    const std::function<void(size_t begin, size_t end)>& fn) {
+    if (count == 0) {
+        return;
+    }
+
+    min_range = std::max<size_t>(min_range, 1);
+    // Few ranges per thread, so faster threads could pick up the slack
+    size_t range = std::max(min_range, count / (get_threads_amount() * 4));
+    size_t ranges_amount = (count + range - 1) / range;
+
+    if (ranges_amount == 1) {
+        fn(0, count);
+        return;
+    }
+
+    // Helper tasks may start after this function has already returned (if all
+    // work has been done by others), thus state must outlive it.
+    struct State {
+        std::atomic<size_t> next_range{0};
+        std::atomic<size_t> ranges_left{0};
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<State>();
+    state->ranges_left = ranges_amount;
+
+    auto run = [state, &fn, count, range, ranges_amount]() {
+        while (true) {
+            size_t i = state->next_range.fetch_add(1);
+            if (i >= ranges_amount) {
+                return;
+            }
+
+            fn(i * range, std::min(count, (i + 1) * range));
+
+            if (state->ranges_left.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min(workers.size(), ranges_amount - 1);
+    for (size_t i = 0; i < helpers; i++) {
+        // fn is only touched while some range is not done, and we don't return
+        // until all of them are - thus referencing it is fine.
+        submit(run);
+    }
+
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state]() { return state->ranges_left == 0; });
+}
+
+WorkerPool& get_worker_pool() {
+    static WorkerPool pool;
+    return pool;
+}
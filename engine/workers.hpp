@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Pool of background threads to offload cpu-heavy work to.
+// Unlike TaskManager, this has nothing to do with nodes or main thread - tasks
+// submitted there will run on whatever worker is free, thus they must not touch
+// raylib's window/gpu functions or any scene state.
+class WorkerPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable has_tasks;
+    bool stopping = false;
+
+    void worker_loop();
+
+public:
+    // If threads_amount is 0 - use one less than amount of cpu cores, since
+    // main thread is also busy.
+    WorkerPool(size_t threads_amount);
+    WorkerPool();
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Schedule task to be executed on some worker
+    void submit(std::function<void()> task);
+
+    // Split [0, count) into ranges of at least min_range items and call fn on
+    // each of them, in parallel. Calling thread participates too, thus this is
+    // safe to call from within other tasks. Blocks until all ranges are done.
+    void parallel_for(
+        size_t count,
+        size_t min_range,
+        const std::function<void(size_t begin, size_t end)>& fn);
+
+    // Amount of threads that may work at once, including calling one
+    size_t get_threads_amount();
+};
+
+// Shared pool, created on first use.
+WorkerPool& get_worker_pool();
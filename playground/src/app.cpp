@@ -17,6 +17,8 @@ App::App() {
     config = std::make_unique<SettingsManager>(
         toml::table{
             {"show_fps", true},
+            {"hot_reload", false},
+            {"show_memory", false},
             {"fullscreen", false},
             {"resolution", toml::array{1280, 720}},
             {"sfx_volume", 100},
@@ -39,8 +41,48 @@ App::App() {
         SetWindowSize(GetMonitorWidth(current_screen), GetMonitorHeight(current_screen));
     };
 
-    assets.sprites.load(platform->get_sprites_dir(), ".png");
-    assets.sounds.load(platform->get_sounds_dir(), ".ogg");
+    // These get decoded in background, while title screen is shown. It also
+    // uploads them to gpu, bit by bit. Sprites get packed into atlas once all
+    // of them are there.
+    assets.sprites.enable_atlas({});
+    // Decoded images and sounds are kept next to settings, so the next launch
+    // doesn't need to decode these again
+    if (assets.cache.open(platform->get_settings_dir() + "cache")) {
+        assets.sprites.set_cache(&assets.cache);
+        assets.sounds.set_cache(&assets.cache);
+    }
+    // Pack made by asset_packer is preferred, if it's there
+    std::string pack_path = platform->get_resource_dir() + "assets.pack";
+    if (FileExists(pack_path.c_str()) && assets.pack.open(pack_path)) {
+        spdlog::info("Loading assets from {}", pack_path);
+        assets.sprites.load_pack_async(assets.pack, "Sprites", ".png");
+        assets.sounds.index_pack(assets.pack, "SFX", ".ogg");
+    }
+    else {
+        assets.sprites.load_async(platform->get_sprites_dir(), ".png");
+        assets.sounds.index(platform->get_sounds_dir(), ".ogg");
+    }
+    // Sounds are loaded once some scene acquires them, and those no scene
+    // uses get evicted when there are too many
+    assets.sounds.set_budget(32 * 1024 * 1024);
+
+    // Whatever takes memory, for overlay and to be warned about going over
+    // budgets. Sprites' budget is just a guess of what low-end gpus have spare.
+    memory_sources.emplace_back(
+        "Sprites", [this]() { return assets.sprites.get_memory_usage(); });
+    memory_sources.emplace_back(
+        "Sounds", [this]() { return assets.sounds.get_memory_usage(); });
+    memory_sources.emplace_back("Nodes", [this]() {
+        return MemoryUsage{0, window.sc_mgr.get_nodes_amount()};
+    });
+    get_memory_stats().set_budget("Sprites", 256 * 1024 * 1024);
+    get_memory_stats().set_budget("Sounds", 64 * 1024 * 1024);
+
+    // Edited sprites and sounds show up without restart
+    if (config->settings["hot_reload"].value_or(false)) {
+        assets.sprites.enable_hot_reload();
+        assets.sounds.enable_hot_reload();
+    }
 }
 
 void App::run() {
@@ -54,9 +96,28 @@ void App::run() {
     // TODO: add ability to show/hide and stop/play nodes;
     // Then make this toggle on/off by, say , F9
     overlay->get_current_or_future()->add_child(new MousePosReporter());
+    overlay->get_current_or_future()->add_child(new TextureSwitchReporter());
     overlay->get_current_or_future()->add_child(new NodeInspector(scenes));
+    if (config->settings["hot_reload"].value_or(false)) {
+        overlay->get_current_or_future()->add_child(new AssetReloader(&assets));
+    }
+    if (config->settings["show_memory"].value_or(false)) {
+        overlay->get_current_or_future()->add_child(
+            new MemoryReporter({static_cast<float>(GetScreenWidth()) - 320.0f, 0.0f}));
+    }
 
     scenes->set_current(new TitleScreen(this, scenes));
 
     window.run();
+    // Scenes hold handles to assets, thus these go first
+    window.sc_mgr.clear();
+}
+
+AssetReloader::AssetReloader(AssetLoader* _assets)
+    : assets(_assets) {
+}
+
+void AssetReloader::update(float) {
+    assets->sprites.update_hot_reload(0.004f);
+    assets->sounds.update_hot_reload(0.004f);
 }
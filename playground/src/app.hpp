@@ -3,16 +3,33 @@
 #include "platform.hpp"
 
 #include <engine/core.hpp>
+#include <engine/memory_stats.hpp>
 #include <engine/settings.hpp>
 #include <engine/storage.hpp>
 
 #include <memory>
+#include <vector>
 
 struct AssetLoader {
+    // These go first, thus they are closed after storages that may still use them
+    AssetPack pack;
+    DecodedCache cache;
     SpriteStorage sprites;
     SoundStorage sounds;
 };
 
+// Swaps in assets that have changed on disk, between frames. Lives in overlay,
+// thus it works whatever scene is shown.
+class AssetReloader : public Node {
+private:
+    AssetLoader* assets;
+
+public:
+    AssetReloader(AssetLoader* _assets);
+
+    void update(float dt) override;
+};
+
 class App {
 public:
     App();
@@ -21,6 +38,8 @@ public:
 
     GameWindow window;
     AssetLoader assets;
+    // After things these measure, to be gone before them
+    std::vector<MemorySource> memory_sources;
     std::unique_ptr<SettingsManager> config;
     std::unique_ptr<Platform> platform;
 };
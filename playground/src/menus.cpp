@@ -4,6 +4,7 @@
 #include "engine/ui/ui.hpp"
 #include "engine/ui/observers.hpp"
 #include "engine/settings.hpp"
+#include "fmt/format.h"
 
 #include <functional>
 
@@ -34,13 +35,39 @@ TitleScreen::TitleScreen(App* app, LayerStorage* p)
     );
     text->set_align(Align::Center);
     ui_container->add_child(text);
+
+    progress_text = new UiText("Loading...");
+    progress_text->set_pos(
+        {
+            get_window_width() / 2.0f,
+            get_window_height() / 2.0f + 40.0f
+        }
+    );
+    progress_text->set_align(Align::Center);
+    ui_container->add_child(progress_text);
     add_child(ui_container);
 
     timer.start();
 }
 
 void TitleScreen::update(float dt) {
-    if (timer.tick(dt)) {
+    // Few milliseconds of gpu uploads per frame, so screen doesn't freeze
+    app->assets.sprites.finalize(0.004f);
+    app->assets.sounds.finalize(0.004f);
+
+    AssetLoader& assets = app->assets;
+    size_t finished = assets.sprites.get_finished() + assets.sounds.get_finished();
+    size_t requested = assets.sprites.get_requested() + assets.sounds.get_requested();
+    progress_text->set_text(fmt::format("Loading assets: {}/{}", finished, requested));
+
+    // Main menu needs these, thus waiting for everything to be loaded
+    bool is_loading = assets.sprites.is_loading() || assets.sounds.is_loading();
+    if (timer.tick(dt) && !is_loading) {
+        assets.sprites.build_atlas();
+        spdlog::info(
+            "Decoded cache: {} hits, {} misses",
+            assets.cache.get_hits(),
+            assets.cache.get_misses());
         // parent->set_current_scene(new MainMenu(app, parent));
         spdlog::info("Switching to main menu");
         parent->set_current(new MainMenu(app, parent));
@@ -77,12 +104,14 @@ MainMenu::MainMenu(App* app, LayerStorage* p)
     ButtonStateSubject* clicked_subject = b->get_subject(ButtonState::Clicked);
     // clicked_subject->register_observer(new ShutdownObserver(app));
     SoundObserver* clicked_sound = new SoundObserver();
-    clicked_sound->set_sound(app->assets.sounds["button_clicked"]);
+    clicked_sound_handle = app->assets.sounds.acquire("button_clicked"_id);
+    clicked_sound->set_sound(clicked_sound_handle.get());
     clicked_subject->register_observer(clicked_sound);
 
     ButtonStateSubject* hover_subject = b->get_subject(ButtonState::Hover);
     SoundObserver* hover_sound = new SoundObserver();
-    hover_sound->set_sound(app->assets.sounds["button_hover"]);
+    hover_sound_handle = app->assets.sounds.acquire("button_hover"_id);
+    hover_sound->set_sound(hover_sound_handle.get());
     hover_subject->register_observer(hover_sound);
 
     TextObserver* text_idle_observer = new TextObserver(b);
@@ -109,18 +138,21 @@ MainMenu::MainMenu(App* app, LayerStorage* p)
         }
     );
     UiText* text_node = new UiText("Sampletext");
+    // Button's textures are packed into atlas, thus these are regions of it
+    // Ids are hashed at compile time, thus these are just table lookups
+    SpriteStorage& sprites = app->assets.sprites;
     TextureObserver* default_texture_observer = new TextureObserver();
-    default_texture_observer->set_texture(app->assets.sprites["button_default"]);
+    default_texture_observer->set_region(sprites.get_region("button_default"_id));
     default_texture_observer->attach_to_button(texture_button);
     texture_button->get_subject(ButtonState::Idle)->register_observer(default_texture_observer);
 
     TextureObserver* hover_texture_observer = new TextureObserver();
-    hover_texture_observer->set_texture(app->assets.sprites["button_hover"]);
+    hover_texture_observer->set_region(sprites.get_region("button_hover"_id));
     hover_texture_observer->attach_to_button(texture_button);
     texture_button->get_subject(ButtonState::Hover)->register_observer(hover_texture_observer);
 
     TextureObserver* pressed_texture_observer = new TextureObserver();
-    pressed_texture_observer->set_texture(app->assets.sprites["button_pressed"]);
+    pressed_texture_observer->set_region(sprites.get_region("button_pressed"_id));
     pressed_texture_observer->attach_to_button(texture_button);
     texture_button->get_subject(ButtonState::Pressed)->register_observer(pressed_texture_observer);
 
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "engine/core.hpp"
+#include "engine/storage.hpp"
 #include "engine/utility.hpp"
 
 class App;
+class UiText;
 
 class PlaygroundScene : public Scene {
 protected:
@@ -16,6 +18,7 @@ public:
 class TitleScreen : public PlaygroundScene {
 private:
     Timer timer;
+    UiText* progress_text;
 
 public:
     TitleScreen(App* app, LayerStorage* p);
@@ -33,6 +36,9 @@ private:
     };
 
     std::unordered_map<MM_BUTTONS, Node*> buttons;
+    // Keep sounds loaded while menu is around
+    AssetHandle<Sound> clicked_sound_handle;
+    AssetHandle<Sound> hover_sound_handle;
 public:
     MainMenu(App* app, LayerStorage* p);
 };
@@ -0,0 +1,67 @@
+// Packs directory of assets into single AssetPack file.
+// Usage: asset_packer [--store] <assets directory> <pack file>
+// Files are named by their path relative to assets directory, thus
+// "Sprites/button.png" can be loaded with
+// storage.load_pack(pack, "Sprites", ".png").
+// With --store, nothing gets deflated - that's faster to unpack, but wavs and
+// other uncompressed formats take more space then.
+
+#include "engine/asset_pack.hpp"
+#include "spdlog/spdlog.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char** argv) {
+    bool compress = true;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--store") {
+            compress = false;
+        }
+        else {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.size() != 2) {
+        spdlog::error("Usage: asset_packer [--store] <assets directory> <pack file>");
+        return 1;
+    }
+
+    fs::path input = args[0];
+    fs::path output = fs::absolute(args[1]);
+    std::error_code error;
+    if (!fs::is_directory(input, error)) {
+        spdlog::error("{} is not a directory", input.string());
+        return 1;
+    }
+
+    std::vector<PackSource> sources;
+    uintmax_t total_size = 0;
+    for (const auto& item : fs::recursive_directory_iterator(input)) {
+        // Pack may be written into the directory it's made of
+        if (!item.is_regular_file() || fs::absolute(item.path()) == output) {
+            continue;
+        }
+        std::string name = fs::relative(item.path(), input).generic_string();
+        sources.push_back({name, item.path().string()});
+        total_size += item.file_size();
+    }
+
+    if (!AssetPack::write(output.string(), sources, compress)) {
+        return 1;
+    }
+
+    spdlog::info(
+        "Packed {} files ({} bytes) into {} ({} bytes)",
+        sources.size(),
+        total_size,
+        output.string(),
+        fs::file_size(output, error));
+    return 0;
+}